@@ -0,0 +1,215 @@
+#include "grep.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fmt/format.h>
+#include <iterator>
+#include <libbearpig/matchscratch.h>
+#include <libbearpig/threadpool.h>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// a worker writes its buffer out once it holds this much, always after a
+// whole line, so lines from different workers never mix
+constexpr size_t FLUSH_THRESHOLD = 64 * 1024;
+
+// files are read this many bytes at a time
+constexpr size_t READ_SIZE = 64 * 1024;
+
+// What each worker keeps across the files it searches.
+struct Worker {
+  bp::MatchScratch scratch;
+  // what was read of the current file, whole lines and one partial line
+  std::string buffer;
+  std::string output;
+};
+
+class Grep {
+public:
+  Grep(const bp::NFA &nfa, size_t num_threads)
+      : nfa{nfa}, workers(num_threads), pool{num_threads} {}
+
+  void search_path(const fs::path &path);
+  int finish();
+
+private:
+  void walk(const fs::path &directory);
+  void search_file(const fs::path &path);
+  size_t search(const std::string &name, std::string_view lines, size_t line,
+                Worker &worker);
+  void flush(std::string &output);
+  void fail(const fs::path &path, std::string_view reason);
+
+  const bp::NFA &nfa;
+  std::vector<Worker> workers;
+  std::mutex stdout_mutex;
+  std::atomic<bool> matched{false};
+  std::atomic<bool> failed{false};
+  // last, so it is joined before anything its tasks use goes away
+  bp::ThreadPool pool;
+};
+
+void Grep::search_path(const fs::path &path) {
+  std::error_code error;
+  if (fs::is_directory(path, error)) {
+    pool.submit([this, path] { walk(path); });
+  } else {
+    pool.submit([this, path] { search_file(path); });
+  }
+}
+
+// Every subdirectory is a task of its own, so idle workers can steal parts of
+// a deep tree instead of waiting for one thread to list all of it.
+void Grep::walk(const fs::path &directory) {
+  std::error_code error;
+  fs::directory_iterator it{directory, error};
+  for (; !error && it != fs::directory_iterator{}; it.increment(error)) {
+    const fs::directory_entry &entry = *it;
+    std::error_code type_error;
+    if (entry.is_symlink(type_error)) {
+      // like grep -r, links found while walking are not followed
+      continue;
+    }
+    if (entry.is_directory(type_error)) {
+      pool.submit([this, path = entry.path()] { walk(path); });
+    } else if (entry.is_regular_file(type_error)) {
+      pool.submit([this, path = entry.path()] { search_file(path); });
+    }
+  }
+  if (error) {
+    fail(directory, error.message());
+  }
+}
+
+// Files are read rather than mapped, so one that is truncated while it is
+// searched, like a log rotated with copytruncate, just ends early instead of
+// raising SIGBUS. Matches cannot span lines, so each read is searched up to
+// its last newline, and the partial line after that is moved to the front of
+// the buffer to be finished by the next read. Only a line longer than
+// READ_SIZE makes the buffer grow.
+void Grep::search_file(const fs::path &path) {
+  Worker &worker = workers[pool.current_worker()];
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fail(path, std::strerror(errno));
+    return;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  std::string name = path.string();
+  std::string &buffer = worker.buffer;
+  size_t line = 1;
+  size_t kept = 0;
+  while (true) {
+    if (buffer.size() < kept + READ_SIZE) {
+      buffer.resize(kept + READ_SIZE);
+    }
+    ssize_t got = read(fd, buffer.data() + kept, buffer.size() - kept);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      fail(path, std::strerror(errno));
+      break;
+    }
+    if (got == 0) {
+      if (kept > 0) {
+        search(name, {buffer.data(), kept}, line, worker);
+      }
+      break;
+    }
+    std::string_view data{buffer.data(), kept + static_cast<size_t>(got)};
+    // what was kept holds no newline, only what was just read can
+    size_t last_newline = data.substr(kept).rfind('\n');
+    if (last_newline == std::string_view::npos) {
+      kept = data.size();
+      continue;
+    }
+    last_newline += kept;
+    line = search(name, data.substr(0, last_newline + 1), line, worker);
+    kept = data.size() - (last_newline + 1);
+    std::memmove(buffer.data(), data.data() + last_newline + 1, kept);
+  }
+  close(fd);
+}
+
+// Searches whole lines, the first of which is numbered line, in one pass, and
+// formats each match into the worker's output as soon as it is found, which
+// is flushed whenever it fills up. Matches cannot span lines, so
+// each one is a match within its line, and lines are only counted up to where
+// the next match starts. Returns the number of the line after them.
+size_t Grep::search(const std::string &name, std::string_view lines,
+                    size_t line, Worker &worker) {
+  size_t line_start = 0;
+  size_t counted = 0;
+  auto out = std::back_inserter(worker.output);
+  size_t from = 0;
+  while (from <= lines.size()) {
+    bp::Capture match = nfa.next_match(lines, from, worker.scratch);
+    if (!match.matched()) {
+      break;
+    }
+    matched.store(true, std::memory_order_relaxed);
+    while (const void *newline = std::memchr(lines.data() + counted, '\n',
+                                             match.start - counted)) {
+      line++;
+      line_start = static_cast<const char *>(newline) - lines.data() + 1;
+      counted = line_start;
+    }
+    counted = match.start;
+    fmt::format_to(out, "{}:{}:{}:{}\n", name, line,
+                   match.start - line_start + 1, match.in(lines));
+    if (worker.output.size() >= FLUSH_THRESHOLD) {
+      flush(worker.output);
+    }
+    // the same step as find_all_matches, past an empty match by one byte
+    from = match.end > match.start ? match.end : match.end + 1;
+  }
+  return line + std::count(lines.begin() + counted, lines.end(), '\n');
+}
+
+void Grep::flush(std::string &output) {
+  std::lock_guard lock{stdout_mutex};
+  std::fwrite(output.data(), 1, output.size(), stdout);
+  output.clear();
+}
+
+void Grep::fail(const fs::path &path, std::string_view reason) {
+  failed.store(true, std::memory_order_relaxed);
+  spdlog::error("{}: {}", path.string(), reason);
+}
+
+int Grep::finish() {
+  pool.wait();
+  for (Worker &worker : workers) {
+    flush(worker.output);
+  }
+  std::fflush(stdout);
+  if (failed.load()) {
+    return 2;
+  }
+  return matched.load() ? 0 : 1;
+}
+
+} // namespace
+
+int grep(const bp::NFA &nfa, const std::vector<std::string> &paths,
+         size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  Grep grep{nfa, num_threads};
+  for (const std::string &path : paths) {
+    grep.search_path(path);
+  }
+  return grep.finish();
+}
@@ -0,0 +1,20 @@
+#ifndef GREP_H_
+#define GREP_H_
+
+#include <cstddef>
+#include <libbearpig/nfa.h>
+#include <string>
+#include <vector>
+
+// Searches the files in paths, and everything below the directories among
+// them, on num_threads workers (0 for one per core). Prints
+// file:line:column:match for every match, columns counting bytes from 1.
+// nfa should be compiled with RegexFlags::LINE_ORIENTED so that matches stay
+// within their line, and must not match the empty string.
+//
+// Returns the exit status grep would: 0 if anything matched, 1 if nothing did
+// and 2 if a path could not be read.
+int grep(const bp::NFA &nfa, const std::vector<std::string> &paths,
+         size_t num_threads);
+
+#endif // GREP_H_
@@ -1,10 +1,14 @@
+#include "grep.h"
+#include "spec.h"
 #include "libbearpig/nfagenvisitor.h"
 #include "libbearpig/printvisitor.h"
 #include <exception>
 #include <libbearpig/lib.h>
 #include <libbearpig/nfa.h>
+#include <libbearpig/queryplan.h>
 #include <libbearpig/regexparser.h>
 #include <libbearpig/regexscanner.h>
+#include <libbearpig/trace.h>
 
 #include <argparse/argparse.hpp>
 #include <spdlog/spdlog.h>
@@ -15,9 +19,31 @@ int main(int argc, char **argv) {
   std::string input(R"(abc)");
   std::string query(R"([abc\[]\[)");
   argparse::ArgumentParser program(argv[0]);
-  program.add_argument("query").help("regex to use as a query");
-  program.add_argument("input").help("input string to search");
+  program.add_argument("query")
+      .help("regex to use as a query, with -f the first file to scan")
+      .nargs(argparse::nargs_pattern::optional);
+  program.add_argument("input")
+      .help("input string to search, or with -r and -f the files")
+      .nargs(argparse::nargs_pattern::any);
+  program.add_argument("-f")
+      .help("scanner specification to build and scan the files with");
+  program.add_argument("--cache-dir")
+      .help("directory to cache the automata of the -f rules in");
   program.add_argument("-v").flag().help("enable verbose logging");
+  program.add_argument("-i", "--ignore-case")
+      .flag()
+      .help("let letters in the query match either case");
+  program.add_argument("--stats").flag().help(
+      "print matching engine counters when done");
+  program.add_argument("--plan").flag().help(
+      "print the engine chosen for the query and why");
+  program.add_argument("-r", "--recursive")
+      .flag()
+      .help("search the lines of files, and of everything below directories");
+  program.add_argument("-j", "--threads")
+      .help("worker threads for -r and -f, one per core by default")
+      .default_value(size_t{0})
+      .scan<'u', size_t>();
 
   try {
     program.parse_args(argc, argv);
@@ -30,12 +56,27 @@ int main(int argc, char **argv) {
     spdlog::set_level(spdlog::level::debug);
   }
 
+  auto inputs = program.get<std::vector<std::string>>("input");
+  if (program.is_used("-f")) {
+    if (program.is_used("query")) {
+      inputs.insert(inputs.begin(), program.get<std::string>("query"));
+    }
+    bp::RegexFlags flags = program.is_used("-i")
+                               ? bp::RegexFlags::CASE_INSENSITIVE
+                               : bp::RegexFlags::NONE;
+    std::string cache_dir = program.is_used("--cache-dir")
+                                ? program.get<std::string>("--cache-dir")
+                                : std::string{};
+    return scan_with_spec(program.get<std::string>("-f"), cache_dir, flags,
+                          inputs, program.get<size_t>("-j"));
+  }
+
   if (program.is_used("query")) {
     query = program.get<std::string>("query");
   }
 
-  if (program.is_used("input")) {
-    input = program.get<std::string>("input");
+  if (!inputs.empty() && !program.is_used("-r")) {
+    input = inputs.front();
   }
 
   bp::RegexScanner scanner{query};
@@ -62,17 +103,47 @@ int main(int argc, char **argv) {
   }
 
   bp::NFA nfa;
-  bp::NfaGenVisitor nfagen{nfa, tokens};
+  bp::RegexFlags flags = bp::RegexFlags::NONE;
+  if (program.is_used("-i") || regex_parser.ignores_case()) {
+    flags = flags | bp::RegexFlags::CASE_INSENSITIVE;
+  }
+  if (program.is_used("-r")) {
+    flags = flags | bp::RegexFlags::LINE_ORIENTED;
+  }
+  bp::NfaGenVisitor nfagen{nfa, tokens, flags};
   bp::AlternativeExp *top = regex_parser.get_top_of_expression();
   nfagen(*top);
+  if (nfagen.has_failed()) {
+    exit(1);
+  }
+  nfa.plan_query();
+  if (program.is_used("--plan")) {
+    spdlog::info("query plan:\n{}", nfa.plan()->describe());
+  }
+
+  if (program.is_used("-r")) {
+    // it would print a match at every offset of every line
+    if (nfa.properties().nullable()) {
+      spdlog::error("{} matches the empty string, which is in every line",
+                    query);
+      return 2;
+    }
+    if (inputs.empty()) {
+      inputs.push_back(".");
+    }
+    return grep(nfa, inputs, program.get<size_t>("-j"));
+  }
+
+  // the single input mode is for looking at one pattern, graphviz included
   nfa.to_dot();
 
-  auto exact_match = nfa.exact_match(input);
+  bp::MatchScratch scratch;
+  auto exact_match = nfa.exact_match(input, scratch);
   spdlog::info("found exact match: {} ({}) from {} with length {}",
                exact_match.success, exact_match.match, exact_match.start,
                exact_match.length);
 
-  auto substringmatch = nfa.find_first_match(input);
+  auto substringmatch = nfa.find_first_match(input, scratch);
   spdlog::info("found sub string match: {}", substringmatch.success);
   spdlog::info("first matched string: {}", substringmatch.match);
 
@@ -82,12 +153,35 @@ int main(int argc, char **argv) {
   spdlog::info("\033[33m{}{}\033[0m", padding, diag_line);
 
   spdlog::info("trying to find all matches.");
-  auto matches = nfa.find_all_matches(input);
+  auto matches = nfa.find_all_matches(input, scratch);
   spdlog::info("found {} matches", matches.size());
   for (auto match : matches) {
     spdlog::info("{} from {} with length {}", match.match, match.start,
                  match.length);
   }
 
+  if (bp::trace_enabled && program.is_used("-v")) {
+    auto records = bp::TraceBuffer::for_this_thread().snapshot();
+    spdlog::debug("last {} of {} trace events:", records.size(),
+                  bp::TraceBuffer::for_this_thread().total_recorded());
+    for (const bp::TraceRecord &record : records) {
+      spdlog::debug("{} {} {}", bp::to_string(record.event), record.first,
+                    record.second);
+    }
+  }
+
+  if (program.is_used("--stats")) {
+    const bp::MatchStats &stats = scratch.stats();
+    spdlog::info("bytes scanned:      {}", stats.bytes_scanned);
+    spdlog::info("candidate starts:   {}", stats.candidate_starts);
+    spdlog::info("prefilter hits:     {}", stats.prefilter_hits);
+    spdlog::info("nfa states visited: {}", stats.nfa_states_visited);
+    spdlog::info("epsilon closures:   {}", stats.epsilon_closures);
+    spdlog::info("dfa cache hits:     {}", stats.dfa_cache_hits);
+    spdlog::info("dfa cache misses:   {}", stats.dfa_cache_misses);
+    spdlog::info("dfa cache flushes:  {}", stats.dfa_cache_flushes);
+    spdlog::info("peak scratch bytes: {}", stats.peak_memory);
+  }
+
   return 0;
 }
@@ -0,0 +1,99 @@
+#include "spec.h"
+#include <cstdio>
+#include <fmt/format.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <libbearpig/scannerspec.h>
+#include <spdlog/spdlog.h>
+#include <sstream>
+
+namespace {
+
+std::optional<std::string> read_all(const std::string &path) {
+  std::ostringstream text;
+  if (path == "-") {
+    text << std::cin.rdbuf();
+    return text.str();
+  }
+  std::ifstream in{path, std::ios::binary};
+  if (!in) {
+    spdlog::error("could not open {}", path);
+    return std::nullopt;
+  }
+  text << in.rdbuf();
+  return text.str();
+}
+
+// keeps a token that spans lines on one line of output
+std::string escaped(std::string_view lexeme) {
+  std::string text;
+  for (char c : lexeme) {
+    if (c == '\n') {
+      text += "\\n";
+    } else if (c == '\t') {
+      text += "\\t";
+    } else {
+      text += c;
+    }
+  }
+  return text;
+}
+
+} // namespace
+
+int scan_with_spec(const std::filesystem::path &spec_path,
+                   const std::filesystem::path &cache_dir, bp::RegexFlags flags,
+                   const std::vector<std::string> &paths, size_t num_threads) {
+  auto spec = bp::ScannerSpec::load(spec_path);
+  if (!spec) {
+    return 2;
+  }
+  bp::ScannerSpec::BuildStats stats;
+  auto scanner = spec->build(flags, cache_dir, &stats, num_threads);
+  if (!scanner) {
+    return 2;
+  }
+  spdlog::debug("{} rules, {} compiled and {} from the cache, {} states",
+                spec->rules().size(), stats.compiled, stats.cached,
+                scanner->num_states());
+
+  std::vector<std::string> inputs = paths;
+  if (inputs.empty()) {
+    inputs.push_back("-");
+  }
+  int status = 0;
+  std::string output;
+  for (const std::string &path : inputs) {
+    auto text = read_all(path);
+    if (!text) {
+      status = 2;
+      continue;
+    }
+    size_t line = 1;
+    size_t line_start = 0;
+    for (auto token : scanner->tokenize(*text)) {
+      std::string_view lexeme{text->data() + token.start, token.length};
+      size_t column = token.start - line_start + 1;
+      if (token.rule == bp::RuleScanner::NO_RULE) {
+        fmt::format_to(std::back_inserter(output), "{}:{}:{}:?:{}\n", path,
+                       line, column, escaped(lexeme));
+        status = std::max(status, 1);
+      } else {
+        const bp::ScannerRule &rule = spec->rules()[token.rule];
+        fmt::format_to(std::back_inserter(output), "{}:{}:{}:{}:{}{}{}\n",
+                       path, line, column, rule.name, escaped(lexeme),
+                       rule.action.empty() ? "" : " ", rule.action);
+      }
+      for (size_t i = 0; i < lexeme.size(); i++) {
+        if (lexeme[i] == '\n') {
+          line++;
+          line_start = token.start + i + 1;
+        }
+      }
+    }
+    std::fwrite(output.data(), 1, output.size(), stdout);
+    output.clear();
+  }
+  return status;
+}
@@ -0,0 +1,22 @@
+#ifndef SPEC_H_
+#define SPEC_H_
+
+#include <filesystem>
+#include <libbearpig/compile.h>
+#include <string>
+#include <vector>
+
+// Builds the scanner described by the spec file on num_threads threads (0 for
+// one per core), caching each rule's automaton in cache_dir unless it is
+// empty, then scans the files in paths,
+// or standard input without any. Prints file:line:column:rule:token for every
+// token, followed by the rule's action if it has one, and
+// file:line:column:?:byte for bytes no rule matches.
+//
+// Returns 0, 1 if some byte matched no rule and 2 if the spec or a file could
+// not be read or the scanner not built.
+int scan_with_spec(const std::filesystem::path &spec,
+                   const std::filesystem::path &cache_dir, bp::RegexFlags flags,
+                   const std::vector<std::string> &paths, size_t num_threads);
+
+#endif // SPEC_H_
@@ -0,0 +1,96 @@
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fmt/format.h>
+#include <libbearpig/compile.h>
+#include <libbearpig/dfa.h>
+#include <libbearpig/scannerspec.h>
+#include <regex>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+void BM_compile(benchmark::State &state, std::string pattern) {
+  for (auto _ : state) {
+    bp::NFA nfa = bp::compile(pattern);
+    benchmark::DoNotOptimize(nfa);
+  }
+}
+
+void BM_compile_dfa(benchmark::State &state, std::string pattern) {
+  bp::NFA nfa = bp::compile(pattern);
+  for (auto _ : state) {
+    auto dfa = bp::DFA::from_nfa(nfa);
+    benchmark::DoNotOptimize(dfa);
+  }
+}
+
+void BM_compile_std_regex(benchmark::State &state, std::string pattern) {
+  for (auto _ : state) {
+    std::regex regex{pattern};
+    benchmark::DoNotOptimize(regex);
+  }
+}
+
+// Rules that determinize to over a hundred states each, which planning them
+// does, but that rarely overlap, so the scanner itself stays small.
+bp::ScannerSpec build_spec() {
+  std::string text;
+  for (char name = 'A'; name < 'Y'; name++) {
+    text += fmt::format("R{0} {0}_[a-z]*x[a-z][a-z][a-z][a-z][a-z][a-z]\n",
+                        name);
+  }
+  return *bp::ScannerSpec::parse(text);
+}
+
+// Cold compiles every rule, warm maps them all back in from the cache.
+void BM_build_spec(benchmark::State &state, bool warm) {
+  bp::ScannerSpec spec = build_spec();
+  auto cache_dir = std::filesystem::temp_directory_path() /
+                   fmt::format("bearpigbench-{}", getpid());
+  std::filesystem::remove_all(cache_dir);
+  if (warm) {
+    spec.build(bp::RegexFlags::NONE, cache_dir);
+  }
+  for (auto _ : state) {
+    if (!warm) {
+      state.PauseTiming();
+      std::filesystem::remove_all(cache_dir);
+      state.ResumeTiming();
+    }
+    bp::ScannerSpec::BuildStats stats;
+    auto scanner = spec.build(bp::RegexFlags::NONE, cache_dir, &stats, 1);
+    benchmark::DoNotOptimize(scanner);
+    state.counters["cached"] = static_cast<double>(stats.cached);
+  }
+  std::filesystem::remove_all(cache_dir);
+}
+
+const std::string LITERAL{"ERROR"};
+const std::string IPV4{R"([0-9]+\.[0-9]+\.[0-9]+\.[0-9]+)"};
+const std::string IDENTIFIER{"[a-zA-Z_][a-zA-Z0-9_]*"};
+const std::string ALTERNATION{"GET|POST|PUT|DELETE|PATCH|HEAD|OPTIONS"};
+
+// One long chain of states, which reduction must merge in about linear time.
+std::string long_literal(size_t length) {
+  std::string literal;
+  for (size_t i = 0; i < length; i++) {
+    literal += static_cast<char>('a' + i % 26);
+  }
+  return literal;
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(BM_compile, literal, LITERAL);
+BENCHMARK_CAPTURE(BM_compile, ipv4, IPV4);
+BENCHMARK_CAPTURE(BM_compile, identifier, IDENTIFIER);
+BENCHMARK_CAPTURE(BM_compile, alternation, ALTERNATION);
+BENCHMARK_CAPTURE(BM_compile, literal_1000, long_literal(1000));
+BENCHMARK_CAPTURE(BM_compile, literal_2000, long_literal(2000));
+BENCHMARK_CAPTURE(BM_compile_dfa, ipv4, IPV4);
+BENCHMARK_CAPTURE(BM_compile_dfa, identifier, IDENTIFIER);
+BENCHMARK_CAPTURE(BM_compile_std_regex, ipv4, IPV4);
+BENCHMARK_CAPTURE(BM_compile_std_regex, identifier, IDENTIFIER);
+BENCHMARK_CAPTURE(BM_build_spec, cold, false)->UseRealTime();
+BENCHMARK_CAPTURE(BM_build_spec, warm, true)->UseRealTime();
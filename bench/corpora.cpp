@@ -0,0 +1,104 @@
+#include "corpora.h"
+#include <array>
+#include <fmt/format.h>
+#include <random>
+#include <string_view>
+
+namespace bp::bench {
+
+namespace {
+constexpr unsigned SEED = 0xbea4916;
+
+template <typename T, size_t N>
+const T &pick(std::mt19937 &rng, const std::array<T, N> &choices) {
+  return choices[std::uniform_int_distribution<size_t>{0, N - 1}(rng)];
+}
+} // namespace
+
+std::string log_corpus(size_t size) {
+  static constexpr std::array<std::string_view, 4> levels{"INFO", "DEBUG",
+                                                          "WARN", "ERROR"};
+  static constexpr std::array<std::string_view, 5> paths{
+      "/index.html", "/api/v1/users", "/static/app.js", "/login",
+      "/api/v1/orders"};
+  static constexpr std::array<std::string_view, 4> users{
+      "alice@example.com", "bob@example.org", "-", "carol@example.net"};
+  std::mt19937 rng{SEED};
+  std::uniform_int_distribution<int> octet{1, 254};
+  std::uniform_int_distribution<int> status{0, 9};
+  std::uniform_int_distribution<int> millis{0, 99999};
+
+  std::string corpus;
+  corpus.reserve(size + 256);
+  while (corpus.size() < size) {
+    corpus += fmt::format(
+        "2024-05-{:02} 12:{:02}:{:02} {} {}.{}.{}.{} {} GET {} {} {}ms\n",
+        octet(rng) % 28 + 1, octet(rng) % 60, octet(rng) % 60,
+        pick(rng, levels), octet(rng), octet(rng), octet(rng), octet(rng),
+        pick(rng, users), pick(rng, paths), status(rng) == 0 ? 500 : 200,
+        millis(rng));
+  }
+  corpus.resize(size);
+  return corpus;
+}
+
+std::string source_corpus(size_t size) {
+  static constexpr std::array<std::string_view, 8> keywords{
+      "int", "return", "if", "else", "for", "while", "static", "const"};
+  static constexpr std::array<std::string_view, 8> names{
+      "count", "buffer_size", "node", "next_state", "i", "result", "tmp",
+      "parse_token"};
+  std::mt19937 rng{SEED};
+  std::uniform_int_distribution<int> kind{0, 9};
+  std::uniform_int_distribution<int> number{0, 4096};
+
+  std::string corpus;
+  corpus.reserve(size + 256);
+  while (corpus.size() < size) {
+    switch (kind(rng)) {
+    case 0:
+      corpus += fmt::format("  // {} the {}\n", pick(rng, names),
+                            pick(rng, names));
+      break;
+    case 1:
+      corpus += fmt::format("  {} ({} < {}) {{\n", pick(rng, keywords),
+                            pick(rng, names), number(rng));
+      break;
+    case 2:
+      corpus += "  }\n";
+      break;
+    default:
+      corpus += fmt::format("  {} {} = {}({}, {});\n", pick(rng, keywords),
+                            pick(rng, names), pick(rng, names),
+                            pick(rng, names), number(rng));
+    }
+  }
+  corpus.resize(size);
+  return corpus;
+}
+
+std::string random_corpus(size_t size) {
+  std::mt19937 rng{SEED};
+  std::uniform_int_distribution<int> byte{0, 255};
+  std::string corpus(size, '\0');
+  for (char &c : corpus) {
+    c = static_cast<char>(byte(rng));
+  }
+  return corpus;
+}
+
+std::string needle_corpus(size_t size, const std::string &needle,
+                          size_t spacing) {
+  std::mt19937 rng{SEED};
+  std::uniform_int_distribution<int> letter{'a', 'z'};
+  std::string corpus(size, '\0');
+  for (char &c : corpus) {
+    c = static_cast<char>(letter(rng));
+  }
+  for (size_t i = spacing / 2; i + needle.size() <= size; i += spacing) {
+    corpus.replace(i, needle.size(), needle);
+  }
+  return corpus;
+}
+
+} // namespace bp::bench
@@ -0,0 +1,23 @@
+#ifndef CORPORA_H_
+#define CORPORA_H_
+
+#include <cstddef>
+#include <string>
+
+// Synthetic inputs for the benchmarks. Everything is generated from a fixed
+// seed, so runs are repeatable and nothing has to be downloaded.
+namespace bp::bench {
+
+// web server style access and application log lines
+std::string log_corpus(size_t size);
+// C-like source code with identifiers, keywords, numbers and comments
+std::string source_corpus(size_t size);
+// uniformly random bytes, including zero and non-ASCII
+std::string random_corpus(size_t size);
+// lowercase filler with `needle` spliced in every `spacing` bytes
+std::string needle_corpus(size_t size, const std::string &needle,
+                          size_t spacing);
+
+} // namespace bp::bench
+
+#endif // CORPORA_H_
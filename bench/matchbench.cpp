@@ -0,0 +1,458 @@
+#include "corpora.h"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+#include <libbearpig/compile.h>
+#include <libbearpig/dfa.h>
+#include <libbearpig/inputbuffer.h>
+#include <libbearpig/jit.h>
+#include <libbearpig/regexset.h>
+#include <libbearpig/replace.h>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Throughput of the three matching entry points on the synthetic corpora.
+// Every engine is run on the same pattern and input: the NFA with its lazy
+// DFA, the fully determinized DFA, that DFA compiled to native code, whatever
+// the query planner picks and std::regex as a baseline. Note that
+// std::regex is leftmost-first while bearpig is leftmost-longest, so match
+// counts can differ for patterns with ambiguous alternatives.
+
+namespace {
+
+using Corpus = std::string (*)(size_t);
+
+std::string sparse_corpus(size_t size) {
+  return bp::bench::needle_corpus(size, "needle", 4096);
+}
+
+std::string dense_corpus(size_t size) {
+  return bp::bench::needle_corpus(size, "needle", 16);
+}
+
+// the exact_match benchmarks need a line that matches as a whole
+std::string repeated(size_t size, std::string_view unit) {
+  std::string input;
+  input.reserve(size);
+  while (input.size() + unit.size() <= size) {
+    input += unit;
+  }
+  return input;
+}
+
+template <typename Engine>
+void BM_find_all(benchmark::State &state, std::string pattern, Corpus corpus) {
+  Engine engine{pattern};
+  std::string input = corpus(state.range(0));
+  size_t matches = 0;
+  for (auto _ : state) {
+    matches = engine.count_all(input);
+    benchmark::DoNotOptimize(matches);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+  state.counters["matches"] = matches;
+}
+
+template <typename Engine>
+void BM_find_first(benchmark::State &state, std::string pattern,
+                   Corpus corpus) {
+  Engine engine{pattern};
+  std::string input = corpus(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(engine.first(input));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+// is_match and count_matches where the engine has them
+template <typename Engine>
+void BM_is_match(benchmark::State &state, std::string pattern,
+                 Corpus corpus) {
+  Engine engine{pattern};
+  std::string input = corpus(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(engine.any(input));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+template <typename Engine>
+void BM_count(benchmark::State &state, std::string pattern, Corpus corpus) {
+  Engine engine{pattern};
+  std::string input = corpus(state.range(0));
+  size_t matches = 0;
+  for (auto _ : state) {
+    matches = engine.count(input);
+    benchmark::DoNotOptimize(matches);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+  state.counters["matches"] = matches;
+}
+
+template <typename Engine>
+void BM_exact(benchmark::State &state, std::string pattern, std::string unit) {
+  Engine engine{pattern};
+  std::string input = repeated(state.range(0), unit);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(engine.exact(input));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+// (a|aa)*b and friends never match a run of a's, so every start position
+// explores the whole remaining input
+template <typename Engine>
+void BM_pathological(benchmark::State &state, std::string pattern) {
+  Engine engine{pattern};
+  std::string input(state.range(0), 'a');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(engine.first(input));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+template <bp::RegexFlags Flags> struct NfaEngine {
+  bp::NFA nfa;
+  explicit NfaEngine(const std::string &pattern)
+      : nfa{bp::compile(pattern, Flags)} {}
+  size_t count_all(std::string_view input) {
+    return nfa.find_all_matches(input).size();
+  }
+  bool first(std::string_view input) {
+    return nfa.find_first_match(input).success;
+  }
+  bool exact(std::string_view input) { return nfa.exact_match(input).success; }
+  bool any(std::string_view input) { return nfa.is_match(input); }
+  size_t count(std::string_view input) { return nfa.count_matches(input); }
+};
+
+struct DfaEngine {
+  bp::DFA dfa;
+  explicit DfaEngine(const std::string &pattern)
+      : dfa{*bp::DFA::from_nfa(bp::compile(pattern))} {}
+  size_t count_all(std::string_view input) {
+    return dfa.find_all_matches(input).size();
+  }
+  bool first(std::string_view input) {
+    return dfa.find_first_match(input).success;
+  }
+  bool exact(std::string_view input) { return dfa.exact_match(input).success; }
+  bool any(std::string_view input) { return dfa.is_match(input); }
+  size_t count(std::string_view input) { return dfa.count_matches(input); }
+};
+
+struct JitEngine {
+  bp::JitDFA jit;
+  explicit JitEngine(const std::string &pattern)
+      : jit{*bp::DFA::from_nfa(bp::compile(pattern))} {}
+  size_t count_all(std::string_view input) {
+    return jit.find_all_matches(input).size();
+  }
+  bool first(std::string_view input) {
+    return jit.find_first_match(input).success;
+  }
+  bool exact(std::string_view input) { return jit.exact_match(input).success; }
+  bool any(std::string_view input) { return jit.is_match(input); }
+  size_t count(std::string_view input) { return jit.count_matches(input); }
+};
+
+struct StdRegexEngine {
+  std::regex regex;
+  // std::regex has no inline flags, (?i) becomes icase
+  explicit StdRegexEngine(const std::string &pattern)
+      : regex{pattern.starts_with("(?i)") ? pattern.substr(4) : pattern,
+              pattern.starts_with("(?i)") ? std::regex::icase
+                                          : std::regex::ECMAScript} {}
+  size_t count_all(const std::string &input) {
+    return std::distance(
+        std::sregex_iterator{input.begin(), input.end(), regex},
+        std::sregex_iterator{});
+  }
+  bool first(const std::string &input) {
+    return std::regex_search(input, regex);
+  }
+  bool exact(const std::string &input) {
+    return std::regex_match(input, regex);
+  }
+  bool any(const std::string &input) { return first(input); }
+  size_t count(const std::string &input) { return count_all(input); }
+};
+
+constexpr int64_t SMALL = 64 << 10;
+constexpr int64_t LARGE = 1 << 20;
+
+const std::string IPV4{R"([0-9]+\.[0-9]+\.[0-9]+\.[0-9]+)"};
+const std::string EMAIL{R"([a-z]+@[a-z]+\.(com|org|net))"};
+const std::string IDENTIFIER{"[a-zA-Z_][a-zA-Z0-9_]*"};
+
+struct SearchWorkload {
+  std::string name;
+  std::string pattern;
+  Corpus corpus;
+};
+
+struct ExactWorkload {
+  std::string name;
+  std::string pattern;
+  std::string unit;
+};
+
+// Registers every workload once per engine, named like
+// find_all/nfa/logs_ipv4/65536. std::regex only gets the smaller input.
+template <typename Engine>
+void register_engine(const std::string &engine, bool large_inputs) {
+  const std::vector<SearchWorkload> find_all{
+      {"logs_ipv4", IPV4, bp::bench::log_corpus},
+      {"logs_email", EMAIL, bp::bench::log_corpus},
+      {"logs_error", "ERROR", bp::bench::log_corpus},
+      {"logs_error_caseless", "(?i)error", bp::bench::log_corpus},
+      {"source_identifier", IDENTIFIER, bp::bench::source_corpus},
+      {"source_return", "return", bp::bench::source_corpus},
+      {"random_digits", "[0-9]+", bp::bench::random_corpus},
+      {"sparse_needle", "needle", sparse_corpus},
+      {"dense_needle", "needle", dense_corpus},
+  };
+  const std::vector<SearchWorkload> find_first{
+      // patterns cannot contain spaces yet
+      {"logs_status_500", "500", bp::bench::log_corpus},
+      {"random_absent", "needle", bp::bench::random_corpus},
+  };
+  const std::vector<ExactWorkload> exact{
+      {"identifier_line", IDENTIFIER, "parse_token_2"},
+      {"alternation_line", "(ab|cd|ef)+", "abcdef"},
+  };
+
+  auto sizes = [large_inputs](benchmark::internal::Benchmark *bench) {
+    bench->Arg(SMALL);
+    if (large_inputs) {
+      bench->Arg(LARGE);
+    }
+  };
+  for (const auto &w : find_all) {
+    sizes(benchmark::RegisterBenchmark(
+        ("find_all/" + engine + "/" + w.name).c_str(),
+        BM_find_all<Engine>, w.pattern, w.corpus));
+  }
+  for (const auto &w : find_first) {
+    sizes(benchmark::RegisterBenchmark(
+        ("find_first/" + engine + "/" + w.name).c_str(),
+        BM_find_first<Engine>, w.pattern, w.corpus));
+  }
+  for (const auto &w : find_first) {
+    sizes(benchmark::RegisterBenchmark(
+        ("is_match/" + engine + "/" + w.name).c_str(), BM_is_match<Engine>,
+        w.pattern, w.corpus));
+  }
+  for (const auto &w : find_all) {
+    sizes(benchmark::RegisterBenchmark(
+        ("count/" + engine + "/" + w.name).c_str(), BM_count<Engine>,
+        w.pattern, w.corpus));
+  }
+  for (const auto &w : exact) {
+    sizes(benchmark::RegisterBenchmark(
+        ("exact/" + engine + "/" + w.name).c_str(), BM_exact<Engine>,
+        w.pattern, w.unit));
+  }
+
+  for (std::string pattern : {"(a|aa)*b", "(a*)*b"}) {
+    auto *bench = benchmark::RegisterBenchmark(
+        ("pathological/" + engine + "/" + pattern).c_str(),
+        BM_pathological<Engine>, pattern);
+    if (large_inputs) {
+      bench->RangeMultiplier(4)->Range(16, 4096);
+    } else {
+      // backtracking blows up quickly, keep the inputs short
+      bench->DenseRange(8, 24, 8);
+    }
+  }
+}
+
+// Lexes the source corpus out of an InputBuffer smaller than the input, the
+// way a scanner reading a file would, skipping what no token matches.
+void BM_match_tokens(benchmark::State &state) {
+  bp::NFA nfa = bp::compile("[a-zA-Z_][a-zA-Z0-9_]*|[0-9]+");
+  std::istringstream source{bp::bench::source_corpus(state.range(0))};
+  size_t tokens = 0;
+  for (auto _ : state) {
+    source.clear();
+    source.seekg(0);
+    bp::InputBuffer input{source, 16 * 1024};
+    tokens = 0;
+    while (!input.at_end()) {
+      if (nfa.match_token(input)) {
+        tokens++;
+      } else {
+        input.skip();
+      }
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+  state.counters["tokens"] = tokens;
+}
+BENCHMARK(BM_match_tokens)->Arg(SMALL)->Arg(LARGE);
+
+// Classifies log lines against state.range(0) patterns, once with a RegexSet
+// and once asking every pattern on its own.
+std::vector<std::string> classifier_patterns(size_t count) {
+  std::vector<std::string> patterns;
+  for (size_t i = 0; i < count; i++) {
+    patterns.push_back(fmt::format("12:{:02}:{:02}.(WARN|ERROR)", i % 60,
+                                   i * 7 % 60));
+  }
+  return patterns;
+}
+
+std::vector<std::string> log_lines() {
+  std::vector<std::string> lines;
+  std::istringstream corpus{bp::bench::log_corpus(SMALL)};
+  for (std::string line; std::getline(corpus, line);) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+void BM_classify_set(benchmark::State &state) {
+  auto set = bp::RegexSet::compile(classifier_patterns(state.range(0)));
+  std::vector<std::string> lines = log_lines();
+  size_t matches = 0;
+  for (auto _ : state) {
+    matches = 0;
+    for (const std::string &line : lines) {
+      matches += set->matches(line).count();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * lines.size());
+  state.counters["matches"] = matches;
+}
+BENCHMARK(BM_classify_set)->Arg(16)->Arg(256);
+
+void BM_classify_each(benchmark::State &state) {
+  std::vector<bp::NFA> nfas;
+  for (auto &nfa : bp::compile_all(classifier_patterns(state.range(0)))) {
+    nfas.push_back(std::move(*nfa));
+  }
+  std::vector<std::string> lines = log_lines();
+  size_t matches = 0;
+  for (auto _ : state) {
+    matches = 0;
+    for (const std::string &line : lines) {
+      for (const bp::NFA &nfa : nfas) {
+        matches += nfa.is_match(line);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * lines.size());
+  state.counters["matches"] = matches;
+}
+BENCHMARK(BM_classify_each)->Arg(16)->Arg(256);
+
+// Matches whole log lines one at a time and in lockstep batches.
+const std::string RECORD_PATTERN{".*(WARN|ERROR).*/api/v1/(users|orders).*"};
+
+void BM_exact_each(benchmark::State &state) {
+  auto dfa = bp::DFA::from_nfa(bp::compile(RECORD_PATTERN));
+  std::vector<std::string> lines = log_lines();
+  size_t matches = 0;
+  for (auto _ : state) {
+    matches = 0;
+    for (const std::string &line : lines) {
+      matches += dfa->exact_match(line).success;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * lines.size());
+  state.counters["matches"] = matches;
+}
+BENCHMARK(BM_exact_each);
+
+void BM_exact_batch(benchmark::State &state) {
+  auto dfa = bp::DFA::from_nfa(bp::compile(RECORD_PATTERN));
+  std::vector<std::string> lines = log_lines();
+  std::vector<std::string_view> records{lines.begin(), lines.end()};
+  size_t matches = 0;
+  for (auto _ : state) {
+    std::vector<bool> matched = dfa->exact_match_batch(records);
+    matches = std::count(matched.begin(), matched.end(), true);
+  }
+  state.SetItemsProcessed(state.iterations() * lines.size());
+  state.counters["matches"] = matches;
+}
+BENCHMARK(BM_exact_batch);
+
+// Searches logs with one big alternation, state.range(0) says whether its
+// DFA was reordered by a profile of a smaller sample of the same logs first.
+void BM_find_reordered(benchmark::State &state) {
+  std::string pattern;
+  for (const std::string &alternative : classifier_patterns(256)) {
+    pattern += (pattern.empty() ? "" : "|") + alternative;
+  }
+  auto dfa = bp::DFA::from_nfa(bp::compile(pattern));
+  if (state.range(0) != 0) {
+    std::string sample = bp::bench::log_corpus(SMALL);
+    std::string_view corpus[] = {sample};
+    dfa = dfa->reordered(dfa->profile(corpus));
+  }
+  std::string input = bp::bench::log_corpus(LARGE);
+  size_t matches = 0;
+  for (auto _ : state) {
+    matches = dfa->find_all_matches(input).size();
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+  state.counters["matches"] = matches;
+  state.counters["states"] = dfa->num_states();
+}
+BENCHMARK(BM_find_reordered)->Arg(0)->Arg(1);
+
+// Redacts the email addresses in the logs, once by rebuilding the output from
+// find_all_matches and once with replace_all. Copying the logs is the bound.
+void BM_redact_by_hand(benchmark::State &state) {
+  bp::NFA email = bp::compile(EMAIL);
+  std::string input = bp::bench::log_corpus(LARGE);
+  for (auto _ : state) {
+    std::string out;
+    size_t copied = 0;
+    for (const bp::RegexMatch &match : email.find_all_matches(input)) {
+      out += input.substr(copied, match.start - copied);
+      out += "<email>";
+      copied = match.start + match.length;
+    }
+    out += input.substr(copied);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_redact_by_hand);
+
+void BM_redact_replace_all(benchmark::State &state) {
+  bp::NFA email = bp::compile(EMAIL);
+  std::string input = bp::bench::log_corpus(LARGE);
+  for (auto _ : state) {
+    std::string out;
+    bp::replace_all(email, input, "<email>", out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_redact_replace_all);
+
+void BM_redact_copy_only(benchmark::State &state) {
+  std::string input = bp::bench::log_corpus(LARGE);
+  for (auto _ : state) {
+    std::string out{input};
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_redact_copy_only);
+
+const bool registered = [] {
+  register_engine<NfaEngine<bp::RegexFlags::NFA_ONLY>>("nfa", true);
+  register_engine<DfaEngine>("dfa", true);
+  register_engine<JitEngine>("jit", true);
+  register_engine<NfaEngine<bp::RegexFlags::NONE>>("planned", true);
+  register_engine<StdRegexEngine>("std_regex", false);
+  return true;
+}();
+
+} // namespace
@@ -0,0 +1,61 @@
+#ifndef COMPILE_H_
+#define COMPILE_H_
+
+#include <libbearpig/nfa.h>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+class ThreadPool;
+
+enum class RegexFlags : unsigned {
+  NONE = 0,
+  // skip the query planner and always run the NFA, to compare engines
+  NFA_ONLY = 1 << 0,
+  // letters match either case, same as starting the pattern with (?i). This
+  // covers ASCII, Latin-1 with ÿ and Ÿ, Greek with the final sigma and the
+  // basic Cyrillic alphabet, each letter to the ones of the same alphabet.
+  CASE_INSENSITIVE = 1 << 1,
+  // matches never span lines: . and negative sets leave out newlines
+  LINE_ORIENTED = 1 << 2,
+};
+
+constexpr RegexFlags operator|(RegexFlags a, RegexFlags b) {
+  return static_cast<RegexFlags>(static_cast<unsigned>(a) |
+                                 static_cast<unsigned>(b));
+}
+
+constexpr bool has_flag(RegexFlags flags, RegexFlags flag) {
+  return (static_cast<unsigned>(flags) & static_cast<unsigned>(flag)) != 0;
+}
+
+// Runs the whole RegexScanner -> RegexParser -> NfaGenVisitor pipeline for a
+// single pattern. Tokens and AST live in an arena that is thrown away once the
+// NFA is built, which is then planned unless flags hold NFA_ONLY. Errors in
+// the pattern are logged and give nullopt.
+std::optional<NFA> try_compile(std::string_view pattern,
+                               RegexFlags flags = RegexFlags::NONE);
+// For patterns that are part of the program. An error in one is logged and
+// ends it, use try_compile() for patterns that come from outside.
+NFA compile(std::string_view pattern, RegexFlags flags = RegexFlags::NONE);
+
+// Compiles many patterns at once, spread over the workers of a thread pool.
+// The NFA of patterns[i] is always the i-th result, nullopt if it has an
+// error, like try_compile(). Compiling a pattern does not depend on what
+// else runs, so the results are the same for any number of threads. Must
+// not be called from one of pool's own tasks.
+std::vector<std::optional<NFA>>
+compile_all(std::span<const std::string> patterns, RegexFlags flags,
+            ThreadPool &pool);
+// on a pool of its own, 0 threads meaning one per core
+std::vector<std::optional<NFA>>
+compile_all(std::span<const std::string> patterns,
+            RegexFlags flags = RegexFlags::NONE, size_t num_threads = 0);
+
+} // namespace bp
+
+#endif // COMPILE_H_
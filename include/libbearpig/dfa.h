@@ -0,0 +1,124 @@
+#ifndef DFA_H_
+#define DFA_H_
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <libbearpig/nfa.h>
+#include <libbearpig/statetable.h>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+// A fully determinized NFA: one row per state and one column per byte class,
+// with state ids no wider than the number of states needs, see StateTable.
+// Unlike the lazy DFA in MatchScratch it is built once up front and needs no
+// scratch to match, at the price of possibly exponential size, which is why
+// from_nfa() gives up beyond max_states.
+//
+// Like NFA, the tables are either owned or point into a mapped file.
+class DFA {
+public:
+  static constexpr uint32_t DEAD = 0;
+
+  static std::optional<DFA> from_nfa(const NFA &nfa,
+                                     size_t max_states = 10000);
+
+  RegexMatch exact_match(std::string_view input) const;
+  RegexMatch find_first_match(std::string_view input) const;
+  std::vector<RegexMatch> find_all_matches(std::string_view input) const;
+  // like NFA's, but tried from every start in turn, each attempt stopping at
+  // the first accepting state
+  bool is_match(std::string_view input) const;
+  size_t count_matches(std::string_view input) const;
+  // see NFA::next_match
+  Capture next_match(std::string_view input, size_t from) const;
+
+  // For many short inputs, like the records of a log: whether each of them
+  // matches as a whole, the same as exact_match(input).success. BATCH_LANES
+  // inputs are walked in lockstep, so the table loads of different inputs
+  // are in flight together instead of each waiting on the one before. Tables
+  // too large for the cache are prefetched a step ahead as well.
+  std::vector<bool>
+  exact_match_batch(std::span<const std::string_view> inputs) const;
+  static constexpr size_t BATCH_LANES = 8;
+  static constexpr size_t PREFETCH_TABLE_BYTES = 256 * 1024;
+
+  // How often matching used each state and transition, see profile().
+  struct Profile {
+    std::vector<uint64_t> state_visits;
+    // by table entry, state * num_classes + byte class
+    std::vector<uint64_t> transitions;
+    // the fewest states that account for coverage of all visits
+    size_t hot_states(double coverage = 0.99) const;
+  };
+  // Runs the searches find_all_matches() would run on every input of corpus
+  // and counts the states and transitions they use.
+  Profile profile(std::span<const std::string_view> corpus) const;
+  // The same automaton with its states renumbered hottest first, by a
+  // profile of this DFA on representative input. The rows matching reads
+  // most then sit next to each other at the start of the table, which keeps
+  // them in cache when the whole table does not fit. Unvisited states keep
+  // their order behind them and DEAD stays 0.
+  DFA reordered(const Profile &profile) const;
+
+  size_t num_states() const { return accepting.size(); }
+  // those of the NFA the DFA was built from
+  const PatternProperties &properties() const { return analysis; }
+  // bytes per state id in the transition table
+  size_t state_width() const { return table.width(); }
+
+private:
+  friend struct Serializer;
+  friend class QueryPlan;
+  friend class JitDFA;
+  DFA() = default;
+
+  uint32_t next_state(uint32_t state, unsigned char byte) const {
+    return table[state * num_classes + byte_classes[byte]];
+  }
+  bool can_start_with(unsigned char byte) const {
+    return starts_with_any || analysis.first_bytes.test(byte);
+  }
+  // see NFA::next_start
+  size_t next_start(std::string_view input, size_t i, size_t limit) const {
+    for (size_t end = std::min(limit, input.size());
+         i < end && !can_start_with(input[i]); i++)
+      ;
+    return i;
+  }
+  RegexMatch run_dfa(std::string_view input, bool exact,
+                     size_t start_id) const;
+  static constexpr size_t NO_MATCH = SIZE_MAX;
+  size_t longest_match(std::string_view input, bool exact) const;
+  bool matches_prefix(std::string_view input) const;
+  // the loops behind the two above, for each width of table
+  template <typename StateId>
+  size_t longest_match(std::span<const StateId> ids, std::string_view input,
+                       bool exact) const;
+  template <typename StateId>
+  bool matches_prefix(std::span<const StateId> ids,
+                      std::string_view input) const;
+  template <bool Prefetch, typename StateId>
+  void exact_match_lanes(std::span<const StateId> ids,
+                         std::span<const std::string_view> inputs,
+                         std::vector<bool> &results) const;
+
+  uint32_t start{DEAD};
+  size_t num_classes{1};
+  std::array<uint8_t, 256> byte_classes{};
+  PatternProperties analysis;
+  bool starts_with_any{false};
+  // state * num_classes + byte class -> next state
+  StateTable table;
+  std::span<const uint8_t> accepting;
+  std::shared_ptr<const void> storage;
+};
+
+} // namespace bp
+
+#endif // DFA_H_
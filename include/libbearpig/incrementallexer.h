@@ -0,0 +1,121 @@
+#ifndef INCREMENTALLEXER_H_
+#define INCREMENTALLEXER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <libbearpig/matchscratch.h>
+#include <libbearpig/nfa.h>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+struct LexedToken {
+  size_t start;
+  size_t length;
+  // Bytes looked at to find the token. The longest match reads on until the
+  // automaton dies, so this can reach past the token, and an edit there can
+  // change it.
+  size_t scanned;
+  // false for a single byte that no token matches
+  bool matched;
+  size_t end() const { return start + length; }
+  size_t reach() const { return start + scanned; }
+};
+
+// Splits a text into the longest tokens of one pattern, typically an
+// alternation of token rules, and keeps them up to date as the text is
+// edited, for editors and language servers.
+//
+// The tokens are kept in chunks of about checkpoint_interval tokens, each
+// starting at a checkpoint that records where its first token starts and how
+// far the tokens before it looked. An edit is relexed from the last
+// checkpoint whose tokens all stopped looking before the edit, and relexing
+// stops at the first token boundary past the edit that was also a boundary in
+// the old text. Every token starts in the start state of the automaton, so
+// from there on the old tokens are still right, only shifted.
+//
+// Tokens are stored relative to their checkpoint and the checkpoints after an
+// edit are shifted lazily, so only the chunks the edit touched are rewritten.
+// Lexing work and the time an edit takes are proportional to the edit, not
+// to the text, as long as edits stay near each other. Moving to an edit
+// elsewhere costs a step per checkpoint in between.
+class IncrementalLexer {
+public:
+  struct Edit {
+    // bytes [start, start + removed) of the old text were replaced by
+    // inserted bytes
+    size_t start;
+    size_t removed;
+    size_t inserted;
+  };
+  // Tokens [first, first + removed) of the old stream were replaced by
+  // [first, first + inserted) of the new one.
+  struct Change {
+    size_t first;
+    size_t removed;
+    size_t inserted;
+  };
+
+  explicit IncrementalLexer(const NFA &nfa, size_t checkpoint_interval = 64)
+      : nfa{nfa}, interval{std::max<size_t>(checkpoint_interval, 1)},
+        chunks(1) {}
+
+  // Lexes text from the start.
+  void lex(std::string_view text);
+  // Brings the tokens up to date with text, the old text after edit.
+  Change relex(std::string_view text, Edit edit);
+
+  size_t num_tokens() const;
+  LexedToken token(size_t index) const;
+  // a copy of every token, which takes time proportional to the text
+  std::vector<LexedToken> tokens() const;
+  // bytes lexed by the last lex or relex, to see what an edit cost
+  size_t bytes_lexed() const { return last_bytes_lexed; }
+  // checkpoints the last lex or relex wrote, shifted or fixed the reach of,
+  // the rest of what an edit cost
+  size_t checkpoints_written() const { return last_checkpoints_written; }
+
+private:
+  struct Checkpoint {
+    size_t token;
+    size_t offset;
+    // the furthest any token before this one looked
+    size_t reach;
+  };
+  struct Chunk {
+    Checkpoint checkpoint;
+    // starts relative to the checkpoint's offset
+    std::vector<LexedToken> tokens;
+  };
+
+  LexedToken next_token(std::string_view text, size_t at);
+  // chunk's checkpoint with the pending shift applied
+  Checkpoint checkpoint(size_t chunk) const;
+  // the last chunk whose checkpoint is at or before token or offset
+  size_t chunk_of_token(size_t token) const;
+  size_t chunk_of_offset(size_t offset) const;
+  void shift_from(size_t chunk);
+  size_t replace_chunks(size_t first, size_t count, Checkpoint checkpoint,
+                        std::span<const LexedToken> tokens);
+
+  const NFA &nfa;
+  size_t interval;
+  MatchScratch scratch;
+  // never empty, only chunk 0 can hold no tokens
+  std::vector<Chunk> chunks;
+  // The checkpoints of chunks from shifted on are pending_tokens tokens and
+  // pending_bytes bytes further along than they say, the sum of the edits
+  // made before them since they were last written. These wrap around for
+  // edits that removed more than they inserted.
+  size_t shifted{1};
+  size_t pending_tokens{0};
+  size_t pending_bytes{0};
+  size_t last_bytes_lexed{0};
+  size_t last_checkpoints_written{0};
+};
+
+} // namespace bp
+
+#endif // INCREMENTALLEXER_H_
@@ -0,0 +1,79 @@
+#ifndef INPUTBUFFER_H_
+#define INPUTBUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+struct NFA;
+
+// Input for matching tokens one after another straight from a file
+// descriptor or an istream, without reading all of it into memory first. Like
+// flex's buffers it is a fixed size window that is refilled as matching runs
+// off its end: the bytes of the token being matched are slid to the front and
+// the rest of the window is filled from the source. Only a token longer than
+// the window makes it grow.
+//
+// The byte past the data in the window is always SENTINEL, so the matching
+// loop only checks whether it ran out of data when it reads that byte value,
+// see NFA::match_token. Input may contain SENTINEL bytes of its own, they just
+// cost that check.
+class InputBuffer {
+public:
+  static constexpr char SENTINEL = '\0';
+  static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+
+  // The descriptor is read with read(2) and stays open, the caller closes it.
+  explicit InputBuffer(int fd, size_t capacity = DEFAULT_CAPACITY);
+  explicit InputBuffer(std::istream &in, size_t capacity = DEFAULT_CAPACITY);
+
+  // The last token matched, valid until the next match, skip or at_end.
+  std::string_view token() const {
+    return {window.data() + token_begin, token_length};
+  }
+  // position of token() in the whole input
+  uint64_t token_offset() const { return window_offset + token_begin; }
+  // position in the whole input the next token is matched from
+  uint64_t offset() const { return window_offset + mark; }
+
+  // Whether all input has been consumed. Reads more if it has to find out.
+  bool at_end();
+  // Steps over up to count bytes no token matched. Returns how many it
+  // skipped, fewer only at the end of input.
+  size_t skip(size_t count = 1);
+
+  // errno of a failed read, which ends the input early, or 0
+  int error() const { return read_error; }
+  size_t capacity() const { return window.size() - 1; }
+
+private:
+  friend struct NFA;
+
+  // Slides everything from mark on to the front and reads more after it.
+  // Returns false once the source is exhausted.
+  bool refill();
+  size_t read_some(char *into, size_t max);
+
+  int fd{-1};
+  std::istream *stream{nullptr};
+  // capacity bytes of data and the sentinel after them
+  std::vector<char> window;
+  uint64_t window_offset{0};
+  // the last token, where the next one starts, where matching has read up to
+  // and where the data ends, all indices into window
+  size_t token_begin{0};
+  size_t token_length{0};
+  size_t mark{0};
+  size_t cursor{0};
+  size_t limit{0};
+  bool exhausted{false};
+  int read_error{0};
+};
+
+} // namespace bp
+
+#endif // INPUTBUFFER_H_
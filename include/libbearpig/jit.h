@@ -0,0 +1,66 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <cstddef>
+#include <libbearpig/dfa.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+// A DFA compiled to native code. Every state becomes a block of x86-64 that
+// reads a byte and branches straight to the block of the next state, through
+// a few compare-and-branches when the state has few distinct successors and
+// through a jump table otherwise. A state that loops on some bytes checks
+// those first and is unrolled four times over while enough input is left, so
+// runs like [a-z]* stay in a tight loop. The code lives in pages of its own
+// that are mapped executable once it is written, never writable and
+// executable at once.
+//
+// Where there is no JIT, because the library was built with BEARPIG_JIT=OFF,
+// not for x86-64, or mapping the pages failed, the same methods run the DFA's
+// tables instead, see is_native().
+class JitDFA {
+public:
+  struct Options {
+    // Appends a symbol per state to /tmp/perf-<pid>.map so that perf and
+    // other profilers can name the generated code.
+    bool perf_map{false};
+    // prefix of those symbols
+    std::string name{"bearpig_dfa"};
+  };
+
+  explicit JitDFA(DFA dfa) : JitDFA(std::move(dfa), Options{}) {}
+  JitDFA(DFA dfa, const Options &options);
+
+  RegexMatch exact_match(std::string_view input) const;
+  RegexMatch find_first_match(std::string_view input) const;
+  std::vector<RegexMatch> find_all_matches(std::string_view input) const;
+  bool is_match(std::string_view input) const;
+  size_t count_matches(std::string_view input) const;
+
+  // whether matching runs generated code rather than the tables
+  bool is_native() const { return code != nullptr; }
+  size_t code_size() const { return code_bytes; }
+
+private:
+  static constexpr size_t NO_MATCH = SIZE_MAX;
+  // Returns the length of the longest match at the start of [begin, end), or
+  // of the shortest one if first is set, and NO_MATCH if there is none.
+  using MatchFunction = size_t (*)(const unsigned char *begin,
+                                   const unsigned char *end, int first);
+
+  size_t longest_match(std::string_view input, bool first) const;
+  RegexMatch run(std::string_view input, bool exact, size_t start_id) const;
+
+  DFA dfa;
+  std::shared_ptr<const void> code;
+  MatchFunction entry{nullptr};
+  size_t code_bytes{0};
+};
+
+} // namespace bp
+
+#endif // JIT_H_
@@ -0,0 +1,182 @@
+#ifndef MATCHSCRATCH_H_
+#define MATCHSCRATCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace bp {
+
+struct NFA;
+
+// Counters gathered by a MatchScratch while matching. They are plain integers
+// bumped by the thread owning the scratch, so collecting them costs next to
+// nothing. Per-thread stats can be summed with +=.
+struct MatchStats {
+  // bytes fed through the automaton, bytes skipped by the prefilter excluded
+  uint64_t bytes_scanned{0};
+  // positions a match was attempted from
+  uint64_t candidate_starts{0};
+  // positions the first-byte prefilter stopped at
+  uint64_t prefilter_hits{0};
+  // NFA states stepped while building DFA states
+  uint64_t nfa_states_visited{0};
+  uint64_t epsilon_closures{0};
+  uint64_t dfa_cache_hits{0};
+  uint64_t dfa_cache_misses{0};
+  uint64_t dfa_cache_flushes{0};
+  // largest memory footprint of the scratch, in bytes
+  size_t peak_memory{0};
+
+  MatchStats &operator+=(const MatchStats &other);
+};
+
+// Mutable working memory for matching: the state sets used to step the NFA and
+// a DFA that is built lazily on top of them, one set of NFA states per DFA
+// state. A finished NFA is never modified by matching, everything that changes
+// lives here, so one NFA can be shared by many threads as long as each of them
+// brings its own scratch.
+//
+// A scratch remembers which NFA it was last used with and starts over when it
+// is handed another one. Memory is kept between calls, so matching in a loop
+// only allocates when the DFA runs into states it has not seen before. Once
+// max_dfa_states is reached the DFA is thrown away and rebuilt as needed.
+//
+// The same cache also holds the states of an unanchored search, which start
+// the pattern over at every byte. Their sets carry one extra id past the last
+// NFA state to keep them apart from the anchored ones, see
+// unanchored_start_state().
+//
+// Capture groups get a second, tagged DFA (Laurikari's TDFA). Its states are
+// the NFA states that can still consume input or accept, in the order a
+// backtracking matcher would try them, and each of them carries one register
+// per tag holding the position the tag was last passed. A transition knows
+// for every register of its target which register of its source it copies or
+// whether it is set to the current position, so stepping stays deterministic.
+class MatchScratch {
+public:
+  explicit MatchScratch(size_t max_dfa_states = 4096)
+      : max_dfa_states{max_dfa_states} {}
+
+  // The scratch used by the NFA matching methods that are not handed one.
+  static MatchScratch &for_this_thread();
+
+  const MatchStats &stats() const { return match_stats; }
+  void reset_stats() { match_stats = {}; }
+
+private:
+  friend struct NFA;
+  friend class DFA;
+
+  struct SparseSet {
+    std::vector<uint32_t> dense;
+    std::vector<uint32_t> sparse;
+    size_t size{0};
+    void resize(size_t capacity) {
+      dense.resize(capacity);
+      sparse.resize(capacity);
+      size = 0;
+    }
+    bool contains(uint32_t value) const {
+      return sparse[value] < size && dense[sparse[value]] == value;
+    }
+    void insert(uint32_t value) {
+      sparse[value] = size;
+      dense[size++] = value;
+    }
+    void clear() { size = 0; }
+  };
+
+  struct KeyHash {
+    size_t operator()(const std::vector<uint32_t> &key) const;
+  };
+
+  static constexpr uint32_t UNKNOWN = UINT32_MAX;
+  static constexpr uint32_t DEAD = 0;
+  // register commands besides copying the register with that index
+  static constexpr uint32_t SET_TAG = UINT32_MAX;
+  static constexpr uint32_t CLEAR_TAG = UINT32_MAX - 1;
+  static constexpr uint32_t NO_ACCEPT = UINT32_MAX;
+
+  struct TaggedTransition {
+    uint32_t target{UNKNOWN};
+    // the commands for target's registers start at tagged_commands[commands]
+    uint32_t commands{0};
+  };
+
+  struct ClosureEntry {
+    uint32_t state;
+    // tag + 1 of the edge leading here, 0 for none
+    uint16_t tag;
+    // restore tag_set[tag - 1] to was_set instead of visiting state
+    bool restore;
+    bool was_set;
+  };
+
+  void reset(const NFA &nfa);
+  void flush();
+  uint32_t start_state(const NFA &nfa);
+  uint32_t unanchored_start_state(const NFA &nfa);
+  uint32_t next_state(const NFA &nfa, uint32_t state, unsigned char byte);
+  bool is_accepting(uint32_t state) const { return accepting[state]; }
+  uint32_t compute_next_state(const NFA &nfa, uint32_t state,
+                              unsigned char byte);
+  void add_with_closure(const NFA &nfa, uint32_t state);
+  uint32_t intern(const NFA &nfa);
+  size_t memory_usage() const;
+
+  void flush_tagged();
+  uint32_t tagged_start_state(const NFA &nfa);
+  // steps the tagged DFA, leaving the commands to apply in tagged_step_commands
+  uint32_t tagged_next_state(const NFA &nfa, uint32_t state,
+                             unsigned char byte);
+  void add_with_tagged_closure(const NFA &nfa, uint32_t state,
+                               uint16_t tag, uint32_t source);
+  uint32_t intern_tagged(const NFA &nfa);
+
+  uint64_t program_id{0};
+  size_t max_dfa_states;
+  size_t num_classes{1};
+  uint32_t start{UNKNOWN};
+  uint32_t unanchored_start{UNKNOWN};
+  // the extra id in the sets of unanchored states
+  uint32_t restart_marker{0};
+  size_t interned_bytes{0};
+  MatchStats match_stats;
+
+  SparseSet nfa_states;
+  std::vector<uint32_t> stack;
+  std::vector<uint32_t> key_buffer;
+
+  // dfa state * num_classes + byte class -> next dfa state or UNKNOWN
+  std::vector<uint32_t> transitions;
+  std::vector<uint8_t> accepting;
+  std::vector<const std::vector<uint32_t> *> dfa_states;
+  std::unordered_map<std::vector<uint32_t>, uint32_t, KeyHash> dfa_state_ids;
+
+  size_t num_tags{0};
+  uint32_t tagged_start{UNKNOWN};
+  std::vector<ClosureEntry> closure_stack;
+  std::vector<uint8_t> tag_set;
+  // commands of the transition being computed, and of the one last taken
+  std::vector<uint32_t> command_buffer;
+  const uint32_t *tagged_step_commands{nullptr};
+  size_t tagged_step_size{0};
+  // registers of the current state, the next one and of the longest match
+  std::vector<size_t> registers;
+  std::vector<size_t> next_registers;
+  std::vector<size_t> matched_tags;
+
+  std::vector<TaggedTransition> tagged_transitions;
+  std::vector<uint32_t> tagged_commands;
+  std::vector<uint32_t> start_commands;
+  // index of the accepting NFA state among a tagged state's, or NO_ACCEPT
+  std::vector<uint32_t> tagged_accept;
+  std::vector<const std::vector<uint32_t> *> tagged_states;
+  std::unordered_map<std::vector<uint32_t>, uint32_t, KeyHash> tagged_state_ids;
+};
+
+} // namespace bp
+
+#endif // MATCHSCRATCH_H_
@@ -1,24 +1,52 @@
 #ifndef NFA_H_
 #define NFA_H_
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
 #include <filesystem>
-#include <map>
-#include <set>
+#include <libbearpig/inputbuffer.h>
+#include <libbearpig/matchscratch.h>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
 #include <vector>
 
 namespace bp {
 
+class QueryPlan;
+
 struct Transition {
   size_t from; // redundant information?
   size_t to;
+  // consumes one byte in [edge, last], it is an epsilon edge if both are 0
   char edge;
+  char last = edge;
+  // tag + 1 of the capture boundary an epsilon edge records, 0 for none
+  uint16_t tag{0};
 };
 
 struct State {
-  std::multimap<char, Transition> transitions;
+  std::vector<Transition> transitions;
   size_t id;
   bool is_accept;
 };
 
+// Transition in the flattened tables that matching runs on. The layout is
+// fixed since the tables are also written to and mapped from disk.
+struct FlatEdge {
+  uint32_t to;
+  uint8_t first;
+  uint8_t last;
+  uint16_t tag{};
+  bool is_epsilon() const { return first == 0 && last == 0; }
+  bool accepts(unsigned char byte) const {
+    return !is_epsilon() && first <= byte && byte <= last;
+  }
+};
+static_assert(sizeof(FlatEdge) == 8);
+
 struct RegexMatch {
   bool success;
   size_t start;
@@ -26,39 +54,215 @@ struct RegexMatch {
   std::string match;
 };
 
+// Where a capture group matched, as offsets into the searched input. Group 0
+// is the whole match, group n the n-th opening parenthesis of the pattern.
+// Groups that took no part in the match are left at npos.
+struct Capture {
+  static constexpr size_t npos = std::string_view::npos;
+  size_t start{npos};
+  size_t end{npos};
+  bool matched() const { return start != npos; }
+  std::string_view in(std::string_view input) const {
+    return matched() ? input.substr(start, end - start) : std::string_view{};
+  }
+};
+
+// What every match of a pattern has in common. finalize() works it out once
+// from the finished states, which is where case folding, UTF-8 and every
+// other rewrite of the pattern has already happened, and matching uses it to
+// rule out inputs and offsets without running the automaton at all.
+struct PatternProperties {
+  static constexpr size_t UNBOUNDED = SIZE_MAX;
+  // UNBOUNDED if the pattern matches nothing at all
+  size_t min_length{0};
+  // UNBOUNDED if repetition lets matches grow without limit
+  size_t max_length{0};
+  // the bytes matches can begin and end with
+  std::bitset<256> first_bytes;
+  std::bitset<256> last_bytes;
+
+  bool nullable() const { return min_length == 0; }
+  bool allows_length(size_t length) const {
+    return min_length <= length && length <= max_length;
+  }
+  // One past the last offset of an input of size bytes that a match can
+  // start at, as every match needs min_length bytes. 0 if none can.
+  size_t start_limit(size_t size) const {
+    return size >= min_length ? size - min_length + 1 : 0;
+  }
+};
+
+// An NFA is only modified while NfaGenVisitor builds it. After that it is an
+// immutable program: every matching method is const and keeps its state in a
+// MatchScratch, so one NFA can be matched from any number of threads at once.
 struct NFA {
 private:
   friend class NfaGenVisitor;
-  std::set<size_t> get_all_available_epsilon_transitions(size_t current);
-  std::set<char> get_possible_first_characters();
+  friend class MatchScratch;
+  friend class DFA;
+  friend struct Serializer;
+  friend class IncrementalLexer;
+  friend class RuleScanner;
+  friend class RegexSet;
+  // works out the properties from the finished tables
+  PatternProperties analyze() const;
   size_t next_id = 0;
-  RegexMatch run_nfa(std::string_view input, bool exact, size_t start_id = 0);
-  State currentAccept;
-  std::map<size_t, State> states;
+  RegexMatch run_nfa(std::string_view input, bool exact, size_t start_id,
+                     MatchScratch &scratch) const;
+  static constexpr size_t NO_MATCH = SIZE_MAX;
+  // scanned, if given, receives the number of bytes looked at
+  size_t longest_match(std::string_view input, bool exact, size_t start_id,
+                       MatchScratch &scratch,
+                       size_t *scanned = nullptr) const;
+  size_t run_tagged(std::string_view input, bool exact,
+                    MatchScratch &scratch) const;
+  bool fill_captures(std::string_view input, size_t start, size_t length,
+                     std::span<Capture> captures, MatchScratch &scratch) const;
+  // the plan, if it picked an engine other than this NFA
+  const QueryPlan *delegate() const;
+  // state ids are handed out densely, so they index straight into states
+  size_t accept_id = 0;
+  std::vector<State> states;
   size_t add_state();
+  void reserve(size_t num_states) { states.reserve(num_states); }
   void add_transition_to_state(size_t state_id, const Transition &transition) {
-    states.at(state_id).transitions.insert({transition.edge, transition});
+    states[state_id].transitions.push_back(transition);
   }
   void add_transition_to_state(size_t state_id, size_t to, char edge) {
-    Transition transition{state_id, to, edge};
-    states.at(state_id).transitions.insert({edge, transition});
+    states[state_id].transitions.push_back(Transition{state_id, to, edge});
+  }
+  void add_range_transition(size_t state_id, size_t to, uint8_t first,
+                            uint8_t last) {
+    states[state_id].transitions.push_back(
+        Transition{state_id, to, static_cast<char>(first),
+                   static_cast<char>(last)});
   }
+  void add_tagged_transition(size_t state_id, size_t to, uint16_t tag) {
+    states[state_id].transitions.push_back(
+        Transition{state_id, to, 0, 0, static_cast<uint16_t>(tag + 1)});
+  }
+  const Transition *find_transition(const State &state, char edge) const;
+  // Shrinks the states NfaGenVisitor built before they are finalized.
+  void reduce();
+
+  // Everything below is derived from the states by finalize() once the NFA is
+  // complete. program_id tells scratches apart which NFA they were built for.
+  void finalize();
+  uint64_t program_id = 0;
+  // the outgoing edges of state i are edges[edge_offsets[i]..edge_offsets[i+1])
+  // the tables either live in storage or in a mapped file, see serialize.h
+  std::span<const uint32_t> edge_offsets;
+  std::span<const FlatEdge> edges;
+  std::shared_ptr<const void> storage;
+  std::span<const FlatEdge> edges_of(size_t state) const {
+    return edges.subspan(edge_offsets[state],
+                         edge_offsets[state + 1] - edge_offsets[state]);
+  }
+  // bytes that no edge tells apart share a class, so the lazy DFA only needs
+  // one column per class instead of one per byte
+  std::array<uint8_t, 256> byte_classes{};
+  size_t num_classes = 1;
+  PatternProperties analysis;
+  bool starts_with_any = false;
+  bool can_start_with(unsigned char byte) const {
+    return starts_with_any || analysis.first_bytes.test(byte);
+  }
+  // the first offset from i on that a match can start at, limit if none
+  size_t next_start(std::string_view input, size_t i, size_t limit) const {
+    for (size_t end = std::min(limit, input.size());
+         i < end && !can_start_with(input[i]); i++)
+      ;
+    return i;
+  }
+  // group n opens at tag 2n - 2 and closes at tag 2n - 1
+  static constexpr size_t MAX_GROUPS = UINT16_MAX / 2;
+  size_t num_groups = 0;
+  size_t num_tags() const { return num_groups * 2; }
+  std::shared_ptr<const QueryPlan> query_plan;
 
 public:
   NFA() {
-    State init{{}, 0, true};
-    states.insert({0, init});
-    currentAccept = init;
+    states.push_back(State{{}, 0, true});
+    finalize();
   }
 
   void fill_with_dummy_data();
+  // Picks the engine the matching methods hand their work to, see
+  // queryplan.h. compile() and load_nfa() plan every NFA, one generated
+  // straight from NfaGenVisitor runs on its own until planned.
+  void plan_query();
+  // nullptr until plan_query() was called
+  const QueryPlan *plan() const { return query_plan.get(); }
+  size_t num_states() const { return edge_offsets.size() - 1; }
+  const PatternProperties &properties() const { return analysis; }
   void to_dot(std::filesystem::path dotfile =
                   std::filesystem::path("./dot/test.dot")) const;
-  RegexMatch exact_match(std::string_view input);
-  RegexMatch find_first_match(std::string_view input);
-  std::vector<RegexMatch> find_all_matches(std::string_view input);
+
+  // Without an explicit scratch these use MatchScratch::for_this_thread().
+  RegexMatch exact_match(std::string_view input) const;
+  RegexMatch find_first_match(std::string_view input) const;
+  std::vector<RegexMatch> find_all_matches(std::string_view input) const;
+  RegexMatch exact_match(std::string_view input, MatchScratch &scratch) const;
+  RegexMatch find_first_match(std::string_view input,
+                              MatchScratch &scratch) const;
+  std::vector<RegexMatch> find_all_matches(std::string_view input,
+                                           MatchScratch &scratch) const;
+
+  // Whether input contains a match, like find_first_match(input).success.
+  // It takes a single pass that starts the pattern over at every byte and
+  // stops at the first accepting state, so it is not slowed down by finding
+  // where the match starts or how far it extends.
+  bool is_match(std::string_view input) const;
+  bool is_match(std::string_view input, MatchScratch &scratch) const;
+  // find_all_matches(input).size(), without building the matches.
+  size_t count_matches(std::string_view input) const;
+  size_t count_matches(std::string_view input, MatchScratch &scratch) const;
+  // The first match find_all_matches() would report at or after from, as
+  // offsets into input, or an unmatched Capture if there is none. Nothing is
+  // copied, so stepping through the matches with it costs only the search,
+  // see MatchIterator.
+  Capture next_match(std::string_view input, size_t from) const;
+  Capture next_match(std::string_view input, size_t from,
+                     MatchScratch &scratch) const;
+
+  // Matches the longest non-empty token at input's offset(). On success the
+  // token is in input.token() and the offset moves past it, otherwise
+  // nothing moves and input.skip() gets past the offending bytes. The input
+  // is only read as far as the token could reach.
+  bool match_token(InputBuffer &input) const;
+  bool match_token(InputBuffer &input, MatchScratch &scratch) const;
+
+  // Capture groups in the pattern, group 0 not counted.
+  size_t num_captures() const { return num_groups; }
+  // Like the matching methods above, but report the match and its groups in
+  // captures, which holds num_captures() + 1 entries to see all of them.
+  // Groups are extracted by a tagged DFA built lazily in the scratch, so once
+  // it is warm nothing is allocated and every byte costs one table lookup
+  // plus a few register copies. Among the ways to make the longest match,
+  // groups take the one that prefers earlier alternatives and longer
+  // repetitions, like a backtracking matcher would.
+  bool exact_match(std::string_view input, std::span<Capture> captures) const;
+  bool find_first_match(std::string_view input,
+                        std::span<Capture> captures) const;
+  bool exact_match(std::string_view input, std::span<Capture> captures,
+                   MatchScratch &scratch) const;
+  bool find_first_match(std::string_view input, std::span<Capture> captures,
+                        MatchScratch &scratch) const;
 };
 
+// Hands out the ids that tell finished NFAs apart, see MatchScratch.
+uint64_t next_program_id();
+
+inline uint32_t MatchScratch::next_state(const NFA &nfa, uint32_t state,
+                                         unsigned char byte) {
+  uint32_t next = transitions[state * num_classes + nfa.byte_classes[byte]];
+  if (next != UNKNOWN) {
+    match_stats.dfa_cache_hits++;
+    return next;
+  }
+  return compute_next_state(nfa, state, byte);
+}
+
 } // namespace bp
 
 
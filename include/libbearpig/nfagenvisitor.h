@@ -1,9 +1,12 @@
 #ifndef NFAGENVISITOR_H_
 #define NFAGENVISITOR_H_
 
+#include "libbearpig/compile.h"
 #include "libbearpig/nfa.h"
 #include "libbearpig/regexast.h"
 #include "libbearpig/regextokens.h"
+#include "libbearpig/utf8.h"
+#include <span>
 #include <vector>
 
 namespace bp {
@@ -11,16 +14,39 @@ namespace bp {
 struct NfaGenVisitor {
 private:
   NFA &nfa;
-  std::vector<RegexToken> tokenstream;
+  // only used for diagnostics, borrowed from the caller like in RegexParser
+  std::span<const RegexToken> tokenstream;
   size_t id{0};
+  // nesting of AlternativeExps, the NFA is finalized when the outermost ends
+  int depth{0};
+  // with CASE_INSENSITIVE letters get an edge for each case instead of the
+  // input being folded
+  RegexFlags flags;
   char last_char;
+  // what the items of the set being generated take, see SetExp
+  std::vector<CodepointRange> set_ranges;
+  std::vector<uint8_t> set_bytes;
+  std::vector<Utf8Sequence> sequences;
+  // set by an error in the pattern, the NFA is then not what it asked for
+  bool failed{false};
 
 public:
-  NfaGenVisitor(NFA &nfa, std::vector<RegexToken> tokens)
-      : nfa{nfa}, tokenstream{tokens} {};
+  NfaGenVisitor(NFA &nfa, std::span<const RegexToken> tokens,
+                RegexFlags flags = RegexFlags::NONE)
+      : nfa{nfa}, tokenstream{tokens}, flags{flags} {
+    // a few states per token covers everything but large set ranges
+    nfa.reserve(tokens.size() * 3 + 1);
+  };
+
+  // whether the pattern had an error, which has been logged
+  bool has_failed() const { return failed; }
 
   void invalid_range_error(RChar startchar, RChar stopchar);
   void confusing_range_warning(RChar start, RChar stop);
+  // Adds edges from the current state that consume one code point in ranges,
+  // as UTF-8, or one of raw_bytes, and moves on to where they meet.
+  void add_codepoints(std::span<const CodepointRange> ranges,
+                      std::span<const uint8_t> raw_bytes = {});
 
   void operator()(this NfaGenVisitor &self, AlternativeExp &exp);
   void operator()(this NfaGenVisitor &self, ConcatExp &exp);
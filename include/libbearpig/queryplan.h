@@ -0,0 +1,107 @@
+#ifndef QUERYPLAN_H_
+#define QUERYPLAN_H_
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <libbearpig/dfa.h>
+#include <libbearpig/nfa.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+// The ways a pattern can be matched, cheapest first.
+enum class Engine {
+  // a single byte, found with memchr
+  MEMCHR,
+  // a single literal string, found with memmem
+  MEMMEM,
+  // a single literal in any mix of cases, candidates found by memchr for both
+  // cases of its first byte
+  CASELESS_LITERAL,
+  // a handful of literal strings, candidates found by their first byte
+  LITERAL_SET,
+  // a fixed length sequence of byte sets, matched with Shift-And
+  BIT_PARALLEL,
+  // a fully determinized DFA
+  DFA,
+  // the NFA stepped through its lazy DFA in a MatchScratch
+  NFA,
+};
+
+std::string_view to_string(Engine engine);
+
+// What the planner found out about a pattern and which engine it picked. The
+// facts come from determinizing the pattern once. The literal and bit-parallel
+// engines only take patterns that cannot match the empty string, while the
+// full DFA takes any pattern small enough, so they all agree with the NFA on
+// every input.
+//
+// NFA's matching methods hand their work to the plan unless it picked the NFA
+// itself, so callers get the cheapest engine without asking for it. Capture
+// groups are always extracted by the NFA.
+class QueryPlan {
+public:
+  // Larger DFAs are left to the lazy one in MatchScratch, which only builds
+  // the states the input actually reaches.
+  static constexpr size_t MAX_DFA_STATES = 512;
+  static constexpr size_t MAX_DFA_BYTES = 64 * 1024;
+  static constexpr size_t MAX_LITERALS = 64;
+  static constexpr size_t MAX_POSITIONS = 64;
+
+  static QueryPlan analyze(const NFA &nfa);
+
+  Engine engine() const { return chosen; }
+  // states of the determinized pattern, 0 if there were too many
+  size_t dfa_states() const { return num_dfa_states; }
+  bool matches_empty() const { return nullable; }
+  // the whole language if it is a small, finite set of strings
+  const std::vector<std::string> &literals() const { return literal_set; }
+  // length of the byte set sequence, 0 if the pattern is not one
+  size_t positions() const { return num_positions; }
+  // One fact per line, for tuning and for bearpig --plan.
+  std::string describe() const;
+
+  RegexMatch exact_match(std::string_view input) const;
+  RegexMatch find_first_match(std::string_view input) const;
+  std::vector<RegexMatch> find_all_matches(std::string_view input) const;
+  bool is_match(std::string_view input) const;
+  size_t count_matches(std::string_view input) const;
+  Capture next_match(std::string_view input, size_t from) const;
+
+private:
+  struct Span {
+    size_t start;
+    size_t length;
+  };
+  // the leftmost-longest match starting at or after from
+  std::optional<Span> find(std::string_view input, size_t from) const;
+  size_t longest_literal_at(std::string_view input, size_t at) const;
+  std::optional<Span> shift_and(std::string_view input, size_t from) const;
+  std::optional<Span> find_caseless(std::string_view input, size_t from) const;
+  bool equals_caseless(std::string_view candidate) const;
+
+  Engine chosen{Engine::NFA};
+  size_t num_dfa_states{0};
+  bool nullable{false};
+  size_t min_length{0};
+  size_t max_length{0};
+  std::vector<std::string> literal_set;
+  size_t num_positions{0};
+
+  std::optional<DFA> dfa;
+  // CASELESS_LITERAL: the literal with its letters in lower case
+  std::string folded;
+  // LITERAL_SET: literals by first byte, longest first
+  std::array<std::vector<uint16_t>, 256> by_first_byte;
+  std::bitset<256> first_bytes;
+  // BIT_PARALLEL: bit k of masks[byte] is set if byte may be at position k
+  std::array<uint64_t, 256> masks{};
+};
+
+} // namespace bp
+
+#endif // QUERYPLAN_H_
@@ -3,6 +3,7 @@
 
 #include <libbearpig/regextokens.h>
 #include <memory>
+#include <memory_resource>
 #include <variant>
 #include <vector>
 
@@ -18,6 +19,28 @@ struct RChar;
 // expressions
 using ElementaryExp = std::variant<SetExp, GroupExp, AnyExp, RChar>;
 
+// Nodes that own other nodes through a pointer allocate them from the memory
+// resource of the parse (usually a per-compilation arena). The deleter hands
+// them back to the same resource, which is a no-op for monotonic arenas.
+struct ArenaDeleter {
+  std::pmr::memory_resource *resource{std::pmr::get_default_resource()};
+  template <typename T> void operator()(T *ptr) const {
+    std::pmr::polymorphic_allocator<T> alloc{resource};
+    std::destroy_at(ptr);
+    alloc.deallocate(ptr, 1);
+  }
+};
+
+template <typename T> using ArenaPtr = std::unique_ptr<T, ArenaDeleter>;
+
+template <typename T, typename... Args>
+ArenaPtr<T> make_arena(std::pmr::memory_resource *resource, Args &&...args) {
+  std::pmr::polymorphic_allocator<T> alloc{resource};
+  T *ptr = alloc.allocate(1);
+  std::construct_at(ptr, std::forward<Args>(args)...);
+  return ArenaPtr<T>{ptr, ArenaDeleter{resource}};
+}
+
 struct AnyExp {
   ~AnyExp() = default;
 };
@@ -27,7 +50,7 @@ struct RChar {
   int idx;
   RegexToken character;
   bool is_escape{false};
-  std::string to_string() { return std::string{character.data}; }
+  std::string to_string() { return character.text(); }
 };
 
 struct SetItem {
@@ -38,9 +61,11 @@ struct SetItem {
 };
 
 struct SetExp {
+  SetExp() = default;
+  explicit SetExp(std::pmr::memory_resource *resource) : items{resource} {}
   ~SetExp() = default;
   bool negative = false;
-  std::vector<SetItem> items;
+  std::pmr::vector<SetItem> items;
 };
 
 struct GroupExp {
@@ -54,7 +79,7 @@ struct GroupExp {
     subExp.swap(other.subExp);
     return *this;
   }
-  std::unique_ptr<AlternativeExp> subExp{};
+  ArenaPtr<AlternativeExp> subExp{};
 };
 
 struct QuantifiedExp {
@@ -102,13 +127,14 @@ struct ConcatExp {
   ConcatExp(ConcatExp &&other) : exps(std::move(other.exps)) {}
   explicit ConcatExp(const ConcatExp &other) = delete;
   explicit ConcatExp() = default;
+  explicit ConcatExp(std::pmr::memory_resource *resource) : exps{resource} {}
   ConcatExp &operator=(const ConcatExp &other) = delete;
   ConcatExp &operator=(ConcatExp &&other) {
     exps.swap(other.exps);
     return *this;
   }
   ~ConcatExp() = default;
-  std::vector<QuantifiedExp> exps;
+  std::pmr::vector<QuantifiedExp> exps;
 
   void merge(ConcatExp &other) {
     for (QuantifiedExp &e : other.exps) {
@@ -122,13 +148,15 @@ struct AlternativeExp {
       : alternatives(std::move(other.alternatives)) {}
   explicit AlternativeExp(const AlternativeExp &other) = delete;
   explicit AlternativeExp() = default;
+  explicit AlternativeExp(std::pmr::memory_resource *resource)
+      : alternatives{resource} {}
   AlternativeExp &operator=(const AlternativeExp &other) = delete;
   AlternativeExp &operator=(AlternativeExp &&other) {
     alternatives.swap(other.alternatives);
     return *this;
   }
   ~AlternativeExp() = default;
-  std::vector<ConcatExp> alternatives{};
+  std::pmr::vector<ConcatExp> alternatives{};
 };
 } // namespace bp
 
@@ -0,0 +1,91 @@
+#ifndef REGEXCACHE_H_
+#define REGEXCACHE_H_
+
+#include <cstdint>
+#include <libbearpig/compile.h>
+#include <libbearpig/nfa.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace bp {
+
+// Interns compiled patterns by text and flags. The cache is split into shards
+// with a lock and an LRU list each, so lookups of different patterns rarely
+// contend. Compilation happens outside the shard lock.
+//
+// Compiled automata are handed out as shared immutable objects, an evicted
+// NFA stays alive for as long as somebody still holds on to it.
+class RegexCache {
+public:
+  struct Stats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t evictions{0};
+    size_t size{0};
+  };
+
+  // capacity is the total number of entries, spread evenly over the shards
+  explicit RegexCache(size_t capacity = 4096, size_t num_shards = 16);
+
+  // nullptr for a pattern with an error, which is logged and not cached, so
+  // one bad pattern from a client only fails that client's request
+  std::shared_ptr<const NFA> get(std::string_view pattern,
+                                 RegexFlags flags = RegexFlags::NONE);
+  Stats stats() const;
+  void clear();
+
+private:
+  struct KeyView {
+    std::string_view pattern;
+    RegexFlags flags;
+  };
+  struct Key {
+    std::string pattern;
+    RegexFlags flags;
+  };
+  struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(const KeyView &key) const;
+    size_t operator()(const Key &key) const {
+      return (*this)(KeyView{key.pattern, key.flags});
+    }
+  };
+  struct KeyEqual {
+    using is_transparent = void;
+    static KeyView view(const Key &key) { return {key.pattern, key.flags}; }
+    static KeyView view(const KeyView &key) { return key; }
+    bool operator()(const auto &a, const auto &b) const {
+      return view(a).pattern == view(b).pattern &&
+             view(a).flags == view(b).flags;
+    }
+  };
+  struct Entry {
+    Key key;
+    std::shared_ptr<const NFA> nfa;
+  };
+  struct Shard {
+    mutable std::mutex mutex;
+    // most recently used entry first
+    std::list<Entry> lru;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash, KeyEqual>
+        index;
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t evictions{0};
+  };
+
+  // the low bits pick the bucket inside a shard, use other ones for the shard
+  Shard &shard_for(size_t hash) { return shards[(hash >> 17) % num_shards]; }
+
+  size_t num_shards;
+  size_t shard_capacity;
+  std::unique_ptr<Shard[]> shards;
+};
+
+} // namespace bp
+
+#endif // REGEXCACHE_H_
@@ -4,24 +4,39 @@
 #include <libbearpig/regexast.h>
 #include <libbearpig/regextokens.h>
 #include <memory>
+#include <memory_resource>
+#include <span>
 #include <vector>
 
 namespace bp {
 
 class RegexParser {
 public:
+  // Gives false for a pattern that does not parse, after logging where.
   bool parse();
   bool is_done() { return current_token_idx == tokenstream.size(); };
   int get_current_token_idx() const { return current_token_idx; }
   int get_size_of_tokenstream() const { return tokenstream.size(); }
   AlternativeExp *get_top_of_expression() const { return expression_top.get(); }
+  // whether the pattern started with (?i)
+  bool ignores_case() const { return case_insensitive; }
   RegexParser() = delete;
-  explicit RegexParser(std::vector<RegexToken> tokens)
-      : tokenstream(tokens), current_token_idx{0},
-        current_token{tokenstream[current_token_idx]} {}
+  // The parser only borrows the tokens, they have to outlive it. AST nodes
+  // are allocated from resource, which lets callers hand in a per-compilation
+  // arena.
+  explicit RegexParser(std::span<const RegexToken> tokens,
+                       std::pmr::memory_resource *resource =
+                           std::pmr::get_default_resource())
+      : tokenstream(tokens), resource{resource}, current_token_idx{0},
+        current_token{tokenstream.empty() ? &eos_token
+                                          : &tokenstream[current_token_idx]} {}
+  explicit RegexParser(std::vector<RegexToken> &&tokens,
+                       std::pmr::memory_resource *resource =
+                           std::pmr::get_default_resource()) = delete;
 
 private:
   bool parse_top_level();
+  void parse_inline_flags();
   AlternativeExp parse_exp();
   ConcatExp parse_simple_exp();
   ConcatExp parse_concatenation_exp();
@@ -31,7 +46,7 @@ private:
   AnyExp parse_any();
   GroupExp parse_group();
   SetExp parse_set();
-  std::vector<SetItem> parse_set_items();
+  std::pmr::vector<SetItem> parse_set_items();
   SetItem parse_set_item();
   RChar parse_character(bool single = false);
   RChar parse_escape_seq();
@@ -44,12 +59,14 @@ private:
   void advance();
   void consume(RegexTokenType expected);
   void consume(std::string_view func, RegexTokenType expected);
-  void print_error_message_and_exit(const std::string &, int loc);
-  std::vector<RegexToken> tokenstream;
-  std::unique_ptr<AlternativeExp> expression_top;
+  [[noreturn]] void parse_error(const std::string &, int loc);
+  std::span<const RegexToken> tokenstream;
+  std::pmr::memory_resource *resource;
+  ArenaPtr<AlternativeExp> expression_top;
   int current_token_idx{0};
-  RegexToken current_token;
-  bool invalid = false;
+  RegexToken eos_token{RegexTokenType::EOS, 0, 0};
+  const RegexToken *current_token;
+  bool case_insensitive = false;
 };
 } // namespace bp
 
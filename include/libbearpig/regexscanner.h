@@ -1,6 +1,7 @@
 #ifndef REGEXSCANNER_H_
 #define REGEXSCANNER_H_
 #include <libbearpig/regextokens.h>
+#include <memory_resource>
 #include <string_view>
 #include <vector>
 
@@ -11,6 +12,7 @@ public:
   RegexScanner(const std::string_view input);
   RegexToken next();
   std::vector<RegexToken> tokenize();
+  std::pmr::vector<RegexToken> tokenize(std::pmr::memory_resource *resource);
   bool is_at_end() const { return current_column == input.size(); }
 
 private:
@@ -0,0 +1,151 @@
+#ifndef REGEXSET_H_
+#define REGEXSET_H_
+
+#include <array>
+#include <cstdint>
+#include <libbearpig/compile.h>
+#include <libbearpig/nfa.h>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+// Many patterns matched at once. All of them are determinized into one DFA
+// whose accepting states carry the set of patterns they accept for, so one
+// pass over the input tells every pattern that matches, however many there
+// are. Like RuleScanner, which picks one rule per token, it is built from the
+// patterns' NFAs laid out side by side.
+//
+// The DFA is built lazily while matching, the way MatchScratch builds one for
+// a single pattern, as patterns like word.*code that overlap each other have
+// a DFA exponential in their number, while the input only ever reaches a few
+// of its states. The states live in a Scratch, which holds at most max_states
+// of them and throws them away to be rebuilt as needed once it is full.
+class RegexSet {
+public:
+  // Which patterns matched, pattern i is bit i.
+  class Matches {
+  public:
+    explicit Matches(size_t num_patterns)
+        : bits((num_patterns + 63) / 64, 0) {}
+
+    bool contains(size_t pattern) const {
+      return (bits[pattern / 64] >> (pattern % 64) & 1) != 0;
+    }
+    bool empty() const;
+    size_t count() const;
+    // the matching patterns in increasing order
+    std::vector<size_t> patterns() const;
+    std::span<const uint64_t> words() const { return bits; }
+
+    bool operator==(const Matches &) const = default;
+
+  private:
+    friend class RegexSet;
+    std::vector<uint64_t> bits;
+  };
+
+  // The lazily built DFA states of one set, which one thread matches with.
+  // Like MatchScratch it starts over when handed another set.
+  class Scratch {
+  public:
+    // The scratch used by the matching methods that are not handed one.
+    static Scratch &for_this_thread();
+
+    size_t num_states() const { return sets.size(); }
+    // how often the states were thrown away for lack of room
+    size_t flushes() const { return num_flushes; }
+
+  private:
+    friend class RegexSet;
+
+    uint64_t set_id{0};
+    size_t num_classes{1};
+    uint32_t whole_start{0};
+    uint32_t anywhere_start{0};
+    size_t num_flushes{0};
+    // the NFA states of each DFA state, sorted, anywhere states ending in
+    // the restart marker
+    std::vector<std::vector<uint32_t>> sets;
+    std::map<std::vector<uint32_t>, uint32_t> ids;
+    // state * num_classes + byte class -> next state or UNKNOWN
+    std::vector<uint32_t> transitions;
+    // state -> index of the set of patterns it accepts for
+    std::vector<uint32_t> accepts;
+    // Every distinct set of accepted patterns, words_per_set words each and
+    // the empty one first, as many states accept for the same patterns.
+    std::vector<uint64_t> accept_sets;
+    std::map<std::vector<uint64_t>, uint32_t> accept_ids;
+
+    std::vector<uint32_t> mark;
+    uint32_t generation{0};
+    std::vector<uint32_t> stack;
+    std::vector<uint32_t> states;
+    std::vector<uint64_t> accepted;
+  };
+
+  // max_states bounds the DFA states a Scratch keeps. Only a pattern that
+  // does not compile makes this fail.
+  static std::optional<RegexSet>
+  compile(std::span<const std::string> patterns,
+          RegexFlags flags = RegexFlags::NONE, size_t max_states = 4096);
+  static RegexSet from_nfas(std::span<const NFA *const> nfas,
+                            size_t max_states = 4096);
+
+  // patterns matching all of input
+  Matches exact_matches(std::string_view input) const;
+  Matches exact_matches(std::string_view input, Scratch &scratch) const;
+  // patterns matching somewhere in input
+  Matches matches(std::string_view input) const;
+  Matches matches(std::string_view input, Scratch &scratch) const;
+
+  size_t num_patterns() const { return patterns; }
+
+private:
+  static constexpr uint32_t DEAD = 0;
+  static constexpr uint32_t UNKNOWN = UINT32_MAX;
+  // the index of the empty accept set
+  static constexpr uint32_t NONE = 0;
+
+  RegexSet() = default;
+
+  void prepare(Scratch &scratch) const;
+  void flush(Scratch &scratch) const;
+  uint32_t start_state(Scratch &scratch, bool restart) const;
+  uint32_t next_state(Scratch &scratch, uint32_t state,
+                      unsigned char byte) const {
+    uint32_t next = scratch.transitions[state * num_classes +
+                                        byte_classes[byte]];
+    return next != UNKNOWN ? next : compute_next_state(scratch, state, byte);
+  }
+  uint32_t compute_next_state(Scratch &scratch, uint32_t state,
+                              unsigned char byte) const;
+  void close(Scratch &scratch) const;
+  uint32_t intern(Scratch &scratch) const;
+  uint32_t accept_set_of(Scratch &scratch) const;
+  void add_accepted(const Scratch &scratch, Matches &found,
+                    uint32_t set) const;
+
+  uint64_t set_id{0};
+  size_t patterns{0};
+  size_t max_states{0};
+  size_t num_classes{1};
+  std::array<uint8_t, 256> byte_classes{};
+  size_t words_per_set{0};
+  // The patterns' NFAs side by side, the same layout as
+  // RuleScanner::from_rules. The restart marker is one id past the last
+  // state.
+  std::vector<uint32_t> edge_offsets;
+  std::vector<FlatEdge> edges;
+  // state -> the pattern it accepts, or UINT32_MAX
+  std::vector<uint32_t> accept_of;
+  std::vector<uint32_t> starts;
+};
+
+} // namespace bp
+
+#endif // REGEXSET_H_
@@ -2,6 +2,7 @@
 #define REGEXTOKENS_H_
 
 #include <array>
+#include <cstdint>
 #include <string>
 
 namespace bp {
@@ -53,7 +54,17 @@ std::string to_string(RegexTokenType t);
 struct RegexToken {
   RegexTokenType tokentype;
   int column;
+  // first byte of the token in the pattern
   char data;
+  // A CHARACTER token is one code point, which can take up to four bytes of
+  // UTF-8 in the pattern. A byte that is not valid UTF-8 stays a token of
+  // its own and stands for itself, see is_raw_byte().
+  char32_t codepoint = static_cast<unsigned char>(data);
+  uint8_t length = 1;
+
+  bool is_raw_byte() const { return length == 1 && codepoint >= 0x80; }
+  // the bytes the token was scanned from
+  std::string text() const;
 };
 
 const RegexToken &invalid_token();
@@ -0,0 +1,103 @@
+#ifndef REPLACE_H_
+#define REPLACE_H_
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <libbearpig/matchscratch.h>
+#include <libbearpig/nfa.h>
+#include <string>
+#include <string_view>
+
+namespace bp {
+
+// Steps through the matches of a pattern from left to right, the same ones
+// find_all_matches() reports, but as offsets into input and one at a time,
+// so nothing is copied or collected.
+class MatchIterator {
+public:
+  MatchIterator(const NFA &nfa, std::string_view input,
+                MatchScratch &scratch = MatchScratch::for_this_thread())
+      : nfa{nfa}, input{input}, scratch{scratch} {}
+
+  // the next match, or an unmatched Capture once there are no more
+  Capture next();
+
+private:
+  const NFA &nfa;
+  std::string_view input;
+  MatchScratch &scratch;
+  // where the next search starts, past the end once the last match was found
+  size_t from{0};
+};
+
+// The pieces of input between the matches of a pattern, produced lazily as
+// the loop asks for them. Like splitting by a separator, n matches make n + 1
+// pieces, some of which may be empty, so "a,,b" split by "," is "a", "" and
+// "b". Every piece points into input.
+class Split {
+public:
+  Split(const NFA &nfa, std::string_view input,
+        MatchScratch &scratch = MatchScratch::for_this_thread())
+      : matches{nfa, input, scratch}, input{input} {}
+
+  class iterator {
+  public:
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+
+    std::string_view operator*() const { return piece; }
+    iterator &operator++() {
+      split->next(*this);
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+    bool operator==(std::default_sentinel_t) const { return split == nullptr; }
+
+  private:
+    friend class Split;
+    Split *split{nullptr};
+    std::string_view piece;
+  };
+
+  // a Split is walked once, begin() picks up where the last piece left off
+  iterator begin() {
+    iterator it;
+    it.split = this;
+    next(it);
+    return it;
+  }
+  std::default_sentinel_t end() const { return {}; }
+
+private:
+  void next(iterator &it);
+
+  MatchIterator matches;
+  std::string_view input;
+  // where the piece after the last match starts, past the end when done
+  size_t rest{0};
+};
+
+// Where replace_all writes its output, in order and piece by piece. The
+// pieces of input that did not match are passed on as views into input.
+using Sink = std::function<void(std::string_view)>;
+// Writes the replacement of one match to the sink.
+using Replacer = std::function<void(std::string_view match, const Sink &out)>;
+
+// Writes input to out with every match of nfa, as find_all_matches() finds
+// them, replaced. The input is scanned once and the bytes between matches
+// are written as they are, so with few matches this is not much more than
+// copying input. Returns how many matches were replaced.
+size_t replace_all(const NFA &nfa, std::string_view input,
+                   std::string_view replacement, const Sink &out);
+size_t replace_all(const NFA &nfa, std::string_view input,
+                   const Replacer &replacer, const Sink &out);
+// These append to out instead.
+size_t replace_all(const NFA &nfa, std::string_view input,
+                   std::string_view replacement, std::string &out);
+size_t replace_all(const NFA &nfa, std::string_view input,
+                   const Replacer &replacer, std::string &out);
+
+} // namespace bp
+
+#endif // REPLACE_H_
@@ -0,0 +1,66 @@
+#ifndef RULESCANNER_H_
+#define RULESCANNER_H_
+
+#include <array>
+#include <cstdint>
+#include <libbearpig/nfa.h>
+#include <libbearpig/statetable.h>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+// The scanner generated from a set of token rules: one DFA for all of them,
+// whose accepting states tell which rule matched. A token is the longest
+// match of any rule, and of the rules matching that much the first one wins,
+// like in flex.
+//
+// The DFA is built from the rules' compiled NFAs, which is what makes
+// rebuilding it cheap when the NFAs come out of a cache, see ScannerSpec.
+class RuleScanner {
+public:
+  static constexpr uint32_t DEAD = 0;
+  static constexpr uint32_t NO_RULE = UINT32_MAX;
+
+  struct Token {
+    // index of the rule that matched, NO_RULE for a byte no rule matches
+    uint32_t rule;
+    size_t start;
+    size_t length;
+  };
+
+  // Gives up beyond max_states, like DFA::from_nfa.
+  static std::optional<RuleScanner> from_rules(std::span<const NFA *const> rules,
+                                               size_t max_states = 100000);
+
+  // The token at offset at of input. A byte that starts no non-empty token
+  // comes back on its own with rule NO_RULE.
+  Token next_token(std::string_view input, size_t at) const;
+  std::vector<Token> tokenize(std::string_view input) const;
+
+  size_t num_rules() const { return rules; }
+  size_t num_states() const { return accept_rule.size(); }
+
+private:
+  RuleScanner() = default;
+
+  template <typename StateId>
+  Token next_token(std::span<const StateId> ids, std::string_view input,
+                   size_t at) const;
+
+  size_t rules{0};
+  uint32_t start{DEAD};
+  size_t num_classes{1};
+  std::array<uint8_t, 256> byte_classes{};
+  // state * num_classes + byte class -> next state
+  StateTable table;
+  // the rule a state accepts for, NO_RULE if it does not accept
+  std::vector<uint32_t> accept_rule;
+};
+
+} // namespace bp
+
+#endif // RULESCANNER_H_
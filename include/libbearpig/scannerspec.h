@@ -0,0 +1,74 @@
+#ifndef SCANNERSPEC_H_
+#define SCANNERSPEC_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <libbearpig/compile.h>
+#include <libbearpig/rulescanner.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+struct ScannerRule {
+  std::string name;
+  // with the macros expanded
+  std::string pattern;
+  // the rest of the line after the pattern, possibly empty
+  std::string action;
+  size_t line;
+};
+
+// The input of bearpig -f: named token rules that are compiled into one
+// RuleScanner.
+//
+//   # macros come first, a name and a pattern per line
+//   digit   [0-9]
+//   %%
+//   # then the rules, a name, a pattern and an optional action
+//   NUMBER  {digit}+        return NUMBER;
+//   PLUS    \+
+//
+// Lines starting with # are comments. Patterns cannot contain spaces, so a
+// space ends them. {name} in a pattern, or in a later macro, stands for the
+// macro in parentheses. Without a %% line every line is a rule.
+//
+// Building can cache each rule's NFA in a directory, in a file named after a
+// hash of the expanded pattern and the flags. Editing one rule then only
+// compiles that one again, the others are mapped back in and the scanner is
+// determinized from them.
+class ScannerSpec {
+public:
+  // Parse errors, including rule patterns that do not parse, are logged with
+  // their line and give nullopt.
+  static std::optional<ScannerSpec> parse(std::string_view text);
+  static std::optional<ScannerSpec> load(const std::filesystem::path &path);
+
+  const std::vector<ScannerRule> &rules() const { return token_rules; }
+
+  struct BuildStats {
+    size_t compiled{0};
+    size_t cached{0};
+  };
+  // Without a cache_dir every rule is compiled. Rules are read from the
+  // cache and compiled on num_threads threads, 0 for one per core, which
+  // makes no difference to the scanner. A pattern that parses but does not
+  // compile, such as one with an inverted range, is logged with its rule and
+  // line and gives nullopt.
+  std::optional<RuleScanner>
+  build(RegexFlags flags = RegexFlags::NONE,
+        const std::filesystem::path &cache_dir = {},
+        BuildStats *stats = nullptr, size_t num_threads = 0) const;
+
+  // what a rule's NFA is cached under
+  static uint64_t content_hash(std::string_view pattern, RegexFlags flags);
+
+private:
+  std::vector<ScannerRule> token_rules;
+};
+
+} // namespace bp
+
+#endif // SCANNERSPEC_H_
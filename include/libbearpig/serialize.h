@@ -0,0 +1,36 @@
+#ifndef SERIALIZE_H_
+#define SERIALIZE_H_
+
+#include <filesystem>
+#include <libbearpig/compile.h>
+#include <libbearpig/dfa.h>
+#include <libbearpig/nfa.h>
+#include <optional>
+
+namespace bp {
+
+// Compiled automata can be written to a binary file and mapped back in later,
+// which skips scanning, parsing and NFA generation entirely. The file starts
+// with a FileHeader followed by the automaton's tables, each section aligned to
+// a cache line. Loading maps the file read-only and matches straight out of the
+// mapping, so processes loading the same file share its pages.
+//
+// Files are checked for magic, version, byte order and section bounds, but the
+// table contents are trusted. They are build artifacts, not untrusted input.
+inline constexpr uint32_t SERIALIZE_VERSION = 5;
+
+// Saving writes a file next to path, flushes it to disk and renames it over
+// path. Processes that still map the old file keep reading it whole, and a
+// crash leaves the old file or the new one, never part of one.
+bool save(const NFA &nfa, const std::filesystem::path &path);
+bool save(const DFA &dfa, const std::filesystem::path &path);
+// The NFA is planned again, as plans are not stored, unless flags hold
+// NFA_ONLY. That skips determinizing it, which costs more than the load,
+// for callers like RuleScanner that only ever run the NFA itself.
+std::optional<NFA> load_nfa(const std::filesystem::path &path,
+                            RegexFlags flags = RegexFlags::NONE);
+std::optional<DFA> load_dfa(const std::filesystem::path &path);
+
+} // namespace bp
+
+#endif // SERIALIZE_H_
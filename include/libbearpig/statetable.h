@@ -0,0 +1,73 @@
+#ifndef STATETABLE_H_
+#define STATETABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace bp {
+
+// The transition table of a determinized automaton, state * num_classes +
+// byte class -> next state, with state ids as narrow as the number of states
+// allows: one byte below 256 states, two below 65536 and four beyond. Most
+// automata are small, so their tables shrink four times over and more of them
+// stay in cache.
+//
+// Matching loops are templates over the id type that visit() instantiates
+// for the table's width, so the width is looked at once per call, not once
+// per byte.
+class StateTable {
+public:
+  StateTable() = default;
+  // narrows table, every entry of which is below num_states
+  StateTable(std::span<const uint32_t> table, size_t num_states);
+  // Looks at ids of width bytes stored somewhere else, like in a mapped file,
+  // which has to outlive the table. nullopt for a width that is not 1, 2 or
+  // 4 or bytes that are not a whole number of ids of that width.
+  static std::optional<StateTable> view(std::span<const std::byte> bytes,
+                                        size_t width);
+
+  // the id width that holds num_states states
+  static size_t width_for(size_t num_states) {
+    return num_states <= UINT8_MAX + 1    ? 1
+           : num_states <= UINT16_MAX + 1 ? 2
+                                          : 4;
+  }
+
+  template <typename Visitor> decltype(auto) visit(Visitor &&visitor) const {
+    switch (id_width) {
+    case 1:
+      return visitor(ids<uint8_t>());
+    case 2:
+      return visitor(ids<uint16_t>());
+    default:
+      return visitor(ids<uint32_t>());
+    }
+  }
+
+  // for code that is not on a hot path and does not care about the width
+  uint32_t operator[](size_t index) const {
+    return visit([index](auto table) -> uint32_t { return table[index]; });
+  }
+  size_t size() const { return bytes.size() / id_width; }
+  size_t width() const { return id_width; }
+  std::span<const std::byte> data() const { return bytes; }
+
+private:
+  template <typename StateId> std::span<const StateId> ids() const {
+    return {reinterpret_cast<const StateId *>(bytes.data()),
+            bytes.size() / sizeof(StateId)};
+  }
+
+  std::span<const std::byte> bytes;
+  size_t id_width{4};
+  // the narrowed copy, unless the table is a view
+  std::shared_ptr<const std::vector<std::byte>> storage;
+};
+
+} // namespace bp
+
+#endif // STATETABLE_H_
@@ -0,0 +1,68 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bp {
+
+// A fixed set of worker threads with a task deque each. Workers take their
+// own newest task first and steal the oldest task of another worker when they
+// run dry, so a task that fans out into more tasks, like a directory walk,
+// keeps its subtree local while idle workers pick off whole subtrees.
+//
+// Tasks submitted from a worker go to that worker's deque, others are dealt
+// out round robin. A task must not throw.
+class ThreadPool {
+public:
+  using Task = std::function<void()>;
+  static constexpr size_t NOT_A_WORKER = SIZE_MAX;
+
+  // 0 threads means one per core
+  explicit ThreadPool(size_t num_threads = 0);
+  // waits for every task, then joins the workers
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(Task task);
+  // Blocks until every task submitted so far, and every task those submit,
+  // has run.
+  void wait();
+
+  size_t size() const { return workers.size(); }
+  // Index of the calling thread among this pool's workers, or NOT_A_WORKER.
+  // Lets tasks keep per-worker state without locking it.
+  size_t current_worker() const;
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void work(size_t index);
+  bool pop(size_t index, Task &task);
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<size_t> next_queue{0};
+  // tasks in some deque, and tasks submitted but not yet finished
+  std::atomic<size_t> queued{0};
+  std::atomic<size_t> unfinished{0};
+  std::mutex sleep_mutex;
+  std::condition_variable work_available;
+  std::condition_variable all_done;
+  bool stopping{false};
+};
+
+} // namespace bp
+
+#endif // THREADPOOL_H_
@@ -0,0 +1,80 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Tracing of the scanner, parser, NFA generation and matching internals.
+//
+// BP_TRACE(EVENT, first, second) records a TraceRecord into a per-thread ring
+// buffer when the library is built with BEARPIG_TRACE=1 (see the BEARPIG_TRACE
+// cache variable in src/CMakeLists.txt). Otherwise it expands to nothing and
+// its arguments are never evaluated, so the hot loops pay nothing for it.
+#ifndef BEARPIG_TRACE
+#define BEARPIG_TRACE 0
+#endif
+
+namespace bp {
+
+inline constexpr bool trace_enabled = BEARPIG_TRACE;
+
+enum class TraceEvent : uint8_t {
+  SCAN_TOKEN,      // column, token type
+  PARSE_ADVANCE,   // token index, token type
+  PARSE_EXPECT,    // expected token type, current token type
+  GEN_ALTERNATIVE, // parent state, number of alternatives
+  GEN_CONCAT,      // parent state, number of expressions
+  GEN_QUANTIFIED,  // parent state, quantifier
+  GEN_GROUP,       // parent state
+  GEN_SET,         // parent state, number of items
+  GEN_SET_ITEM,    // parent state, is range
+  GEN_CHAR,        // parent state, character
+  GEN_ANY,         // parent state
+  GEN_ACCEPT,      // old accepting state, new accepting state
+  DFA_STATE_ADDED, // dfa state, number of nfa states in it
+  DFA_FLUSH,       // number of dfa states thrown away
+  MATCH_ATTEMPT,   // start position, matched length or UINT64_MAX
+};
+
+const char *to_string(TraceEvent event);
+
+struct TraceRecord {
+  TraceEvent event;
+  uint64_t first;
+  uint64_t second;
+};
+
+// Holds the last CAPACITY records of one thread.
+class TraceBuffer {
+public:
+  static constexpr size_t CAPACITY = 4096;
+
+  static TraceBuffer &for_this_thread();
+
+  void record(TraceEvent event, uint64_t first, uint64_t second) {
+    records[recorded++ % CAPACITY] = TraceRecord{event, first, second};
+  }
+  // oldest record first
+  std::vector<TraceRecord> snapshot() const;
+  size_t total_recorded() const { return recorded; }
+  void clear() { recorded = 0; }
+
+private:
+  std::array<TraceRecord, CAPACITY> records;
+  size_t recorded{0};
+};
+
+} // namespace bp
+
+#if BEARPIG_TRACE
+#define BP_TRACE(event, first, second)                                         \
+  ::bp::TraceBuffer::for_this_thread().record(                                 \
+      ::bp::TraceEvent::event, static_cast<uint64_t>(first),                   \
+      static_cast<uint64_t>(second))
+#else
+#define BP_TRACE(event, first, second) ((void)0)
+#endif
+
+#endif // TRACE_H_
@@ -0,0 +1,53 @@
+#ifndef UTF8_H_
+#define UTF8_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bp {
+
+inline constexpr char32_t MAX_CODEPOINT = 0x10FFFF;
+
+struct CodepointRange {
+  char32_t first;
+  char32_t last;
+};
+
+struct ByteRange {
+  uint8_t first;
+  uint8_t last;
+};
+
+// The encodings of a run of code points that only differ in their last few
+// bytes, as one byte range per position.
+struct Utf8Sequence {
+  std::array<ByteRange, 4> ranges;
+  size_t length;
+};
+
+// Decodes the code point input starts with. Returns the number of bytes it
+// takes, or 0 if input does not start with well-formed UTF-8.
+size_t decode_utf8(std::string_view input, char32_t &codepoint);
+std::string encode_utf8(char32_t codepoint);
+
+// Appends byte range sequences to out that between them match exactly the
+// UTF-8 encodings of the scalar values in range, surrogates left out. This is
+// how code point classes become byte automata: each sequence is a chain of
+// byte range edges, so matching never decodes.
+void utf8_sequences(CodepointRange range, std::vector<Utf8Sequence> &out);
+
+// Appends the other case of every letter in ranges that has one, for ASCII,
+// Latin-1, Greek and Cyrillic. Leaves ranges unsorted, see normalize_ranges.
+void add_case_variants(std::vector<CodepointRange> &ranges);
+
+// Sorts and merges ranges in place, and with complement replaces them by the
+// code points they leave out.
+void normalize_ranges(std::vector<CodepointRange> &ranges, bool complement);
+
+} // namespace bp
+
+#endif // UTF8_H_
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <libbearpig/compile.h>
+#include <libbearpig/nfagenvisitor.h>
+#include <libbearpig/regexparser.h>
+#include <libbearpig/regexscanner.h>
+#include <libbearpig/threadpool.h>
+#include <latch>
+#include <memory_resource>
+
+namespace bp {
+
+std::optional<NFA> try_compile(std::string_view pattern, RegexFlags flags) {
+  // most patterns fit in here, larger ones spill over to the heap
+  std::array<std::byte, 4096> buffer;
+  std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size()};
+
+  RegexScanner scanner{pattern};
+  std::pmr::vector<RegexToken> tokens = scanner.tokenize(&arena);
+  RegexParser parser{tokens, &arena};
+  if (!parser.parse()) {
+    return std::nullopt;
+  }
+
+  NFA nfa;
+  if (parser.ignores_case()) {
+    flags = flags | RegexFlags::CASE_INSENSITIVE;
+  }
+  NfaGenVisitor nfagen{nfa, tokens, flags};
+  nfagen(*parser.get_top_of_expression());
+  if (nfagen.has_failed()) {
+    return std::nullopt;
+  }
+  if (!has_flag(flags, RegexFlags::NFA_ONLY)) {
+    nfa.plan_query();
+  }
+  return nfa;
+}
+
+NFA compile(std::string_view pattern, RegexFlags flags) {
+  std::optional<NFA> nfa = try_compile(pattern, flags);
+  if (!nfa) {
+    exit(1);
+  }
+  return std::move(*nfa);
+}
+
+std::vector<std::optional<NFA>>
+compile_all(std::span<const std::string> patterns, RegexFlags flags,
+            ThreadPool &pool) {
+  std::vector<std::optional<NFA>> nfas(patterns.size());
+  // a few chunks per worker keep them busy without a task per pattern
+  size_t chunk = std::max<size_t>(patterns.size() / (pool.size() * 8), 1);
+  size_t num_chunks = (patterns.size() + chunk - 1) / chunk;
+  std::latch done{static_cast<std::ptrdiff_t>(num_chunks)};
+  for (size_t first = 0; first < patterns.size(); first += chunk) {
+    size_t last = std::min(first + chunk, patterns.size());
+    pool.submit([&, first, last] {
+      for (size_t i = first; i < last; i++) {
+        nfas[i] = try_compile(patterns[i], flags);
+      }
+      done.count_down();
+    });
+  }
+  done.wait();
+  return nfas;
+}
+
+std::vector<std::optional<NFA>>
+compile_all(std::span<const std::string> patterns, RegexFlags flags,
+            size_t num_threads) {
+  ThreadPool pool{num_threads};
+  return compile_all(patterns, flags, pool);
+}
+
+} // namespace bp
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <libbearpig/dfa.h>
+#include <libbearpig/matchscratch.h>
+#include <numeric>
+
+namespace bp {
+
+namespace {
+struct DfaTables {
+  std::vector<uint8_t> accepting;
+};
+} // namespace
+
+std::optional<DFA> DFA::from_nfa(const NFA &nfa, size_t max_states) {
+  // Determinize by exploring every state of a lazy DFA that is allowed one
+  // more state than we want. Running into a flush means the DFA is too big.
+  MatchScratch scratch{max_states + 1};
+  scratch.reset(nfa);
+
+  std::array<unsigned char, 256> representatives{};
+  for (int byte = 255; byte >= 0; byte--) {
+    representatives[nfa.byte_classes[byte]] = byte;
+  }
+
+  uint32_t start = scratch.start_state(nfa);
+  for (uint32_t state = 0; state < scratch.dfa_states.size(); state++) {
+    for (size_t cls = 0; cls < nfa.num_classes; cls++) {
+      scratch.next_state(nfa, state, representatives[cls]);
+      if (scratch.stats().dfa_cache_flushes != 0) {
+        return std::nullopt;
+      }
+    }
+  }
+
+  auto tables = std::make_shared<DfaTables>();
+  tables->accepting = std::move(scratch.accepting);
+
+  DFA dfa;
+  dfa.start = start;
+  dfa.num_classes = nfa.num_classes;
+  dfa.byte_classes = nfa.byte_classes;
+  dfa.analysis = nfa.analysis;
+  dfa.starts_with_any = nfa.starts_with_any;
+  dfa.table = StateTable{scratch.transitions, tables->accepting.size()};
+  dfa.accepting = tables->accepting;
+  dfa.storage = std::move(tables);
+  return dfa;
+}
+
+std::vector<RegexMatch> DFA::find_all_matches(std::string_view input) const {
+  std::vector<RegexMatch> matches{};
+  size_t limit = analysis.start_limit(input.size());
+  size_t i = 0;
+  while ((i = next_start(input, i, limit)) < limit) {
+    auto match = run_dfa(input.substr(i), false, i);
+    if (match.success) {
+      matches.emplace_back(match);
+      i += std::max(match.length, 1UL);
+    } else {
+      i++;
+    }
+  }
+  return matches;
+}
+
+RegexMatch DFA::find_first_match(std::string_view input) const {
+  size_t limit = analysis.start_limit(input.size());
+  size_t i = 0;
+  while ((i = next_start(input, i, limit)) < limit) {
+    RegexMatch match = run_dfa(input.substr(i), false, i);
+    if (match.success) {
+      return match;
+    }
+    i++;
+  }
+  return RegexMatch{.success = false, .start = input.size()};
+}
+
+RegexMatch DFA::exact_match(std::string_view input) const {
+  return run_dfa(input, true, 0);
+}
+
+bool DFA::is_match(std::string_view input) const {
+  size_t limit = analysis.start_limit(input.size());
+  for (size_t i = 0; (i = next_start(input, i, limit)) < limit; i++) {
+    if (matches_prefix(input.substr(i))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t DFA::count_matches(std::string_view input) const {
+  size_t count = 0;
+  size_t limit = analysis.start_limit(input.size());
+  size_t i = 0;
+  while ((i = next_start(input, i, limit)) < limit) {
+    size_t length = longest_match(input.substr(i), false);
+    if (length != NO_MATCH) {
+      count++;
+      i += std::max(length, 1UL);
+    } else {
+      i++;
+    }
+  }
+  return count;
+}
+
+Capture DFA::next_match(std::string_view input, size_t from) const {
+  size_t limit = analysis.start_limit(input.size());
+  for (size_t i = from; (i = next_start(input, i, limit)) < limit; i++) {
+    size_t length = longest_match(input.substr(i), false);
+    if (length != NO_MATCH) {
+      return Capture{i, i + length};
+    }
+  }
+  return Capture{};
+}
+
+std::vector<bool>
+DFA::exact_match_batch(std::span<const std::string_view> inputs) const {
+  std::vector<bool> results(inputs.size());
+  // a table that does not fit in L2 waits on memory, not just on L1 misses
+  bool prefetch = table.data().size() > PREFETCH_TABLE_BYTES;
+  table.visit([&](auto ids) {
+    if (prefetch) {
+      exact_match_lanes<true>(ids, inputs, results);
+    } else {
+      exact_match_lanes<false>(ids, inputs, results);
+    }
+  });
+  return results;
+}
+
+// Every lane walks one input. A lane that finishes takes the next input that
+// no lane has had yet, so lanes stay busy however the input lengths differ.
+// The steps of different lanes do not depend on each other, which lets the
+// processor have a table load of every lane in flight at once.
+template <bool Prefetch, typename StateId>
+void DFA::exact_match_lanes(std::span<const StateId> ids,
+                            std::span<const std::string_view> inputs,
+                            std::vector<bool> &results) const {
+  struct Lane {
+    const unsigned char *next;
+    const unsigned char *end;
+    uint32_t state;
+    size_t input;
+  };
+  std::array<Lane, BATCH_LANES> lanes;
+  size_t active = 0;
+  size_t taken = 0;
+  auto take = [&](Lane &lane) {
+    while (taken < inputs.size()) {
+      std::string_view input = inputs[taken];
+      size_t index = taken++;
+      if (!analysis.allows_length(input.size())) {
+        results[index] = false;
+        continue;
+      }
+      if (input.empty()) {
+        results[index] = accepting[start];
+        continue;
+      }
+      const auto *begin = reinterpret_cast<const unsigned char *>(input.data());
+      lane = Lane{begin, begin + input.size(), start, index};
+      return true;
+    }
+    return false;
+  };
+  while (active < BATCH_LANES && take(lanes[active])) {
+    active++;
+  }
+
+  while (active > 0) {
+    for (size_t l = 0; l < active; l++) {
+      Lane &lane = lanes[l];
+      lane.state = ids[lane.state * num_classes + byte_classes[*lane.next++]];
+      if (Prefetch) {
+        __builtin_prefetch(&ids[lane.state * num_classes]);
+      }
+      if (lane.state != DEAD && lane.next != lane.end) {
+        continue;
+      }
+      results[lane.input] = lane.state != DEAD && accepting[lane.state];
+      if (!take(lane)) {
+        // the last lane moves into the gap and is stepped next
+        lane = lanes[--active];
+        l--;
+      }
+    }
+  }
+}
+
+DFA::Profile DFA::profile(std::span<const std::string_view> corpus) const {
+  Profile profile;
+  profile.state_visits.assign(num_states(), 0);
+  profile.transitions.assign(table.size(), 0);
+  auto walk = [&](std::string_view input) {
+    uint32_t state = start;
+    profile.state_visits[state]++;
+    size_t length = 0;
+    for (size_t i = 0; i < input.size(); i++) {
+      size_t index = state * num_classes +
+                     byte_classes[static_cast<unsigned char>(input[i])];
+      profile.transitions[index]++;
+      state = table[index];
+      if (state == DEAD) {
+        break;
+      }
+      profile.state_visits[state]++;
+      if (accepting[state]) {
+        length = i + 1;
+      }
+    }
+    return length;
+  };
+  // the same walks as find_all_matches
+  for (std::string_view input : corpus) {
+    size_t limit = analysis.start_limit(input.size());
+    for (size_t i = 0; (i = next_start(input, i, limit)) < limit;) {
+      i += std::max<size_t>(walk(input.substr(i)), 1);
+    }
+  }
+  return profile;
+}
+
+size_t DFA::Profile::hot_states(double coverage) const {
+  std::vector<uint64_t> visits = state_visits;
+  std::sort(visits.begin(), visits.end(), std::greater{});
+  uint64_t total = std::accumulate(visits.begin(), visits.end(), uint64_t{0});
+  uint64_t covered = 0;
+  size_t hot = 0;
+  while (hot < visits.size() && visits[hot] != 0 &&
+         covered < coverage * total) {
+    covered += visits[hot++];
+  }
+  return hot;
+}
+
+DFA DFA::reordered(const Profile &profile) const {
+  std::vector<uint32_t> order(num_states());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin() + 1, order.end(),
+                   [&](uint32_t a, uint32_t b) {
+                     return profile.state_visits[a] > profile.state_visits[b];
+                   });
+  std::vector<uint32_t> renumbered(num_states());
+  for (uint32_t id = 0; id < order.size(); id++) {
+    renumbered[order[id]] = id;
+  }
+
+  auto tables = std::make_shared<DfaTables>();
+  std::vector<uint32_t> moved(table.size());
+  for (uint32_t id = 0; id < order.size(); id++) {
+    tables->accepting.push_back(accepting[order[id]]);
+    for (size_t cls = 0; cls < num_classes; cls++) {
+      moved[id * num_classes + cls] =
+          renumbered[table[order[id] * num_classes + cls]];
+    }
+  }
+
+  DFA dfa = *this;
+  dfa.start = renumbered[start];
+  dfa.table = StateTable{moved, num_states()};
+  dfa.accepting = tables->accepting;
+  dfa.storage = std::move(tables);
+  return dfa;
+}
+
+RegexMatch DFA::run_dfa(std::string_view input, bool exact,
+                        size_t start_id) const {
+  RegexMatch result{.success = false, .start = start_id};
+  size_t length = longest_match(input, exact);
+  if (length != NO_MATCH) {
+    result.success = true;
+    result.length = length;
+    result.match = std::string{input.substr(0, length)};
+  }
+  return result;
+}
+
+size_t DFA::longest_match(std::string_view input, bool exact) const {
+  if (exact && !analysis.allows_length(input.size())) {
+    return NO_MATCH;
+  }
+  return table.visit(
+      [&](auto ids) { return longest_match(ids, input, exact); });
+}
+
+template <typename StateId>
+size_t DFA::longest_match(std::span<const StateId> ids, std::string_view input,
+                          bool exact) const {
+  uint32_t state = start;
+  bool matched = accepting[state] && (!exact || input.empty());
+  size_t length = 0;
+
+  for (size_t current_input = 0; current_input < input.size();
+       current_input++) {
+    state = ids[state * num_classes +
+                byte_classes[static_cast<unsigned char>(input[current_input])]];
+    if (state == DEAD) {
+      break;
+    }
+    if (accepting[state] && (!exact || current_input + 1 == input.size())) {
+      matched = true;
+      length = current_input + 1;
+    }
+  }
+  return matched ? length : NO_MATCH;
+}
+
+// whether some prefix of input, possibly the empty one, is a match
+bool DFA::matches_prefix(std::string_view input) const {
+  return table.visit([&](auto ids) { return matches_prefix(ids, input); });
+}
+
+template <typename StateId>
+bool DFA::matches_prefix(std::span<const StateId> ids,
+                         std::string_view input) const {
+  uint32_t state = start;
+  for (size_t i = 0; i < input.size() && !accepting[state]; i++) {
+    state = ids[state * num_classes +
+                byte_classes[static_cast<unsigned char>(input[i])]];
+    if (state == DEAD) {
+      return false;
+    }
+  }
+  return accepting[state];
+}
+
+} // namespace bp
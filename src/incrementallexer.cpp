@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <libbearpig/incrementallexer.h>
+#include <ranges>
+
+namespace bp {
+
+LexedToken IncrementalLexer::next_token(std::string_view text, size_t at) {
+  size_t scanned = 0;
+  size_t length =
+      nfa.longest_match(text.substr(at), false, at, scratch, &scanned);
+  // running into the end of the text counts as looking past it, text
+  // appended there could extend the token
+  if (at + scanned == text.size()) {
+    scanned++;
+  }
+  if (length == NFA::NO_MATCH || length == 0) {
+    return LexedToken{at, 1, scanned, false};
+  }
+  return LexedToken{at, length, scanned, true};
+}
+
+IncrementalLexer::Checkpoint IncrementalLexer::checkpoint(size_t chunk) const {
+  Checkpoint checkpoint = chunks[chunk].checkpoint;
+  if (chunk >= shifted) {
+    checkpoint.token += pending_tokens;
+    checkpoint.offset += pending_bytes;
+    checkpoint.reach += pending_bytes;
+  }
+  return checkpoint;
+}
+
+size_t IncrementalLexer::chunk_of_token(size_t token) const {
+  auto later = std::views::iota(size_t{1}, chunks.size());
+  return std::ranges::partition_point(later,
+                                      [&](size_t chunk) {
+                                        return checkpoint(chunk).token <= token;
+                                      }) -
+         later.begin();
+}
+
+size_t IncrementalLexer::chunk_of_offset(size_t offset) const {
+  auto later = std::views::iota(size_t{1}, chunks.size());
+  return std::ranges::partition_point(
+             later,
+             [&](size_t chunk) { return checkpoint(chunk).offset <= offset; }) -
+         later.begin();
+}
+
+// Moves where the pending shift starts to chunk, writing it into the
+// checkpoints in between. Edits near each other only move it a little, and
+// with nothing pending, as after lex(), it just moves.
+void IncrementalLexer::shift_from(size_t chunk) {
+  if (pending_tokens == 0 && pending_bytes == 0) {
+    shifted = chunk;
+    return;
+  }
+  for (; shifted < chunk; shifted++) {
+    chunks[shifted].checkpoint = checkpoint(shifted);
+    last_checkpoints_written++;
+  }
+  for (; shifted > chunk; shifted--) {
+    last_checkpoints_written++;
+    Checkpoint &moved = chunks[shifted - 1].checkpoint;
+    moved.token -= pending_tokens;
+    moved.offset -= pending_bytes;
+    moved.reach -= pending_bytes;
+  }
+}
+
+// Replaces count chunks from first on, which must be where the shift starts,
+// with chunks of tokens starting at checkpoint. The number of chunks is kept
+// while that leaves each between 1 and 2 * interval tokens, so an edit rarely
+// moves the chunks after it. Returns the furthest the tokens looked.
+size_t IncrementalLexer::replace_chunks(size_t first, size_t count,
+                                        Checkpoint checkpoint,
+                                        std::span<const LexedToken> tokens) {
+  size_t total = tokens.size();
+  size_t kept = total >= count && total <= 2 * interval * count
+                    ? count
+                    : (total + interval - 1) / interval;
+  if (kept == 0 && count == chunks.size()) {
+    kept = 1;
+  }
+  if (kept < count) {
+    chunks.erase(chunks.begin() + first + kept, chunks.begin() + first + count);
+  } else {
+    chunks.insert(chunks.begin() + first + count, kept - count, Chunk{});
+  }
+  size_t reach = checkpoint.reach;
+  for (size_t i = 0; i < kept; i++) {
+    size_t begin = i * total / kept;
+    size_t end = (i + 1) * total / kept;
+    Chunk &chunk = chunks[first + i];
+    chunk.checkpoint =
+        Checkpoint{checkpoint.token + begin,
+                   begin < total ? tokens[begin].start : checkpoint.offset,
+                   reach};
+    chunk.tokens.assign(tokens.begin() + begin, tokens.begin() + end);
+    for (LexedToken &token : chunk.tokens) {
+      reach = std::max(reach, token.reach());
+      token.start -= chunk.checkpoint.offset;
+    }
+  }
+  shifted = first + kept;
+  last_checkpoints_written += kept;
+  return reach;
+}
+
+void IncrementalLexer::lex(std::string_view text) {
+  std::vector<LexedToken> lexed;
+  for (size_t at = 0; at < text.size();) {
+    lexed.push_back(next_token(text, at));
+    at = lexed.back().end();
+  }
+  last_bytes_lexed = text.size();
+  last_checkpoints_written = 0;
+  chunks.clear();
+  shifted = 0;
+  pending_tokens = 0;
+  pending_bytes = 0;
+  replace_chunks(0, 0, Checkpoint{0, 0, 0}, lexed);
+}
+
+size_t IncrementalLexer::num_tokens() const {
+  return checkpoint(chunks.size() - 1).token + chunks.back().tokens.size();
+}
+
+LexedToken IncrementalLexer::token(size_t index) const {
+  size_t chunk = chunk_of_token(index);
+  Checkpoint at = checkpoint(chunk);
+  LexedToken token = chunks[chunk].tokens[index - at.token];
+  token.start += at.offset;
+  return token;
+}
+
+std::vector<LexedToken> IncrementalLexer::tokens() const {
+  std::vector<LexedToken> tokens;
+  for (size_t chunk = 0; chunk < chunks.size(); chunk++) {
+    size_t offset = checkpoint(chunk).offset;
+    for (LexedToken token : chunks[chunk].tokens) {
+      token.start += offset;
+      tokens.push_back(token);
+    }
+  }
+  return tokens;
+}
+
+IncrementalLexer::Change IncrementalLexer::relex(std::string_view text,
+                                                 Edit edit) {
+  // reach only grows from one checkpoint to the next
+  auto later = std::views::iota(size_t{1}, chunks.size());
+  size_t from = std::ranges::partition_point(later,
+                                             [&](size_t chunk) {
+                                               return checkpoint(chunk).reach <=
+                                                      edit.start;
+                                             }) -
+                later.begin();
+  Checkpoint start = checkpoint(from);
+  size_t edit_end = edit.start + edit.inserted;
+
+  std::vector<LexedToken> fresh;
+  size_t resumed = num_tokens();
+  size_t at = start.offset;
+  while (at < text.size()) {
+    if (at >= edit_end) {
+      size_t old_at = at + edit.removed - edit.inserted;
+      size_t chunk = chunk_of_offset(old_at);
+      size_t relative = old_at - checkpoint(chunk).offset;
+      const std::vector<LexedToken> &old = chunks[chunk].tokens;
+      auto boundary = std::partition_point(
+          old.begin(), old.end(),
+          [relative](const LexedToken &token) { return token.start < relative; });
+      if (boundary != old.end() && boundary->start == relative) {
+        resumed = checkpoint(chunk).token + (boundary - old.begin());
+        break;
+      }
+    }
+    fresh.push_back(next_token(text, at));
+    at = fresh.back().end();
+  }
+  last_bytes_lexed = at - start.offset;
+  last_checkpoints_written = 0;
+  Change change{start.token, resumed - start.token, fresh.size()};
+
+  // The chunks from the checkpoint to the last replaced token are written
+  // again, with the old tokens after it in the same chunk, and every chunk
+  // after them moves by the edit.
+  size_t last = resumed > start.token ? chunk_of_token(resumed - 1) : from;
+  shift_from(last + 1);
+  const Chunk &tail = chunks[last];
+  for (size_t i = resumed - tail.checkpoint.token; i < tail.tokens.size();
+       i++) {
+    LexedToken token = tail.tokens[i];
+    token.start += tail.checkpoint.offset + edit.inserted - edit.removed;
+    fresh.push_back(token);
+  }
+  size_t reach = replace_chunks(from, last + 1 - from, start, fresh);
+  pending_tokens += change.inserted - change.removed;
+  pending_bytes += edit.inserted - edit.removed;
+
+  // The checkpoints after them kept their reach, shifted, unless a token
+  // before them now looks further or less far. Once one agrees, the same
+  // tokens come before the rest and they agree too.
+  for (size_t chunk = shifted; chunk < chunks.size(); chunk++) {
+    Checkpoint after = checkpoint(chunk);
+    if (after.reach == reach) {
+      break;
+    }
+    chunks[chunk].checkpoint.reach = reach - pending_bytes;
+    last_checkpoints_written++;
+    for (const LexedToken &token : chunks[chunk].tokens) {
+      reach = std::max(reach, after.offset + token.reach());
+    }
+  }
+  return change;
+}
+
+} // namespace bp
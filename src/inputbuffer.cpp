@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <libbearpig/inputbuffer.h>
+#include <unistd.h>
+
+namespace bp {
+
+InputBuffer::InputBuffer(int fd, size_t capacity)
+    : fd{fd}, window(capacity + 1) {
+  window[0] = SENTINEL;
+  // lets the kernel read ahead while we match, ignored for pipes
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+InputBuffer::InputBuffer(std::istream &in, size_t capacity)
+    : stream{&in}, window(capacity + 1) {
+  window[0] = SENTINEL;
+}
+
+size_t InputBuffer::read_some(char *into, size_t max) {
+  if (stream != nullptr) {
+    stream->read(into, max);
+    return stream->gcount();
+  }
+  while (true) {
+    ssize_t count = read(fd, into, max);
+    if (count >= 0) {
+      return count;
+    }
+    if (errno != EINTR) {
+      read_error = errno;
+      return 0;
+    }
+  }
+}
+
+bool InputBuffer::refill() {
+  if (exhausted) {
+    return false;
+  }
+  // the old token is done with, only what comes after mark is kept
+  size_t keep = limit - mark;
+  if (mark > 0) {
+    std::memmove(window.data(), window.data() + mark, keep);
+    window_offset += mark;
+    cursor -= mark;
+    token_begin = token_begin >= mark ? token_begin - mark : 0;
+    token_length = 0;
+    mark = 0;
+    limit = keep;
+  }
+  if (limit == capacity()) {
+    // a token longer than the window
+    window.resize(2 * capacity() + 1);
+  }
+  size_t count = read_some(window.data() + limit, capacity() - limit);
+  if (count == 0) {
+    exhausted = true;
+  }
+  limit += count;
+  window[limit] = SENTINEL;
+  return count > 0;
+}
+
+bool InputBuffer::at_end() {
+  while (mark == limit) {
+    if (!refill()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t InputBuffer::skip(size_t count) {
+  size_t skipped = 0;
+  while (skipped < count && !at_end()) {
+    size_t step = std::min(count - skipped, limit - mark);
+    mark += step;
+    skipped += step;
+  }
+  token_begin = mark;
+  token_length = 0;
+  cursor = mark;
+  return skipped;
+}
+
+} // namespace bp
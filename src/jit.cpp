@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <cstring>
+#include <fmt/format.h>
+#include <fstream>
+#include <libbearpig/jit.h>
+#include <map>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if BEARPIG_JIT && defined(__x86_64__)
+#define BEARPIG_JIT_X86_64 1
+#else
+#define BEARPIG_JIT_X86_64 0
+#endif
+
+namespace bp {
+
+namespace {
+
+// generated code beyond this is not worth the memory, the tables do as well
+constexpr size_t MAX_CODE_BYTES = 64 << 20;
+// above this many ranges a state dispatches through a jump table
+constexpr size_t MAX_COMPARE_RANGES = 6;
+constexpr int UNROLL = 4;
+
+// Emits x86-64 machine code with jumps to labels that are bound later. Jumps
+// are always rel32, which keeps the bookkeeping trivial.
+class Assembler {
+public:
+  std::vector<uint8_t> code;
+
+  size_t new_label() {
+    labels.push_back(UNBOUND);
+    return labels.size() - 1;
+  }
+  void bind(size_t label) { labels[label] = code.size(); }
+
+  void emit(std::initializer_list<uint8_t> bytes) {
+    code.insert(code.end(), bytes);
+  }
+  void emit32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+      code.push_back(value >> (8 * i));
+    }
+  }
+  // opcode followed by a rel32 to label
+  void jump(std::initializer_list<uint8_t> opcode, size_t label) {
+    emit(opcode);
+    jumps.push_back({code.size(), label});
+    emit32(0);
+  }
+  // an int32 holding label's offset from base
+  void table_entry(size_t base, size_t label) {
+    entries.push_back({code.size(), label, base});
+    emit32(0);
+  }
+  void align(size_t alignment) {
+    while (code.size() % alignment != 0) {
+      code.push_back(0xCC); // int3, never executed
+    }
+  }
+
+  void resolve() {
+    for (const Patch &patch : jumps) {
+      patch32(patch.at, labels[patch.label] - (patch.at + 4));
+    }
+    for (const Patch &patch : entries) {
+      patch32(patch.at, labels[patch.label] - labels[patch.base]);
+    }
+  }
+
+private:
+  static constexpr size_t UNBOUND = SIZE_MAX;
+  struct Patch {
+    size_t at;
+    size_t label;
+    size_t base{0};
+  };
+  void patch32(size_t at, int64_t value) {
+    uint32_t bits = static_cast<int32_t>(value);
+    std::memcpy(code.data() + at, &bits, 4);
+  }
+
+  std::vector<size_t> labels;
+  std::vector<Patch> jumps;
+  std::vector<Patch> entries;
+};
+
+struct ByteRange {
+  uint8_t first;
+  uint8_t last;
+  uint32_t target;
+};
+
+// Register use, with the System V calling convention:
+//   rdi  the next byte to read         rsi  end of input
+//   edx  stop at the first accept      rcx  start of input
+//   r8   end of the last match, 0 for none
+//   eax  the byte read                 r9, r10  scratch
+class DfaCompiler {
+public:
+  DfaCompiler(const StateTable &table,
+              std::span<const uint8_t> accepting, size_t num_classes,
+              const std::array<uint8_t, 256> &byte_classes, uint32_t start)
+      : table{table}, accepting{accepting}, num_classes{num_classes},
+        byte_classes{byte_classes}, start{start} {}
+
+  void compile() {
+    done = as.new_label();
+    for (size_t state = 0; state < accepting.size(); state++) {
+      entries.push_back(as.new_label());
+    }
+    // mov rcx, rdi; xor r8d, r8d
+    as.emit({0x48, 0x89, 0xF9, 0x45, 0x31, 0xC0});
+    as.jump({0xE9}, label_of(start));
+    for (uint32_t state = 1; state < accepting.size(); state++) {
+      state_offsets.push_back({state, as.code.size()});
+      compile_state(state);
+    }
+    state_offsets.push_back({DFA::DEAD, as.code.size()});
+    as.bind(done);
+    // test r8, r8; jz no match; mov rax, r8; sub rax, rcx; ret
+    as.emit({0x4D, 0x85, 0xC0, 0x74, 0x07});
+    as.emit({0x4C, 0x89, 0xC0, 0x48, 0x29, 0xC8, 0xC3});
+    // mov rax, -1; ret
+    as.emit({0x48, 0xC7, 0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xC3});
+    as.resolve();
+  }
+
+  Assembler as;
+  // where the code of each state starts, DEAD marking the exit code
+  std::vector<std::pair<uint32_t, size_t>> state_offsets;
+
+private:
+  size_t label_of(uint32_t target) const {
+    return target == DFA::DEAD ? done : entries[target];
+  }
+
+  // jumps to label if eax is in [first, last], with jcc
+  void check(const ByteRange &range, size_t label) {
+    if (range.first == range.last) {
+      // cmp eax, imm32; je
+      as.emit({0x3D});
+      as.emit32(range.first);
+      as.jump({0x0F, 0x84}, label);
+    } else {
+      // lea r10d, [rax - first]; cmp r10d, last - first; jbe
+      as.emit({0x44, 0x8D, 0x90});
+      as.emit32(-static_cast<uint32_t>(range.first));
+      as.emit({0x41, 0x81, 0xFA});
+      as.emit32(range.last - range.first);
+      as.jump({0x0F, 0x86}, label);
+    }
+  }
+
+  void read_byte() {
+    // movzx eax, byte [rdi]; inc rdi
+    as.emit({0x0F, 0xB6, 0x07, 0x48, 0xFF, 0xC7});
+  }
+
+  void compile_state(uint32_t state) {
+    std::vector<ByteRange> ranges;
+    for (unsigned byte = 0; byte < 256; byte++) {
+      uint32_t target = table[state * num_classes + byte_classes[byte]];
+      if (!ranges.empty() && ranges.back().target == target) {
+        ranges.back().last = byte;
+      } else {
+        ranges.push_back({static_cast<uint8_t>(byte),
+                          static_cast<uint8_t>(byte), target});
+      }
+    }
+    std::vector<ByteRange> loops;
+    std::vector<ByteRange> exits;
+    for (const ByteRange &range : ranges) {
+      (range.target == state ? loops : exits).push_back(range);
+    }
+
+    as.bind(entries[state]);
+    if (accepting[state]) {
+      // mov r8, rdi; test edx, edx; jnz done
+      as.emit({0x49, 0x89, 0xF8, 0x85, 0xD2});
+      as.jump({0x0F, 0x85}, done);
+    }
+    if (loops.empty() && exits.size() == 1 && exits[0].target == DFA::DEAD) {
+      // nothing more can match, no need to read on
+      as.jump({0xE9}, done);
+      return;
+    }
+    size_t other = as.new_label();
+    if (!loops.empty() && loops.size() <= 2) {
+      // with UNROLL bytes left, loop without checking for the end
+      size_t loop = as.new_label();
+      size_t tail = as.new_label();
+      as.bind(loop);
+      // lea r9, [rdi + UNROLL]; cmp r9, rsi; ja tail
+      as.emit({0x4C, 0x8D, 0x4F, UNROLL, 0x49, 0x39, 0xF1});
+      as.jump({0x0F, 0x87}, tail);
+      for (int i = 0; i < UNROLL; i++) {
+        size_t next = as.new_label();
+        read_byte();
+        for (const ByteRange &range : loops) {
+          check(range, next);
+        }
+        as.jump({0xE9}, other);
+        as.bind(next);
+        if (accepting[state]) {
+          as.emit({0x49, 0x89, 0xF8});
+        }
+      }
+      as.jump({0xE9}, loop);
+      as.bind(tail);
+    }
+    // cmp rdi, rsi; jae done
+    as.emit({0x48, 0x39, 0xF7});
+    as.jump({0x0F, 0x83}, done);
+    read_byte();
+    for (const ByteRange &range : loops) {
+      check(range, entries[state]);
+    }
+    as.bind(other);
+    dispatch(exits);
+  }
+
+  // branches on eax to the targets of ranges, which cover every byte not
+  // handled before
+  void dispatch(const std::vector<ByteRange> &ranges) {
+    if (ranges.empty()) {
+      // unreachable, every byte looped
+      as.jump({0xE9}, done);
+      return;
+    }
+    std::map<uint32_t, size_t> coverage;
+    for (const ByteRange &range : ranges) {
+      coverage[range.target] += range.last - range.first + 1;
+    }
+    uint32_t fallback =
+        std::max_element(coverage.begin(), coverage.end(),
+                         [](auto &a, auto &b) { return a.second < b.second; })
+            ->first;
+    size_t compares = std::count_if(
+        ranges.begin(), ranges.end(),
+        [fallback](const ByteRange &range) { return range.target != fallback; });
+    if (compares <= MAX_COMPARE_RANGES) {
+      for (const ByteRange &range : ranges) {
+        if (range.target != fallback) {
+          check(range, label_of(range.target));
+        }
+      }
+      as.jump({0xE9}, label_of(fallback));
+      return;
+    }
+
+    // lea r9, [rip + table]; movsxd r10, [r9 + rax*4]; add r10, r9; jmp r10
+    size_t table_label = as.new_label();
+    as.jump({0x4C, 0x8D, 0x0D}, table_label);
+    as.emit({0x4D, 0x63, 0x14, 0x81, 0x4D, 0x01, 0xCA, 0x41, 0xFF, 0xE2});
+    as.align(4);
+    as.bind(table_label);
+    // bytes that were handled before never get here, any entry does
+    std::array<size_t, 256> targets;
+    targets.fill(done);
+    for (const ByteRange &range : ranges) {
+      for (unsigned byte = range.first; byte <= range.last; byte++) {
+        targets[byte] = label_of(range.target);
+      }
+    }
+    for (size_t target : targets) {
+      as.table_entry(table_label, target);
+    }
+  }
+
+  const StateTable &table;
+  std::span<const uint8_t> accepting;
+  size_t num_classes;
+  const std::array<uint8_t, 256> &byte_classes;
+  uint32_t start;
+  size_t done{0};
+  std::vector<size_t> entries;
+};
+
+} // namespace
+
+JitDFA::JitDFA(DFA compiled, const Options &options) : dfa{std::move(compiled)} {
+  if (!BEARPIG_JIT_X86_64) {
+    return;
+  }
+  DfaCompiler compiler{dfa.table, dfa.accepting, dfa.num_classes,
+                       dfa.byte_classes, dfa.start};
+  compiler.compile();
+  const std::vector<uint8_t> &bytes = compiler.as.code;
+  if (bytes.size() > MAX_CODE_BYTES) {
+    spdlog::debug("not compiling a DFA of {} states to {} bytes of code",
+                  dfa.num_states(), bytes.size());
+    return;
+  }
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = (bytes.size() + page - 1) / page * page;
+  void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (address == MAP_FAILED) {
+    spdlog::warn("could not map pages for DFA code: {}", strerror(errno));
+    return;
+  }
+  std::memcpy(address, bytes.data(), bytes.size());
+  if (mprotect(address, size, PROT_READ | PROT_EXEC) != 0) {
+    spdlog::warn("could not make DFA code executable: {}", strerror(errno));
+    munmap(address, size);
+    return;
+  }
+  code = std::shared_ptr<const void>{
+      address, [size](const void *address) {
+        munmap(const_cast<void *>(address), size);
+      }};
+  entry = reinterpret_cast<MatchFunction>(address);
+  code_bytes = bytes.size();
+
+  if (options.perf_map) {
+    std::ofstream map{fmt::format("/tmp/perf-{}.map", getpid()),
+                      std::ios::app};
+    auto base = reinterpret_cast<uintptr_t>(address);
+    auto &offsets = compiler.state_offsets;
+    map << fmt::format("{:x} {:x} {}\n", base, offsets.front().second,
+                       options.name);
+    for (size_t i = 0; i + 1 < offsets.size(); i++) {
+      map << fmt::format("{:x} {:x} {}_state{}\n", base + offsets[i].second,
+                         offsets[i + 1].second - offsets[i].second,
+                         options.name, offsets[i].first);
+    }
+    map << fmt::format("{:x} {:x} {}_exit\n", base + offsets.back().second,
+                       bytes.size() - offsets.back().second, options.name);
+  }
+}
+
+size_t JitDFA::longest_match(std::string_view input, bool first) const {
+  if (entry != nullptr) {
+    // the generated code tells no match apart by a null match end
+    const auto *begin = reinterpret_cast<const unsigned char *>(
+        input.data() != nullptr ? input.data() : "");
+    return entry(begin, begin + input.size(), first);
+  }
+  return dfa.table.visit([&](auto ids) {
+    uint32_t state = dfa.start;
+    size_t length = NO_MATCH;
+    for (size_t i = 0;; i++) {
+      if (dfa.accepting[state]) {
+        length = i;
+        if (first) {
+          break;
+        }
+      }
+      if (i == input.size()) {
+        break;
+      }
+      state = ids[state * dfa.num_classes +
+                  dfa.byte_classes[static_cast<unsigned char>(input[i])]];
+      if (state == DFA::DEAD) {
+        break;
+      }
+    }
+    return length;
+  });
+}
+
+RegexMatch JitDFA::run(std::string_view input, bool exact,
+                       size_t start_id) const {
+  RegexMatch result{.success = false, .start = start_id};
+  size_t length = longest_match(input, false);
+  // the longest match covers all of input exactly when input matches
+  if (length != NO_MATCH && (!exact || length == input.size())) {
+    result.success = true;
+    result.length = length;
+    result.match = std::string{input.substr(0, length)};
+  }
+  return result;
+}
+
+RegexMatch JitDFA::exact_match(std::string_view input) const {
+  if (!dfa.analysis.allows_length(input.size())) {
+    return RegexMatch{.success = false, .start = 0};
+  }
+  return run(input, true, 0);
+}
+
+RegexMatch JitDFA::find_first_match(std::string_view input) const {
+  size_t limit = dfa.analysis.start_limit(input.size());
+  size_t i = 0;
+  while ((i = dfa.next_start(input, i, limit)) < limit) {
+    RegexMatch match = run(input.substr(i), false, i);
+    if (match.success) {
+      return match;
+    }
+    i++;
+  }
+  return RegexMatch{.success = false, .start = input.size()};
+}
+
+std::vector<RegexMatch>
+JitDFA::find_all_matches(std::string_view input) const {
+  std::vector<RegexMatch> matches{};
+  size_t limit = dfa.analysis.start_limit(input.size());
+  size_t i = 0;
+  while ((i = dfa.next_start(input, i, limit)) < limit) {
+    auto match = run(input.substr(i), false, i);
+    if (match.success) {
+      matches.emplace_back(match);
+      i += std::max(match.length, 1UL);
+    } else {
+      i++;
+    }
+  }
+  return matches;
+}
+
+bool JitDFA::is_match(std::string_view input) const {
+  size_t limit = dfa.analysis.start_limit(input.size());
+  for (size_t i = 0; (i = dfa.next_start(input, i, limit)) < limit; i++) {
+    if (longest_match(input.substr(i), true) != NO_MATCH) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t JitDFA::count_matches(std::string_view input) const {
+  size_t count = 0;
+  size_t limit = dfa.analysis.start_limit(input.size());
+  size_t i = 0;
+  while ((i = dfa.next_start(input, i, limit)) < limit) {
+    size_t length = longest_match(input.substr(i), false);
+    if (length != NO_MATCH) {
+      count++;
+      i += std::max(length, 1UL);
+    } else {
+      i++;
+    }
+  }
+  return count;
+}
+
+} // namespace bp
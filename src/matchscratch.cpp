@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <libbearpig/matchscratch.h>
+#include <span>
+#include <libbearpig/nfa.h>
+#include <libbearpig/trace.h>
+
+namespace bp {
+
+MatchStats &MatchStats::operator+=(const MatchStats &other) {
+  bytes_scanned += other.bytes_scanned;
+  candidate_starts += other.candidate_starts;
+  prefilter_hits += other.prefilter_hits;
+  nfa_states_visited += other.nfa_states_visited;
+  epsilon_closures += other.epsilon_closures;
+  dfa_cache_hits += other.dfa_cache_hits;
+  dfa_cache_misses += other.dfa_cache_misses;
+  dfa_cache_flushes += other.dfa_cache_flushes;
+  peak_memory = std::max(peak_memory, other.peak_memory);
+  return *this;
+}
+
+MatchScratch &MatchScratch::for_this_thread() {
+  static thread_local MatchScratch scratch;
+  return scratch;
+}
+
+size_t
+MatchScratch::KeyHash::operator()(const std::vector<uint32_t> &key) const {
+  // FNV-1a over the sorted state ids
+  size_t hash = 14695981039346656037ULL;
+  for (uint32_t id : key) {
+    hash = (hash ^ id) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+void MatchScratch::reset(const NFA &nfa) {
+  if (program_id == nfa.program_id) {
+    return;
+  }
+  program_id = nfa.program_id;
+  num_classes = nfa.num_classes;
+  num_tags = nfa.num_tags();
+  restart_marker = nfa.num_states();
+  nfa_states.resize(nfa.num_states() + 1);
+  tag_set.assign(num_tags, 0);
+  flush();
+  flush_tagged();
+}
+
+void MatchScratch::flush() {
+  if (!dfa_states.empty()) {
+    BP_TRACE(DFA_FLUSH, dfa_states.size(), 0);
+    match_stats.dfa_cache_flushes++;
+  }
+  dfa_state_ids.clear();
+  dfa_states.clear();
+  transitions.clear();
+  accepting.clear();
+  start = UNKNOWN;
+  unanchored_start = UNKNOWN;
+  interned_bytes = 0;
+
+  // the empty set is the dead state, it never leaves itself
+  auto [dead, _] = dfa_state_ids.emplace(std::vector<uint32_t>{}, DEAD);
+  dfa_states.push_back(&dead->first);
+  accepting.push_back(false);
+  transitions.resize(num_classes, DEAD);
+}
+
+uint32_t MatchScratch::start_state(const NFA &nfa) {
+  if (start == UNKNOWN) {
+    nfa_states.clear();
+    add_with_closure(nfa, 0);
+    start = intern(nfa);
+  }
+  return start;
+}
+
+// The start state with the marker added. compute_next_state() adds the start
+// closure to the successors of every marked state, so they stand for all
+// matches that began at or before the current byte.
+uint32_t MatchScratch::unanchored_start_state(const NFA &nfa) {
+  if (unanchored_start == UNKNOWN) {
+    nfa_states.clear();
+    add_with_closure(nfa, 0);
+    nfa_states.insert(restart_marker);
+    unanchored_start = intern(nfa);
+  }
+  return unanchored_start;
+}
+
+void MatchScratch::add_with_closure(const NFA &nfa, uint32_t state) {
+  match_stats.epsilon_closures++;
+  stack.push_back(state);
+  while (!stack.empty()) {
+    uint32_t current = stack.back();
+    stack.pop_back();
+    if (nfa_states.contains(current)) {
+      continue;
+    }
+    nfa_states.insert(current);
+    match_stats.nfa_states_visited++;
+    for (const FlatEdge &transition : nfa.edges_of(current)) {
+      if (transition.is_epsilon()) {
+        stack.push_back(transition.to);
+      }
+    }
+  }
+}
+
+uint32_t MatchScratch::compute_next_state(const NFA &nfa, uint32_t state,
+                                          unsigned char byte) {
+  match_stats.dfa_cache_misses++;
+  nfa_states.clear();
+  const std::vector<uint32_t> &ids = *dfa_states[state];
+  // sorted, so the marker comes last
+  bool unanchored = !ids.empty() && ids.back() == restart_marker;
+  for (uint32_t id : std::span{ids}.first(ids.size() - unanchored)) {
+    for (const FlatEdge &transition : nfa.edges_of(id)) {
+      if (transition.accepts(byte)) {
+        add_with_closure(nfa, transition.to);
+      }
+    }
+  }
+  if (unanchored) {
+    add_with_closure(nfa, 0);
+    nfa_states.insert(restart_marker);
+  }
+
+  uint64_t flushes_before = match_stats.dfa_cache_flushes;
+  uint32_t next = intern(nfa);
+  // a flush drops the state we came from, so there is nothing to cache into
+  if (match_stats.dfa_cache_flushes == flushes_before) {
+    transitions[state * num_classes + nfa.byte_classes[byte]] = next;
+  }
+  return next;
+}
+
+uint32_t MatchScratch::intern(const NFA &nfa) {
+  key_buffer.assign(nfa_states.dense.begin(),
+                    nfa_states.dense.begin() + nfa_states.size);
+  std::sort(key_buffer.begin(), key_buffer.end());
+  auto found = dfa_state_ids.find(key_buffer);
+  if (found != dfa_state_ids.end()) {
+    return found->second;
+  }
+
+  if (dfa_states.size() >= max_dfa_states) {
+    flush();
+  }
+  uint32_t id = dfa_states.size();
+  auto [inserted, _] = dfa_state_ids.emplace(key_buffer, id);
+  dfa_states.push_back(&inserted->first);
+  // node, key and bucket, roughly
+  interned_bytes +=
+      key_buffer.size() * sizeof(uint32_t) + 4 * sizeof(void *);
+  accepting.push_back(
+      std::binary_search(key_buffer.begin(), key_buffer.end(), nfa.accept_id));
+  transitions.resize(transitions.size() + num_classes, UNKNOWN);
+  match_stats.peak_memory = std::max(match_stats.peak_memory, memory_usage());
+  BP_TRACE(DFA_STATE_ADDED, id, key_buffer.size());
+  return id;
+}
+
+void MatchScratch::flush_tagged() {
+  if (!tagged_states.empty()) {
+    match_stats.dfa_cache_flushes++;
+  }
+  tagged_state_ids.clear();
+  tagged_states.clear();
+  tagged_transitions.clear();
+  tagged_commands.clear();
+  tagged_accept.clear();
+  tagged_start = UNKNOWN;
+
+  auto [dead, _] = tagged_state_ids.emplace(std::vector<uint32_t>{}, DEAD);
+  tagged_states.push_back(&dead->first);
+  tagged_accept.push_back(NO_ACCEPT);
+  tagged_transitions.resize(num_classes, TaggedTransition{DEAD, 0});
+}
+
+uint32_t MatchScratch::tagged_start_state(const NFA &nfa) {
+  if (tagged_start == UNKNOWN) {
+    nfa_states.clear();
+    key_buffer.clear();
+    command_buffer.clear();
+    add_with_tagged_closure(nfa, 0, 0, CLEAR_TAG);
+    start_commands = command_buffer;
+    tagged_start = intern_tagged(nfa);
+  }
+  return tagged_start;
+}
+
+uint32_t MatchScratch::tagged_next_state(const NFA &nfa, uint32_t state,
+                                         unsigned char byte) {
+  size_t index = state * num_classes + nfa.byte_classes[byte];
+  TaggedTransition transition = tagged_transitions[index];
+  if (transition.target != UNKNOWN) {
+    match_stats.dfa_cache_hits++;
+    tagged_step_commands = tagged_commands.data() + transition.commands;
+    tagged_step_size = tagged_states[transition.target]->size() * num_tags;
+    return transition.target;
+  }
+
+  match_stats.dfa_cache_misses++;
+  nfa_states.clear();
+  key_buffer.clear();
+  command_buffer.clear();
+  const std::vector<uint32_t> &configs = *tagged_states[state];
+  for (uint32_t source = 0; source < configs.size(); source++) {
+    for (const FlatEdge &edge : nfa.edges_of(configs[source])) {
+      if (edge.accepts(byte)) {
+        add_with_tagged_closure(nfa, edge.to, 0, source);
+      }
+    }
+  }
+
+  uint64_t flushes_before = match_stats.dfa_cache_flushes;
+  uint32_t next = intern_tagged(nfa);
+  // like the lazy DFA, a flush leaves nothing to cache the transition into
+  if (match_stats.dfa_cache_flushes == flushes_before) {
+    tagged_transitions[index] =
+        TaggedTransition{next, static_cast<uint32_t>(tagged_commands.size())};
+    tagged_commands.insert(tagged_commands.end(), command_buffer.begin(),
+                           command_buffer.end());
+  }
+  tagged_step_commands = command_buffer.data();
+  tagged_step_size = command_buffer.size();
+  return next;
+}
+
+// Visits the epsilon closure of state depth first in the order the edges were
+// added, which is the order a backtracking matcher tries them in. States seen
+// before in this step were reached by a preferred path and are skipped. For
+// each state that matters the tags set on the way get the current position,
+// the others are copied from the registers of configuration source.
+void MatchScratch::add_with_tagged_closure(const NFA &nfa, uint32_t state,
+                                           uint16_t tag, uint32_t source) {
+  match_stats.epsilon_closures++;
+  closure_stack.push_back(ClosureEntry{state, tag, false, false});
+  while (!closure_stack.empty()) {
+    ClosureEntry entry = closure_stack.back();
+    closure_stack.pop_back();
+    if (entry.restore) {
+      tag_set[entry.tag - 1] = entry.was_set;
+      continue;
+    }
+    if (nfa_states.contains(entry.state)) {
+      continue;
+    }
+    nfa_states.insert(entry.state);
+    match_stats.nfa_states_visited++;
+    if (entry.tag != 0) {
+      closure_stack.push_back(
+          ClosureEntry{0, entry.tag, true, tag_set[entry.tag - 1] != 0});
+      tag_set[entry.tag - 1] = 1;
+    }
+
+    auto edges = nfa.edges_of(entry.state);
+    bool consumes = entry.state == nfa.accept_id;
+    // pushed in reverse so the first edge is the first one visited
+    for (auto edge = edges.rbegin(); edge != edges.rend(); ++edge) {
+      if (edge->is_epsilon()) {
+        closure_stack.push_back(
+            ClosureEntry{edge->to, edge->tag, false, false});
+      } else {
+        consumes = true;
+      }
+    }
+    if (!consumes) {
+      continue;
+    }
+    key_buffer.push_back(entry.state);
+    for (size_t t = 0; t < num_tags; t++) {
+      if (tag_set[t]) {
+        command_buffer.push_back(SET_TAG);
+      } else if (source == CLEAR_TAG) {
+        command_buffer.push_back(CLEAR_TAG);
+      } else {
+        command_buffer.push_back(source * num_tags + t);
+      }
+    }
+  }
+}
+
+// Unlike intern(), the key keeps its order: the same states in another order
+// disambiguate differently and are a different tagged state.
+uint32_t MatchScratch::intern_tagged(const NFA &nfa) {
+  auto found = tagged_state_ids.find(key_buffer);
+  if (found != tagged_state_ids.end()) {
+    return found->second;
+  }
+
+  if (tagged_states.size() >= max_dfa_states) {
+    flush_tagged();
+  }
+  uint32_t id = tagged_states.size();
+  auto [inserted, _] = tagged_state_ids.emplace(key_buffer, id);
+  tagged_states.push_back(&inserted->first);
+  auto accept =
+      std::find(key_buffer.begin(), key_buffer.end(), nfa.accept_id);
+  tagged_accept.push_back(accept == key_buffer.end()
+                              ? NO_ACCEPT
+                              : accept - key_buffer.begin());
+  tagged_transitions.resize(tagged_transitions.size() + num_classes);
+  size_t num_registers = key_buffer.size() * num_tags;
+  if (registers.size() < num_registers) {
+    registers.resize(num_registers);
+    next_registers.resize(num_registers);
+  }
+  return id;
+}
+
+size_t MatchScratch::memory_usage() const {
+  return interned_bytes +
+         (nfa_states.dense.capacity() + nfa_states.sparse.capacity() +
+          stack.capacity() + key_buffer.capacity() + transitions.capacity()) *
+             sizeof(uint32_t) +
+         accepting.capacity() + dfa_states.capacity() * sizeof(void *);
+}
+
+} // namespace bp
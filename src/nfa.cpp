@@ -1,16 +1,33 @@
 #include "fmt/core.h"
 #include "fmt/ranges.h"
 #include "spdlog/spdlog.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <fmt/format.h>
 #include <fstream>
+#include <map>
 #include <libbearpig/nfa.h>
-#include <stack>
+#include <libbearpig/queryplan.h>
+#include <libbearpig/trace.h>
+#include <optional>
+#include <tuple>
 #include <utility>
 #include <vector>
 
 namespace bp {
 
-char ANY_CHAR{0x1};
+namespace {
+std::string dot_byte(uint8_t byte) {
+  if (byte == '\\' || byte == '"') {
+    return fmt::format("\\{}", static_cast<char>(byte));
+  }
+  if (byte > ' ' && byte < 0x7F) {
+    return std::string{static_cast<char>(byte)};
+  }
+  return fmt::format("\\\\x{:02X}", byte);
+}
+} // namespace
 
 void NFA::to_dot(std::filesystem::path dotfile) const {
 
@@ -20,19 +37,25 @@ void NFA::to_dot(std::filesystem::path dotfile) const {
   outstream << "rankdir=LR;";
   outstream << "node[shape=circle];";
 
-  for (auto key_val : states) {
-    for (auto edge_transition_tuple : key_val.second.transitions) {
-      Transition transition = edge_transition_tuple.second;
-      bool accept = currentAccept.id == transition.to;
+  for (size_t from = 0; from < num_states(); from++) {
+    for (const FlatEdge &transition : edges_of(from)) {
+      bool accept = accept_id == transition.to;
       if (accept) {
         outstream << fmt::format("{}[shape=doublecircle]", transition.to);
       }
-      outstream << fmt::format(
-          "{}->{}[label={}];", transition.from, transition.to,
-          transition.edge == 0
-              ? "\"\""
-              : fmt::format("\"{}{}\"", transition.edge == '\\' ? "\\" : "",
-                            std::string{transition.edge}));
+      std::string label = transition.is_epsilon() ? "\"\""
+                          : transition.first == transition.last
+                              ? fmt::format("\"{}\"", dot_byte(transition.first))
+                              : fmt::format("\"[{}-{}]\"",
+                                            dot_byte(transition.first),
+                                            dot_byte(transition.last));
+      if (transition.tag != 0) {
+        // (n and )n for where group n opens and closes
+        size_t tag = transition.tag - 1;
+        label = fmt::format("\"{}{}\"", tag % 2 == 0 ? "(" : ")", tag / 2 + 1);
+      }
+      outstream << fmt::format("{}->{}[label={}];", from, transition.to,
+                               label);
     }
   }
   outstream << "}";
@@ -40,9 +63,17 @@ void NFA::to_dot(std::filesystem::path dotfile) const {
 }
 
 size_t NFA::add_state() {
-  State state{{}, ++next_id, false};
-  states.insert({state.id, state});
-  return state.id;
+  states.push_back(State{{}, ++next_id, false});
+  return next_id;
+}
+
+const Transition *NFA::find_transition(const State &state, char edge) const {
+  for (const Transition &transition : state.transitions) {
+    if (transition.edge == edge) {
+      return &transition;
+    }
+  }
+  return nullptr;
 }
 
 void NFA::fill_with_dummy_data() {
@@ -58,54 +89,601 @@ void NFA::fill_with_dummy_data() {
   state_id = add_state();
   add_transition_to_state(state_id, state_id + 1, 'c');
   add_transition_to_state(state_id, state_id + 1, 't');
+  finalize();
 }
 
-std::set<size_t> NFA::get_all_available_epsilon_transitions(size_t current) {
-  std::set<size_t> epsilon_states;
-  std::stack<size_t> stack;
-  stack.push(current);
+// Shortest and longest ways from the start to the accepting state, counting
+// only the edges that consume a byte, and the bytes on the first and last of
+// those edges. Only edges on some way to the accepting state count.
+PatternProperties NFA::analyze() const {
+  constexpr size_t UNBOUNDED = PatternProperties::UNBOUNDED;
+  PatternProperties properties;
+  size_t size = num_states();
+  auto set_bytes = [](std::bitset<256> &bytes, const FlatEdge &edge) {
+    for (unsigned byte = edge.first; byte <= edge.last; byte++) {
+      bytes.set(byte);
+    }
+  };
+
+  // 0-1 breadth first search, epsilon edges are free
+  std::vector<size_t> shortest(size, UNBOUNDED);
+  std::deque<uint32_t> queue{0};
+  shortest[0] = 0;
+  while (!queue.empty()) {
+    uint32_t state = queue.front();
+    queue.pop_front();
+    for (const FlatEdge &edge : edges_of(state)) {
+      size_t length = shortest[state] + (edge.is_epsilon() ? 0 : 1);
+      if (length < shortest[edge.to]) {
+        shortest[edge.to] = length;
+        if (edge.is_epsilon()) {
+          queue.push_front(edge.to);
+        } else {
+          queue.push_back(edge.to);
+        }
+      }
+    }
+  }
+  properties.min_length = shortest[accept_id];
+
+  // Tarjan's algorithm finishes the strongly connected components sinks
+  // first, so every edge leaving a component leads to one whose longest way
+  // to the accepting state is known by then. A component that can get there
+  // and consumes a byte on an edge within itself repeats without limit.
+  constexpr uint32_t UNSEEN = UINT32_MAX;
+  std::vector<uint32_t> order(size, UNSEEN);
+  std::vector<uint32_t> low(size);
+  std::vector<uint32_t> component(size, UNSEEN);
+  std::vector<std::optional<size_t>> longest;
+  std::vector<uint32_t> open;
+  // the states being visited and the next of their edges to follow
+  std::vector<std::pair<uint32_t, uint32_t>> calls;
+  uint32_t visited = 0;
+  auto enter = [&](uint32_t state) {
+    order[state] = low[state] = visited++;
+    open.push_back(state);
+    calls.emplace_back(state, edge_offsets[state]);
+  };
+  enter(0);
+  while (!calls.empty()) {
+    auto [state, next] = calls.back();
+    if (next < edge_offsets[state + 1]) {
+      calls.back().second++;
+      uint32_t to = edges[next].to;
+      if (order[to] == UNSEEN) {
+        enter(to);
+      } else if (component[to] == UNSEEN) {
+        low[state] = std::min(low[state], order[to]);
+      }
+      continue;
+    }
+    calls.pop_back();
+    if (!calls.empty()) {
+      uint32_t caller = calls.back().first;
+      low[caller] = std::min(low[caller], low[state]);
+    }
+    if (low[state] != order[state]) {
+      continue;
+    }
+    auto id = static_cast<uint32_t>(longest.size());
+    auto members = std::find(open.begin(), open.end(), state);
+    for (auto it = members; it != open.end(); it++) {
+      component[*it] = id;
+    }
+    std::optional<size_t> best;
+    bool repeats = false;
+    for (auto it = members; it != open.end(); it++) {
+      if (*it == accept_id) {
+        best = best.value_or(0);
+      }
+      for (const FlatEdge &edge : edges_of(*it)) {
+        if (component[edge.to] == id) {
+          repeats |= !edge.is_epsilon();
+        } else if (std::optional<size_t> rest = longest[component[edge.to]]) {
+          size_t length =
+              *rest == UNBOUNDED || edge.is_epsilon() ? *rest : *rest + 1;
+          best = std::max(best.value_or(0), length);
+        }
+      }
+    }
+    if (best && repeats) {
+      best = UNBOUNDED;
+    }
+    longest.push_back(best);
+    open.erase(members, open.end());
+  }
+  properties.max_length = longest[component[0]].value_or(0);
+
+  // the states the accepting state is reached from without consuming a byte
+  std::vector<std::vector<uint32_t>> epsilon_from(size);
+  for (uint32_t state = 0; state < size; state++) {
+    for (const FlatEdge &edge : edges_of(state)) {
+      if (edge.is_epsilon()) {
+        epsilon_from[edge.to].push_back(state);
+      }
+    }
+  }
+  std::vector<bool> ends(size, false);
+  std::vector<uint32_t> stack{static_cast<uint32_t>(accept_id)};
+  ends[accept_id] = true;
   while (!stack.empty()) {
-    size_t current = stack.top();
-    stack.pop();
+    uint32_t state = stack.back();
+    stack.pop_back();
+    for (uint32_t from : epsilon_from[state]) {
+      if (!ends[from]) {
+        ends[from] = true;
+        stack.push_back(from);
+      }
+    }
+  }
 
-    if (epsilon_states.find(current) != epsilon_states.end()) {
+  auto useful = [&](uint32_t state) {
+    return component[state] != UNSEEN && longest[component[state]];
+  };
+  for (uint32_t state = 0; state < size; state++) {
+    if (!useful(state)) {
       continue;
     }
-    epsilon_states.insert(current);
-    const auto &current_state = states.at(current);
-    for (const auto &transition : current_state.transitions) {
-      if (transition.first == 0) {
-        stack.push(transition.second.to);
+    for (const FlatEdge &edge : edges_of(state)) {
+      if (edge.is_epsilon() || !useful(edge.to)) {
+        continue;
+      }
+      if (shortest[state] == 0) {
+        set_bytes(properties.first_bytes, edge);
+      }
+      if (ends[edge.to]) {
+        set_bytes(properties.last_bytes, edge);
+      }
+    }
+  }
+  return properties;
+}
+
+// NfaGenVisitor gives every construct states of its own and glues them
+// together with epsilon edges, which leaves many states that only pass control
+// on. Reduction takes them out without changing what the NFA matches or where
+// captures end up. Tagged edges are never removed and every state keeps its
+// edges in their order. The tagged DFA also visits each state once per step
+// and takes a state's byte edges where it first meets it, so with tags only
+// edges from states without byte edges are moved and only states no epsilon
+// edge enters are merged.
+void NFA::reduce() {
+  size_t n = states.size();
+  auto plain_epsilon = [](const Transition &transition) {
+    return transition.edge == 0 && transition.last == 0 && transition.tag == 0;
+  };
+  auto is_epsilon = [](const Transition &transition) {
+    return transition.edge == 0 && transition.last == 0;
+  };
+  bool tagged = std::any_of(states.begin(), states.end(), [](const State &s) {
+    return std::any_of(s.transitions.begin(), s.transitions.end(),
+                       [](const Transition &t) { return t.tag != 0; });
+  });
+
+  // A state whose only edge is a plain epsilon edge can be skipped by
+  // pointing its incoming edges where it leads.
+  std::vector<size_t> forward(n);
+  for (size_t state = 0; state < n; state++) {
+    const auto &out = states[state].transitions;
+    bool passes_on = state != 0 && state != accept_id && out.size() == 1 &&
+                     plain_epsilon(out[0]) && out[0].to != state;
+    forward[state] = passes_on ? out[0].to : state;
+  }
+  auto destination = [&](size_t state) {
+    // bounded, a cycle of such states goes nowhere anyway
+    for (size_t hops = 0; forward[state] != state && hops < n; hops++) {
+      state = forward[state];
+    }
+    return state;
+  };
+  for (State &state : states) {
+    for (Transition &transition : state.transitions) {
+      transition.to = destination(transition.to);
+    }
+  }
+
+  auto reachable_from_start = [&] {
+    std::vector<bool> reached(n, false);
+    std::vector<size_t> stack{0};
+    reached[0] = true;
+    while (!stack.empty()) {
+      size_t state = stack.back();
+      stack.pop_back();
+      for (const Transition &transition : states[state].transitions) {
+        if (!reached[transition.to]) {
+          reached[transition.to] = true;
+          stack.push_back(transition.to);
+        }
+      }
+    }
+    return reached;
+  };
+
+  // A state entered by nothing but one plain epsilon edge is the same as
+  // having its edges in place of that edge.
+  std::vector<bool> reached = reachable_from_start();
+  auto only_epsilon = [&](size_t state) {
+    return std::all_of(states[state].transitions.begin(),
+                       states[state].transitions.end(), is_epsilon);
+  };
+  std::vector<size_t> incoming(n, 0);
+  for (size_t state = 0; state < n; state++) {
+    for (const Transition &transition : states[state].transitions) {
+      incoming[transition.to] += reached[state];
+    }
+  }
+  std::vector<Transition> spliced;
+  for (size_t state = 0; state < n; state++) {
+    if (!reached[state]) {
+      continue;
+    }
+    spliced.clear();
+    auto splice = [&](auto &splice, const Transition &transition) -> void {
+      size_t to = transition.to;
+      if (plain_epsilon(transition) && to == state) {
+        return; // a plain epsilon loop does nothing
+      }
+      if (plain_epsilon(transition) && to != 0 && to != accept_id &&
+          incoming[to] == 1 && (!tagged || only_epsilon(to))) {
+        incoming[to] = 0;
+        for (const Transition &next : std::exchange(states[to].transitions, {})) {
+          splice(splice, next);
+        }
+        return;
+      }
+      spliced.push_back(Transition{state, to, transition.edge, transition.last,
+                                   transition.tag});
+    };
+    for (const Transition &transition :
+         std::exchange(states[state].transitions, {})) {
+      splice(splice, transition);
+    }
+    states[state].transitions = spliced;
+  }
+
+  // Merge states that are bisimilar: same acceptance and the same edges, in
+  // the same order, into states that are themselves merged. Classes start
+  // out as accepting or not and are split until every member of a class has
+  // the same signature. With tags the start and states entered by epsilon
+  // edges keep a class of their own, one of them standing in for another
+  // could be met again in the closure that first met it.
+  //
+  // Only a state whose edge leads into a state that changed class can have a
+  // new signature, so a split only sends the predecessors of the states that
+  // moved back to be signed again, and the largest part keeps the class.
+  // Long chains, like a literal, then take n log n instead of a pass over
+  // every state for each state of the chain.
+  reached = reachable_from_start();
+  std::vector<bool> entered_by_epsilon(n, false);
+  std::vector<std::vector<size_t>> predecessors(n);
+  for (size_t state = 0; state < n; state++) {
+    if (!reached[state]) {
+      continue;
+    }
+    for (const Transition &transition : states[state].transitions) {
+      entered_by_epsilon[transition.to] =
+          entered_by_epsilon[transition.to] || is_epsilon(transition);
+      predecessors[transition.to].push_back(state);
+    }
+  }
+  using Signature = std::vector<std::tuple<char, char, uint16_t, size_t>>;
+  std::vector<size_t> cls(n);
+  std::vector<std::vector<size_t>> members;
+  // a class's signature, for the members that were not sent back
+  std::vector<Signature> signatures;
+  std::vector<std::vector<size_t>> to_sign;
+  std::vector<bool> pending;
+  std::vector<size_t> worklist;
+  std::vector<size_t> position(n);
+  std::map<size_t, size_t> initial;
+  for (size_t state = 0; state < n; state++) {
+    if (!reached[state]) {
+      continue;
+    }
+    bool alone = tagged && (state == 0 || entered_by_epsilon[state]);
+    size_t label = alone ? 2 + state : state == accept_id;
+    auto [it, added] = initial.try_emplace(label, members.size());
+    if (added) {
+      members.emplace_back();
+      signatures.emplace_back();
+      to_sign.emplace_back();
+      pending.push_back(true);
+      worklist.push_back(it->second);
+    }
+    cls[state] = it->second;
+    position[state] = members[cls[state]].size();
+    members[cls[state]].push_back(state);
+    to_sign[cls[state]].push_back(state);
+  }
+  // every state starts out waiting to be signed in its class
+  std::vector<bool> sent_back = reached;
+  auto signature_of = [&](size_t state) {
+    Signature signature;
+    for (const Transition &transition : states[state].transitions) {
+      signature.emplace_back(transition.edge, transition.last, transition.tag,
+                             cls[transition.to]);
+    }
+    return signature;
+  };
+  auto move = [&](size_t state, size_t to) {
+    std::vector<size_t> &from = members[cls[state]];
+    from[position[state]] = from.back();
+    position[from.back()] = position[state];
+    from.pop_back();
+    cls[state] = to;
+    position[state] = members[to].size();
+    members[to].push_back(state);
+  };
+  std::vector<bool> in_part(n, false);
+  while (!worklist.empty()) {
+    size_t c = worklist.back();
+    worklist.pop_back();
+    pending[c] = false;
+    std::map<Signature, std::vector<size_t>> parts;
+    size_t left_alone = members[c].size() - to_sign[c].size();
+    for (size_t state : std::exchange(to_sign[c], {})) {
+      sent_back[state] = false;
+      parts[signature_of(state)].push_back(state);
+    }
+    if (left_alone > 0) {
+      if (auto same = parts.find(signatures[c]); same != parts.end()) {
+        left_alone += same->second.size();
+        parts.erase(same);
+      }
+    }
+    auto largest = std::max_element(
+        parts.begin(), parts.end(), [](const auto &a, const auto &b) {
+          return a.second.size() < b.second.size();
+        });
+    if (largest != parts.end() && largest->second.size() > left_alone) {
+      // the largest part keeps the class, the rest of it moves out instead
+      if (left_alone > 0) {
+        for (const auto &[signature, part] : parts) {
+          for (size_t state : part) {
+            in_part[state] = true;
+          }
+        }
+        std::vector<size_t> rest;
+        for (size_t state : members[c]) {
+          if (!in_part[state]) {
+            rest.push_back(state);
+          }
+        }
+        for (const auto &[signature, part] : parts) {
+          for (size_t state : part) {
+            in_part[state] = false;
+          }
+        }
+        parts.emplace(signatures[c], std::move(rest));
+      }
+      signatures[c] = largest->first;
+      parts.erase(largest);
+    }
+    std::vector<size_t> moved;
+    for (auto &[signature, part] : parts) {
+      size_t split = members.size();
+      members.emplace_back();
+      signatures.push_back(signature);
+      to_sign.emplace_back();
+      pending.push_back(false);
+      for (size_t state : part) {
+        move(state, split);
+        moved.push_back(state);
+      }
+    }
+    for (size_t state : moved) {
+      for (size_t predecessor : predecessors[state]) {
+        if (sent_back[predecessor]) {
+          continue;
+        }
+        sent_back[predecessor] = true;
+        to_sign[cls[predecessor]].push_back(predecessor);
+        if (!pending[cls[predecessor]]) {
+          pending[cls[predecessor]] = true;
+          worklist.push_back(cls[predecessor]);
+        }
+      }
+    }
+  }
+  size_t num_classes = members.size();
+  std::vector<size_t> representative(num_classes, SIZE_MAX);
+  for (size_t state = 0; state < n; state++) {
+    if (reached[state] && representative[cls[state]] == SIZE_MAX) {
+      representative[cls[state]] = state;
+    }
+  }
+  for (size_t state = 0; state < n; state++) {
+    if (!reached[state]) {
+      continue;
+    }
+    if (representative[cls[state]] != state) {
+      states[state].transitions.clear();
+      continue;
+    }
+    auto &out = states[state].transitions;
+    for (Transition &transition : out) {
+      transition.to = representative[cls[transition.to]];
+    }
+    // an edge that repeats an earlier one adds nothing
+    for (size_t i = 0; i < out.size(); i++) {
+      auto same = [&](const Transition &other) {
+        return other.to == out[i].to && other.edge == out[i].edge &&
+               other.last == out[i].last && other.tag == out[i].tag;
+      };
+      if (std::any_of(out.begin(), out.begin() + i, same)) {
+        out.erase(out.begin() + i--);
+      }
+    }
+  }
+  accept_id = representative[cls[accept_id]] != SIZE_MAX
+                  ? representative[cls[accept_id]]
+                  : accept_id;
+
+  // Keep the states on some way from the start to the accepting state and
+  // number them in breadth first order, so that matching touches nearby
+  // states.
+  reached = reachable_from_start();
+  for (std::vector<size_t> &from : predecessors) {
+    from.clear();
+  }
+  for (size_t state = 0; state < n; state++) {
+    for (const Transition &transition : states[state].transitions) {
+      predecessors[transition.to].push_back(state);
+    }
+  }
+  std::vector<bool> alive(n, false);
+  std::vector<size_t> stack{accept_id};
+  alive[accept_id] = true;
+  while (!stack.empty()) {
+    size_t state = stack.back();
+    stack.pop_back();
+    for (size_t predecessor : predecessors[state]) {
+      if (!alive[predecessor]) {
+        alive[predecessor] = true;
+        stack.push_back(predecessor);
+      }
+    }
+  }
+  auto keep = [&](size_t state) {
+    return state == 0 || state == accept_id || (reached[state] && alive[state]);
+  };
+  std::vector<size_t> renumbered(n, SIZE_MAX);
+  std::vector<size_t> order{0};
+  renumbered[0] = 0;
+  for (size_t i = 0; i < order.size(); i++) {
+    for (const Transition &transition : states[order[i]].transitions) {
+      if (keep(transition.to) && renumbered[transition.to] == SIZE_MAX) {
+        renumbered[transition.to] = order.size();
+        order.push_back(transition.to);
+      }
+    }
+  }
+  if (renumbered[accept_id] == SIZE_MAX) {
+    renumbered[accept_id] = order.size();
+    order.push_back(accept_id);
+  }
+
+  std::vector<State> reduced;
+  reduced.reserve(order.size());
+  for (size_t old : order) {
+    State state{{}, reduced.size(), old == accept_id};
+    for (const Transition &transition : states[old].transitions) {
+      if (keep(transition.to)) {
+        state.transitions.push_back(Transition{
+            state.id, renumbered[transition.to], transition.edge,
+            transition.last, transition.tag});
       }
     }
+    reduced.push_back(std::move(state));
   }
-  return epsilon_states;
+  accept_id = renumbered[accept_id];
+  next_id = reduced.size() - 1;
+  states = std::move(reduced);
 }
 
-std::set<char> NFA::get_possible_first_characters() {
-  std::set<char> starts{};
-  auto init = get_all_available_epsilon_transitions(0);
-  for (size_t id : init) {
-    auto state = states.at(id);
-    for (auto transition : state.transitions) {
-      if (transition.first != 0) {
-        starts.insert(transition.first);
+namespace {
+struct NfaTables {
+  std::vector<uint32_t> edge_offsets;
+  std::vector<FlatEdge> edges;
+};
+} // namespace
+
+uint64_t next_program_id() {
+  static std::atomic<uint64_t> next_id{1};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+void NFA::finalize() {
+  program_id = next_program_id();
+  query_plan.reset();
+
+  auto tables = std::make_shared<NfaTables>();
+  tables->edge_offsets.reserve(states.size() + 1);
+  for (const State &state : states) {
+    tables->edge_offsets.push_back(tables->edges.size());
+    for (const Transition &transition : state.transitions) {
+      tables->edges.push_back(
+          FlatEdge{static_cast<uint32_t>(transition.to),
+                   static_cast<uint8_t>(transition.edge),
+                   static_cast<uint8_t>(transition.last), transition.tag});
+    }
+  }
+  tables->edge_offsets.push_back(tables->edges.size());
+  edge_offsets = tables->edge_offsets;
+  edges = tables->edges;
+  storage = std::move(tables);
+
+  // Every edge splits the classes it partly overlaps into the bytes inside
+  // and outside of it, so in the end bytes share a class exactly when every
+  // edge takes either all or none of them.
+  byte_classes.fill(0);
+  num_classes = 1;
+  std::bitset<256 * 256> seen;
+  for (const FlatEdge &edge : edges) {
+    if (edge.is_epsilon() || seen.test(edge.first * 256 + edge.last)) {
+      continue;
+    }
+    seen.set(edge.first * 256 + edge.last);
+    std::array<uint16_t, 256> size{};
+    std::array<uint16_t, 256> inside{};
+    for (size_t byte = 0; byte < 256; byte++) {
+      size[byte_classes[byte]]++;
+      if (edge.first <= byte && byte <= edge.last) {
+        inside[byte_classes[byte]]++;
+      }
+    }
+    std::array<int, 256> moved;
+    moved.fill(-1);
+    for (unsigned byte = edge.first; byte <= edge.last; byte++) {
+      uint8_t cls = byte_classes[byte];
+      if (inside[cls] == size[cls]) {
+        continue;
       }
+      if (moved[cls] < 0) {
+        moved[cls] = num_classes++;
+      }
+      byte_classes[byte] = moved[cls];
     }
   }
-  return starts;
+
+  analysis = analyze();
+  starts_with_any = analysis.first_bytes.all();
+}
+
+void NFA::plan_query() {
+  query_plan = std::make_shared<const QueryPlan>(QueryPlan::analyze(*this));
+}
+
+const QueryPlan *NFA::delegate() const {
+  return query_plan && query_plan->engine() != Engine::NFA ? query_plan.get()
+                                                           : nullptr;
+}
+
+std::vector<RegexMatch> NFA::find_all_matches(std::string_view input) const {
+  return find_all_matches(input, MatchScratch::for_this_thread());
+}
+
+RegexMatch NFA::find_first_match(std::string_view input) const {
+  return find_first_match(input, MatchScratch::for_this_thread());
 }
 
-std::vector<RegexMatch> NFA::find_all_matches(std::string_view input) {
-  std::set<char> starts = get_possible_first_characters();
+RegexMatch NFA::exact_match(std::string_view input) const {
+  return exact_match(input, MatchScratch::for_this_thread());
+}
+
+std::vector<RegexMatch> NFA::find_all_matches(std::string_view input,
+                                              MatchScratch &scratch) const {
+  if (const QueryPlan *plan = delegate()) {
+    return plan->find_all_matches(input);
+  }
   std::vector<RegexMatch> matches{};
+  size_t limit = analysis.start_limit(input.size());
   size_t i = 0;
-  while (i <= input.size()) {
-    for (; i < input.size() &&
-           !(starts.contains(input[i]) || starts.contains(ANY_CHAR));
-         i++)
-      ;
-    auto match = run_nfa(input.substr(i), false, i);
+  while ((i = next_start(input, i, limit)) < limit) {
+    if (i < input.size()) {
+      scratch.match_stats.prefilter_hits++;
+    }
+    auto match = run_nfa(input.substr(i), false, i, scratch);
     if (match.success) {
       matches.emplace_back(match);
       i += std::max(match.length, 1UL);
@@ -116,90 +694,313 @@ std::vector<RegexMatch> NFA::find_all_matches(std::string_view input) {
   return matches;
 }
 
-RegexMatch NFA::find_first_match(std::string_view input) {
-  std::set<char> starts = get_possible_first_characters();
-  RegexMatch match{.success = false};
+RegexMatch NFA::find_first_match(std::string_view input,
+                                 MatchScratch &scratch) const {
+  if (const QueryPlan *plan = delegate()) {
+    return plan->find_first_match(input);
+  }
+  size_t limit = analysis.start_limit(input.size());
   size_t i = 0;
-  while (i <= input.size() && !match.success) {
-    for (; i < input.size() &&
-           !(starts.contains(input[i]) || starts.contains(ANY_CHAR));
-         i++)
-      ;
-    match = run_nfa(input.substr(i), false, i);
+  while ((i = next_start(input, i, limit)) < limit) {
+    if (i < input.size()) {
+      scratch.match_stats.prefilter_hits++;
+    }
+    RegexMatch match = run_nfa(input.substr(i), false, i, scratch);
+    if (match.success) {
+      return match;
+    }
     i++;
   }
-  return match;
+  // where an attempt at the end of input gives up
+  return RegexMatch{.success = false, .start = input.size()};
 }
 
-RegexMatch NFA::exact_match(std::string_view input) {
-  return run_nfa(input, true);
+RegexMatch NFA::exact_match(std::string_view input,
+                            MatchScratch &scratch) const {
+  if (!analysis.allows_length(input.size())) {
+    return RegexMatch{.success = false, .start = 0};
+  }
+  if (const QueryPlan *plan = delegate()) {
+    return plan->exact_match(input);
+  }
+  return run_nfa(input, true, 0, scratch);
 }
 
-RegexMatch NFA::run_nfa(std::string_view input, bool exact, size_t start_id) {
-  RegexMatch result{.success = false, .start = start_id};
-  std::set<size_t> current_states{0};
-  std::set<size_t> next_states;
-  std::set<size_t> epsilon_states;
-  current_states.merge(get_all_available_epsilon_transitions(0));
-  size_t current_input{0};
-  bool should_greed{true};
+bool NFA::is_match(std::string_view input) const {
+  return is_match(input, MatchScratch::for_this_thread());
+}
 
-  while (true) {
-    char current_char = input[current_input];
-
-    spdlog::debug("current_char: {}({})", current_char, (int)current_char);
-    for (auto state : current_states) {
-      spdlog::debug(
-          "curren_states: {} is_accept={} current_input = {} input_size= {}",
-          state, currentAccept.id == state, current_input, input.size());
-      if (currentAccept.id == state &&
-          (current_input == input.size() || !exact)) {
-        result.length = current_input;
-        result.success = true;
-        result.match = std::string{input.substr(0, current_input)};
-        if (!should_greed) {
-          return result;
-        }
+size_t NFA::count_matches(std::string_view input) const {
+  return count_matches(input, MatchScratch::for_this_thread());
+}
+
+bool NFA::is_match(std::string_view input, MatchScratch &scratch) const {
+  // the full DFA would try every start on its own, this is one pass
+  if (const QueryPlan *plan = delegate();
+      plan && plan->engine() != Engine::DFA) {
+    return plan->is_match(input);
+  }
+  scratch.reset(*this);
+  scratch.match_stats.candidate_starts++;
+  uint32_t state = scratch.unanchored_start_state(*this);
+  bool matched = scratch.is_accepting(state);
+  size_t scanned = 0;
+  for (size_t i = 0; i < input.size() && !matched; i++) {
+    if (state == scratch.unanchored_start) {
+      // no match under way, skip to where one can begin
+      for (; i < input.size() && !can_start_with(input[i]); i++)
+        ;
+      if (i == input.size()) {
+        break;
       }
+      scratch.match_stats.prefilter_hits++;
     }
-    should_greed = false;
-    for (auto state : current_states) {
-      auto current_state = states.at(state);
-      spdlog::debug(
-          "{}::iterating: looking for {}. found state {} with transitions:",
-          __func__, current_char, state);
-      for (auto transition : current_state.transitions) {
-        spdlog::debug("from: {} to: {} edge: {}", transition.second.from,
-                      transition.second.to, transition.second.edge);
+    state = scratch.next_state(*this, state, input[i]);
+    matched = scratch.is_accepting(state);
+    scanned++;
+  }
+  scratch.match_stats.bytes_scanned += scanned;
+  return matched;
+}
+
+size_t NFA::count_matches(std::string_view input,
+                          MatchScratch &scratch) const {
+  if (const QueryPlan *plan = delegate()) {
+    return plan->count_matches(input);
+  }
+  size_t count = 0;
+  size_t limit = analysis.start_limit(input.size());
+  size_t i = 0;
+  while ((i = next_start(input, i, limit)) < limit) {
+    if (i < input.size()) {
+      scratch.match_stats.prefilter_hits++;
+    }
+    size_t length = longest_match(input.substr(i), false, i, scratch);
+    if (length != NO_MATCH) {
+      count++;
+      i += std::max(length, 1UL);
+    } else {
+      i++;
+    }
+  }
+  return count;
+}
+
+Capture NFA::next_match(std::string_view input, size_t from) const {
+  return next_match(input, from, MatchScratch::for_this_thread());
+}
+
+Capture NFA::next_match(std::string_view input, size_t from,
+                        MatchScratch &scratch) const {
+  if (const QueryPlan *plan = delegate()) {
+    return plan->next_match(input, from);
+  }
+  size_t limit = analysis.start_limit(input.size());
+  for (size_t i = from; (i = next_start(input, i, limit)) < limit; i++) {
+    if (i < input.size()) {
+      scratch.match_stats.prefilter_hits++;
+    }
+    size_t length = longest_match(input.substr(i), false, i, scratch);
+    if (length != NO_MATCH) {
+      return Capture{i, i + length};
+    }
+  }
+  return Capture{};
+}
+
+bool NFA::match_token(InputBuffer &input) const {
+  return match_token(input, MatchScratch::for_this_thread());
+}
+
+// The same walk as longest_match, except that the end of the data is only
+// checked for when the sentinel byte comes up.
+bool NFA::match_token(InputBuffer &input, MatchScratch &scratch) const {
+  scratch.reset(*this);
+  scratch.match_stats.candidate_starts++;
+  input.token_begin = input.mark;
+  input.token_length = 0;
+  input.cursor = input.mark;
+  uint32_t state = scratch.start_state(*this);
+  size_t length = 0;
+  while (true) {
+    char byte = input.window[input.cursor];
+    if (byte == InputBuffer::SENTINEL && input.cursor == input.limit) {
+      // refilling moves the bytes from mark on to the front
+      if (!input.refill()) {
+        break;
       }
-      if (current_input >= input.size()) {
-        continue;
-      } else if (current_state.transitions.contains(current_char)) {
-        spdlog::debug("state {} has a transition matching the character {}!",
-                      state, current_char);
-        next_states.insert(
-            current_state.transitions.find(current_char)->second.to);
-      } else if (current_state.transitions.contains(ANY_CHAR)) {
-        spdlog::debug("state {} has a transition matching any character!",
-                      state);
-        next_states.insert(current_state.transitions.find(ANY_CHAR)->second.to);
+      continue;
+    }
+    state = scratch.next_state(*this, state, byte);
+    if (state == MatchScratch::DEAD) {
+      break;
+    }
+    input.cursor++;
+    if (scratch.is_accepting(state)) {
+      length = input.cursor - input.mark;
+    }
+  }
+  scratch.match_stats.bytes_scanned += input.cursor - input.mark;
+  if (length == 0) {
+    return false;
+  }
+  input.token_begin = input.mark;
+  input.token_length = length;
+  input.mark += length;
+  return true;
+}
+
+RegexMatch NFA::run_nfa(std::string_view input, bool exact, size_t start_id,
+                        MatchScratch &scratch) const {
+  RegexMatch result{.success = false, .start = start_id};
+  size_t length = longest_match(input, exact, start_id, scratch);
+  if (length != NO_MATCH) {
+    result.success = true;
+    result.length = length;
+    result.match = std::string{input.substr(0, length)};
+  }
+  return result;
+}
+
+// Finds the length of the longest match at the start of input by walking the
+// lazy DFA in scratch. exact only accepts a match that covers all of input.
+size_t NFA::longest_match(std::string_view input, bool exact, size_t start_id,
+                          MatchScratch &scratch, size_t *scanned) const {
+  if (exact && !analysis.allows_length(input.size())) {
+    if (scanned != nullptr) {
+      *scanned = 0;
+    }
+    return NO_MATCH;
+  }
+  scratch.reset(*this);
+  scratch.match_stats.candidate_starts++;
+  uint32_t state = scratch.start_state(*this);
+  bool matched = scratch.is_accepting(state) && (!exact || input.empty());
+  size_t length = 0;
+
+  size_t current_input = 0;
+  for (; current_input < input.size(); current_input++) {
+    state = scratch.next_state(*this, state, input[current_input]);
+    if (state == MatchScratch::DEAD) {
+      break;
+    }
+    if (scratch.is_accepting(state) &&
+        (!exact || current_input + 1 == input.size())) {
+      matched = true;
+      length = current_input + 1;
+    }
+  }
+  // the byte leading into the dead state was looked at too
+  size_t looked_at = std::min(current_input + 1, input.size());
+  scratch.match_stats.bytes_scanned += looked_at;
+  if (scanned != nullptr) {
+    *scanned = looked_at;
+  }
+
+  BP_TRACE(MATCH_ATTEMPT, start_id, matched ? length : UINT64_MAX);
+  return matched ? length : NO_MATCH;
+}
+
+bool NFA::exact_match(std::string_view input,
+                      std::span<Capture> captures) const {
+  return exact_match(input, captures, MatchScratch::for_this_thread());
+}
+
+bool NFA::find_first_match(std::string_view input,
+                           std::span<Capture> captures) const {
+  return find_first_match(input, captures, MatchScratch::for_this_thread());
+}
+
+bool NFA::exact_match(std::string_view input, std::span<Capture> captures,
+                      MatchScratch &scratch) const {
+  size_t length = longest_match(input, true, 0, scratch);
+  return fill_captures(input, 0, length, captures, scratch);
+}
+
+bool NFA::find_first_match(std::string_view input, std::span<Capture> captures,
+                           MatchScratch &scratch) const {
+  size_t length = NO_MATCH;
+  size_t limit = analysis.start_limit(input.size());
+  size_t i = 0;
+  while (length == NO_MATCH && (i = next_start(input, i, limit)) < limit) {
+    if (i < input.size()) {
+      scratch.match_stats.prefilter_hits++;
+    }
+    length = longest_match(input.substr(i), false, i, scratch);
+    i++;
+  }
+  return fill_captures(input, i - 1, length, captures, scratch);
+}
+
+// The plain DFA already found where the match is, so only the matched bytes
+// are run through the tagged DFA to place the groups.
+bool NFA::fill_captures(std::string_view input, size_t start, size_t length,
+                        std::span<Capture> captures,
+                        MatchScratch &scratch) const {
+  std::fill(captures.begin(), captures.end(), Capture{});
+  if (length == NO_MATCH) {
+    return false;
+  }
+  if (!captures.empty()) {
+    captures[0] = Capture{start, start + length};
+  }
+  if (captures.size() > 1 && num_groups > 0) {
+    run_tagged(input.substr(start, length), true, scratch);
+    for (size_t group = 1; group <= num_groups && group < captures.size();
+         group++) {
+      size_t open = scratch.matched_tags[2 * group - 2];
+      size_t close = scratch.matched_tags[2 * group - 1];
+      if (open != Capture::npos && close != Capture::npos) {
+        captures[group] = Capture{start + open, start + close};
       }
-      should_greed = true;
     }
-    for (auto state : next_states) {
-      epsilon_states.merge(get_all_available_epsilon_transitions(state));
+  }
+  return true;
+}
+
+// Walks the tagged DFA over input and leaves the tags of the longest match in
+// scratch.matched_tags. Returns the length of that match or NO_MATCH.
+size_t NFA::run_tagged(std::string_view input, bool exact,
+                       MatchScratch &scratch) const {
+  scratch.reset(*this);
+  size_t tags = num_tags();
+  uint32_t state = scratch.tagged_start_state(*this);
+  for (size_t i = 0; i < scratch.start_commands.size(); i++) {
+    scratch.registers[i] = scratch.start_commands[i] == MatchScratch::SET_TAG
+                               ? 0
+                               : Capture::npos;
+  }
+  scratch.matched_tags.assign(tags, Capture::npos);
+
+  size_t length = NO_MATCH;
+  auto accept = [&](size_t position) {
+    uint32_t config = scratch.tagged_accept[state];
+    if (config != MatchScratch::NO_ACCEPT &&
+        (!exact || position == input.size())) {
+      length = position;
+      std::copy_n(scratch.registers.begin() + config * tags, tags,
+                  scratch.matched_tags.begin());
     }
-    next_states.merge(epsilon_states);
-    current_input++;
+  };
+  accept(0);
 
-    if (next_states.size() == 0) {
-      return result;
+  for (size_t i = 0; i < input.size(); i++) {
+    state = scratch.tagged_next_state(*this, state, input[i]);
+    if (state == MatchScratch::DEAD) {
+      break;
+    }
+    const uint32_t *commands = scratch.tagged_step_commands;
+    for (size_t r = 0; r < scratch.tagged_step_size; r++) {
+      uint32_t command = commands[r];
+      scratch.next_registers[r] = command == MatchScratch::SET_TAG ? i + 1
+                                  : command == MatchScratch::CLEAR_TAG
+                                      ? Capture::npos
+                                      : scratch.registers[command];
     }
-    std::swap(current_states, next_states);
-    epsilon_states.clear();
-    next_states.clear();
+    scratch.registers.swap(scratch.next_registers);
+    accept(i + 1);
   }
-  return result;
+  return length;
 }
 
 } // namespace bp
@@ -209,7 +1010,7 @@ template <> struct fmt::formatter<bp::Transition> {
   template <typename FormatContext>
   auto format(const bp::Transition &trans, FormatContext &ctx) const {
     return fmt::format_to(ctx.out(), "(from {} to {} {})", trans.from, trans.to,
-                          trans.edge == 0 ? ""
+                          trans.edge == 0 && trans.last == 0 ? ""
                                           : fmt::format("over {}", trans.edge));
   }
 };
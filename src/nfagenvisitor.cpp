@@ -1,4 +1,5 @@
 #include "libbearpig/regextokens.h"
+#include "libbearpig/trace.h"
 #include "spdlog/spdlog.h"
 #include <algorithm>
 #include <libbearpig/nfa.h>
@@ -7,13 +8,14 @@
 
 namespace {
 void print_diag_message(const std::string &msg,
-                        std::vector<bp::RegexToken> tokenstream, size_t start,
-                        size_t stop, spdlog::level::level_enum level) {
+                        std::span<const bp::RegexToken> tokenstream,
+                        size_t start, size_t stop,
+                        spdlog::level::level_enum level) {
   std::stringstream ss;
   // 31 = red for error, 33 = yellow for warning
   std::string color = level == spdlog::level::err ? "31" : "33";
-  std::for_each(tokenstream.cbegin(), tokenstream.cend(),
-                [&ss](bp::RegexToken t) { ss << t.data; });
+  std::for_each(tokenstream.begin(), tokenstream.end(),
+                [&ss](bp::RegexToken t) { ss << t.text(); });
   spdlog::log(level, msg);
   spdlog::log(level, ss.str());
   std::string padding = fmt::format("{: >{}}", " ", start);
@@ -27,11 +29,10 @@ namespace bp {
 void NfaGenVisitor::invalid_range_error(RChar startchar, RChar stopchar) {
 
   print_diag_message(fmt::format("[{}-{}] is an invalid range",
-                                 startchar.character.data,
-                                 stopchar.character.data),
+                                 startchar.to_string(), stopchar.to_string()),
                      tokenstream, startchar.character.column,
                      stopchar.character.column, spdlog::level::err);
-  exit(1);
+  failed = true;
 }
 
 void NfaGenVisitor::confusing_range_warning(RChar startchar, RChar stopchar) {
@@ -40,21 +41,21 @@ void NfaGenVisitor::confusing_range_warning(RChar startchar, RChar stopchar) {
   print_diag_message(
       fmt::format("[{}-{}] might not do what you expected. Consider not mixing "
                   "upper case and lower case symbols in the same range",
-                  startchar.character.data, stopchar.character.data),
+                  startchar.to_string(), stopchar.to_string()),
       tokenstream, columnstart, columnstop, spdlog::level::warn);
 }
 
 void NfaGenVisitor::operator()(this NfaGenVisitor &self, AlternativeExp &exp) {
 
-  spdlog::debug("{}! parent: {}", __PRETTY_FUNCTION__, self.id);
+  BP_TRACE(GEN_ALTERNATIVE, self.id, exp.alternatives.size());
+  self.depth++;
   size_t parent_id = self.id;
   size_t end = self.nfa.add_state();
-  if (self.nfa.currentAccept.id == parent_id) {
-    spdlog::debug("accepting state was: {}, current:{}",
-                  self.nfa.currentAccept.id, end);
-    self.nfa.currentAccept.is_accept = false;
-    self.nfa.currentAccept = self.nfa.states.at(end);
-    self.nfa.states.at(end).is_accept = true;
+  if (self.nfa.accept_id == parent_id) {
+    BP_TRACE(GEN_ACCEPT, self.nfa.accept_id, end);
+    self.nfa.states[self.nfa.accept_id].is_accept = false;
+    self.nfa.accept_id = end;
+    self.nfa.states[end].is_accept = true;
   }
   for (size_t i = 0; i < exp.alternatives.size(); i++) {
     size_t new_state = self.nfa.add_state();
@@ -64,10 +65,15 @@ void NfaGenVisitor::operator()(this NfaGenVisitor &self, AlternativeExp &exp) {
     self.nfa.add_transition_to_state(self.id, end, 0);
   }
   self.id = end;
+  // the outermost alternative is the whole pattern
+  if (--self.depth == 0) {
+    self.nfa.reduce();
+    self.nfa.finalize();
+  }
 }
 
 void NfaGenVisitor::operator()(this NfaGenVisitor &self, ConcatExp &exp) {
-  spdlog::debug("{}! parent: {}", __PRETTY_FUNCTION__, self.id);
+  BP_TRACE(GEN_CONCAT, self.id, exp.exps.size());
 
   for (size_t i = 0; i < exp.exps.size(); i++) {
     self(exp.exps[i]);
@@ -75,7 +81,7 @@ void NfaGenVisitor::operator()(this NfaGenVisitor &self, ConcatExp &exp) {
 }
 
 void NfaGenVisitor::operator()(this NfaGenVisitor &self, QuantifiedExp &exp) {
-  spdlog::debug("{}! parent: {}", __PRETTY_FUNCTION__, self.id);
+  BP_TRACE(GEN_QUANTIFIED, self.id, exp.quantifier);
   size_t start = self.id;
   size_t end = self.nfa.add_state();
 
@@ -109,78 +115,121 @@ void NfaGenVisitor::operator()(this NfaGenVisitor &self, QuantifiedExp &exp) {
 }
 
 void NfaGenVisitor::operator()(this NfaGenVisitor &self, GroupExp &exp) {
-  spdlog::debug("{}! parent: {}", __PRETTY_FUNCTION__, self.id);
+  // tags are 16 bits wide, groups beyond that only group
+  if (self.nfa.num_groups == NFA::MAX_GROUPS) {
+    BP_TRACE(GEN_GROUP, self.id, 0);
+    self(*exp.subExp);
+    return;
+  }
+  // groups are numbered by their opening parenthesis, outer ones first
+  size_t group = ++self.nfa.num_groups;
+  BP_TRACE(GEN_GROUP, self.id, group);
+  size_t open = self.nfa.add_state();
+  self.nfa.add_tagged_transition(self.id, open, 2 * group - 2);
+  self.id = open;
   self(*exp.subExp);
+  size_t close = self.nfa.add_state();
+  self.nfa.add_tagged_transition(self.id, close, 2 * group - 1);
+  self.id = close;
 }
 
+// A set is the code points its items take, or all the others if it is
+// negative. They are lowered to UTF-8 byte ranges in one go, so overlapping
+// items only cost edges once.
 void NfaGenVisitor::operator()(this NfaGenVisitor &self, SetExp &exp) {
-  spdlog::debug("{}! parent: {}", __PRETTY_FUNCTION__, self.id);
-  size_t start = self.nfa.add_state();
-  self.nfa.add_transition_to_state(self.id, start, 0);
-  size_t end = self.nfa.add_state();
-  self.id = start;
-  for (auto item : exp.items) {
-    size_t new_state = self.nfa.add_state();
-    self.nfa.add_transition_to_state(start, new_state, 0);
-    self.id = new_state;
+  BP_TRACE(GEN_SET, self.id, exp.items.size());
+  self.set_ranges.clear();
+  self.set_bytes.clear();
+  for (auto &item : exp.items) {
     self(item);
-    self.nfa.add_transition_to_state(self.id, end, 0);
   }
-  self.id = end;
+  if (has_flag(self.flags, RegexFlags::CASE_INSENSITIVE)) {
+    // before complementing, so [^a] leaves out A as well
+    add_case_variants(self.set_ranges);
+  }
+  if (exp.negative && has_flag(self.flags, RegexFlags::LINE_ORIENTED)) {
+    self.set_ranges.push_back({'\n', '\n'});
+  }
+  normalize_ranges(self.set_ranges, exp.negative);
+  if (exp.negative) {
+    // bytes that are not UTF-8 are no code point, so nothing to leave out
+    self.set_bytes.clear();
+  }
+  self.add_codepoints(self.set_ranges, self.set_bytes);
 }
 
 void NfaGenVisitor::operator()(this NfaGenVisitor &self, SetItem &exp) {
-  spdlog::debug("{}! parent: {}", __PRETTY_FUNCTION__, self.id);
-  size_t subexpstart = self.nfa.add_state();
-  size_t end = self.nfa.add_state();
-  size_t parent_id = self.id;
-  self.id = subexpstart;
-  self.nfa.add_transition_to_state(parent_id, subexpstart, 0);
-  if (exp.range) {
-    char startchar = exp.start.character.data;
-    char stopchar = exp.stop.character.data;
-    if (startchar > stopchar) {
-      self.invalid_range_error(exp.start, exp.stop);
-    } else if (stopchar >= 91 && startchar <= 96) {
-      self.confusing_range_warning(exp.start, exp.stop);
-    }
-    char diff = stopchar - startchar;
-    for (char i = 0; i <= diff; i++) {
-      size_t new_state = self.nfa.add_state();
-      self.nfa.add_transition_to_state(subexpstart, new_state, 0);
-      self.id = new_state;
-      RChar synth;
-      synth.character = RegexToken{RegexTokenType::CHARACTER, exp.start.idx,
-                                   static_cast<char>(startchar + i)};
-      synth.idx = exp.start.idx;
-      self(synth);
-      self.nfa.add_transition_to_state(self.id, end, 0);
-    }
-  } else {
-    self(exp.start);
-    self.nfa.add_transition_to_state(self.id, end, 0);
+  BP_TRACE(GEN_SET_ITEM, self.id, exp.range);
+  const RegexToken &start = exp.start.character;
+  if (!exp.range && start.is_raw_byte()) {
+    self.set_bytes.push_back(static_cast<uint8_t>(start.data));
+    return;
   }
-  self.id = end;
+  char32_t stop = exp.range ? exp.stop.character.codepoint : start.codepoint;
+  if (start.codepoint > stop) {
+    self.invalid_range_error(exp.start, exp.stop);
+    return;
+  }
+  if (exp.range && stop >= 91 && start.codepoint <= 96) {
+    self.confusing_range_warning(exp.start, exp.stop);
+  }
+  self.set_ranges.push_back({start.codepoint, stop});
 }
 
 void NfaGenVisitor::operator()(this NfaGenVisitor &self, RChar &exp) {
-  spdlog::debug("{}! parent: {}", __PRETTY_FUNCTION__, self.id);
-  size_t subexpstart = self.nfa.add_state();
-  size_t parent_id = self.id;
-  self.nfa.add_transition_to_state(parent_id, subexpstart, exp.character.data);
+  BP_TRACE(GEN_CHAR, self.id, exp.character.codepoint);
   self.last_char = exp.character.data;
-  self.id = subexpstart;
+  if (exp.character.is_raw_byte()) {
+    uint8_t byte = exp.character.data;
+    self.add_codepoints({}, std::span{&byte, 1});
+    return;
+  }
+  CodepointRange single{exp.character.codepoint, exp.character.codepoint};
+  if (!has_flag(self.flags, RegexFlags::CASE_INSENSITIVE)) {
+    self.add_codepoints(std::span{&single, 1});
+    return;
+  }
+  self.set_ranges.assign(1, single);
+  add_case_variants(self.set_ranges);
+  normalize_ranges(self.set_ranges, false);
+  self.add_codepoints(self.set_ranges);
 }
 
 void NfaGenVisitor::operator()(this NfaGenVisitor &self, AnyExp &exp) {
-  spdlog::debug("{}! parent: {}", __PRETTY_FUNCTION__, self.id);
-  // not quite sure how to implement this yet
-  // it seems dependant on how i implement the traversal and how i consume
-  // characters
-  size_t subexpstart = self.nfa.add_state();
-  size_t parent_id = self.id;
-  self.nfa.add_transition_to_state(parent_id, subexpstart, 1);
-  self.id = subexpstart;
+  BP_TRACE(GEN_ANY, self.id, 0);
+  // one code point, whatever it is
+  static constexpr CodepointRange everything{0, MAX_CODEPOINT};
+  // or anything but a newline
+  static constexpr std::array<CodepointRange, 2> within_line{
+      {{0, '\n' - 1}, {'\n' + 1, MAX_CODEPOINT}}};
+  if (has_flag(self.flags, RegexFlags::LINE_ORIENTED)) {
+    self.add_codepoints(within_line);
+  } else {
+    self.add_codepoints(std::span{&everything, 1});
+  }
+}
+
+void NfaGenVisitor::add_codepoints(std::span<const CodepointRange> ranges,
+                                   std::span<const uint8_t> raw_bytes) {
+  sequences.clear();
+  for (CodepointRange range : ranges) {
+    utf8_sequences(range, sequences);
+  }
+  size_t start = id;
+  size_t end = nfa.add_state();
+  for (const Utf8Sequence &sequence : sequences) {
+    size_t from = start;
+    for (size_t i = 0; i < sequence.length; i++) {
+      size_t to = i + 1 == sequence.length ? end : nfa.add_state();
+      nfa.add_range_transition(from, to, sequence.ranges[i].first,
+                               sequence.ranges[i].last);
+      from = to;
+    }
+  }
+  for (uint8_t byte : raw_bytes) {
+    nfa.add_range_transition(start, end, byte, byte);
+  }
+  id = end;
 }
 
 } // namespace bp
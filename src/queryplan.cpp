@@ -0,0 +1,443 @@
+#include <algorithm>
+#include <cstring>
+#include <fmt/format.h>
+#include <libbearpig/queryplan.h>
+
+namespace bp {
+
+std::string_view to_string(Engine engine) {
+  switch (engine) {
+  case Engine::MEMCHR:
+    return "memchr";
+  case Engine::MEMMEM:
+    return "memmem";
+  case Engine::CASELESS_LITERAL:
+    return "caseless literal";
+  case Engine::LITERAL_SET:
+    return "literal set";
+  case Engine::BIT_PARALLEL:
+    return "bit-parallel";
+  case Engine::DFA:
+    return "dfa";
+  case Engine::NFA:
+    return "nfa";
+  }
+  return "Should never happen";
+}
+
+namespace {
+
+constexpr size_t MAX_LITERAL_LENGTH = 256;
+// edges followed while listing the language before giving up on it
+constexpr size_t MAX_LITERAL_WORK = 1 << 16;
+
+struct LiteralSearch {
+  const StateTable &table;
+  std::span<const uint8_t> accepting;
+  const std::array<uint8_t, 256> &byte_classes;
+  size_t num_classes;
+  std::vector<std::string> found;
+  std::string path;
+  size_t work{0};
+
+  // false once the language turned out too large to list
+  bool visit(uint32_t state) {
+    if (path.size() == MAX_LITERAL_LENGTH) {
+      return false;
+    }
+    for (int byte = 0; byte < 256; byte++) {
+      uint32_t next = table[state * num_classes + byte_classes[byte]];
+      if (next == DFA::DEAD) {
+        continue;
+      }
+      if (++work > MAX_LITERAL_WORK) {
+        return false;
+      }
+      path.push_back(static_cast<char>(byte));
+      if (accepting[next]) {
+        if (found.size() == QueryPlan::MAX_LITERALS) {
+          return false;
+        }
+        found.push_back(path);
+      }
+      if (!visit(next)) {
+        return false;
+      }
+      path.pop_back();
+    }
+    return true;
+  }
+};
+
+unsigned char to_lower(unsigned char byte) {
+  return byte >= 'A' && byte <= 'Z' ? byte | 0x20 : byte;
+}
+
+unsigned char to_upper(unsigned char byte) {
+  return byte >= 'a' && byte <= 'z' ? byte & ~0x20 : byte;
+}
+
+// The byte set sequence as a literal with its letters in lower case, if every
+// position is either both cases of a letter or a single byte that has no
+// other case. Empty otherwise, and for plain literals, which memmem finds.
+std::string caseless_literal(const std::array<uint64_t, 256> &masks,
+                             size_t positions) {
+  std::string literal;
+  bool folds = false;
+  for (size_t position = 0; position < positions; position++) {
+    std::vector<unsigned char> bytes;
+    for (int byte = 0; byte < 256; byte++) {
+      if ((masks[byte] >> position) & 1) {
+        bytes.push_back(byte);
+      }
+    }
+    unsigned char lower = to_lower(bytes.front());
+    unsigned char upper = to_upper(bytes.front());
+    if (lower == upper && bytes.size() == 1) {
+      literal.push_back(static_cast<char>(lower));
+    } else if (lower != upper && bytes.size() == 2 && bytes[0] == upper &&
+               bytes[1] == lower) {
+      literal.push_back(static_cast<char>(lower));
+      folds = true;
+    } else {
+      return {};
+    }
+  }
+  return folds ? literal : std::string{};
+}
+
+} // namespace
+
+// Determinizes the pattern and reads its shape off the DFA: a small finite
+// language is listed outright, and a pattern whose every state after k bytes
+// accepts the same bytes is a sequence of byte sets.
+QueryPlan QueryPlan::analyze(const NFA &nfa) {
+  QueryPlan plan;
+  plan.nullable = nfa.properties().nullable();
+  plan.min_length = nfa.properties().min_length;
+  plan.max_length = nfa.properties().max_length;
+  std::optional<DFA> determinized = DFA::from_nfa(nfa, MAX_DFA_STATES);
+  if (!determinized) {
+    return plan;
+  }
+  const DFA &full = *determinized;
+  plan.num_dfa_states = full.num_states();
+  std::span<const uint8_t> accepting = full.accepting;
+
+  if (!plan.nullable) {
+    LiteralSearch search{full.table, accepting, full.byte_classes,
+                         full.num_classes};
+    if (search.visit(full.start)) {
+      plan.literal_set = std::move(search.found);
+    }
+
+    std::vector<uint32_t> level{full.start};
+    std::vector<uint32_t> next_level;
+    for (size_t position = 0; position <= MAX_POSITIONS; position++) {
+      std::bitset<256> live;
+      bool accepts = accepting[level.front()];
+      for (int byte = 0; byte < 256; byte++) {
+        live.set(byte, full.next_state(level.front(), byte) != DFA::DEAD);
+      }
+      bool same = std::ranges::all_of(level, [&](uint32_t state) {
+        if (accepting[state] != accepts) {
+          return false;
+        }
+        for (int byte = 0; byte < 256; byte++) {
+          if ((full.next_state(state, byte) != DFA::DEAD) != live.test(byte)) {
+            return false;
+          }
+        }
+        return true;
+      });
+      if (!same || (accepts && live.any())) {
+        break;
+      }
+      if (accepts) {
+        plan.num_positions = position;
+        break;
+      }
+      if (position == MAX_POSITIONS) {
+        break;
+      }
+      next_level.clear();
+      for (int byte = 0; byte < 256; byte++) {
+        if (!live.test(byte)) {
+          continue;
+        }
+        plan.masks[byte] |= uint64_t{1} << position;
+        for (uint32_t state : level) {
+          next_level.push_back(full.next_state(state, byte));
+        }
+      }
+      std::ranges::sort(next_level);
+      next_level.erase(std::unique(next_level.begin(), next_level.end()),
+                       next_level.end());
+      level.swap(next_level);
+    }
+  }
+
+  if (plan.literal_set.size() == 1) {
+    plan.chosen = plan.literal_set.front().size() == 1 ? Engine::MEMCHR
+                                                       : Engine::MEMMEM;
+  } else if (plan.folded = caseless_literal(plan.masks, plan.num_positions);
+             !plan.folded.empty()) {
+    plan.chosen = Engine::CASELESS_LITERAL;
+  } else if (!plan.literal_set.empty()) {
+    plan.chosen = Engine::LITERAL_SET;
+    std::ranges::stable_sort(plan.literal_set, std::greater{},
+                             &std::string::size);
+    for (size_t i = 0; i < plan.literal_set.size(); i++) {
+      auto first = static_cast<unsigned char>(plan.literal_set[i].front());
+      plan.by_first_byte[first].push_back(i);
+      plan.first_bytes.set(first);
+    }
+  } else if (plan.num_positions != 0) {
+    plan.chosen = Engine::BIT_PARALLEL;
+  } else if (full.table.data().size() <= MAX_DFA_BYTES) {
+    plan.chosen = Engine::DFA;
+    plan.dfa = std::move(determinized);
+  }
+  return plan;
+}
+
+std::string QueryPlan::describe() const {
+  std::string description = fmt::format("engine: {}\n", to_string(chosen));
+  if (num_dfa_states == 0) {
+    description += fmt::format("dfa states: more than {}\n", MAX_DFA_STATES);
+  } else {
+    description += fmt::format("dfa states: {}\n", num_dfa_states);
+  }
+  description += fmt::format("matches empty: {}\n", nullable);
+  if (max_length == PatternProperties::UNBOUNDED) {
+    description += fmt::format("match length: at least {}\n", min_length);
+  } else {
+    description +=
+        fmt::format("match length: {} to {}\n", min_length, max_length);
+  }
+  if (!literal_set.empty()) {
+    description += fmt::format("literals: {}\n", literal_set.size());
+    for (const std::string &literal : literal_set) {
+      description += fmt::format("  \"{}\"\n", literal);
+    }
+  }
+  if (!folded.empty()) {
+    description += fmt::format("caseless literal: \"{}\"\n", folded);
+  }
+  if (num_positions != 0) {
+    description += fmt::format("positions: {}\n", num_positions);
+  }
+  return description;
+}
+
+size_t QueryPlan::longest_literal_at(std::string_view input, size_t at) const {
+  auto first = static_cast<unsigned char>(input[at]);
+  for (uint16_t index : by_first_byte[first]) {
+    const std::string &literal = literal_set[index];
+    if (input.substr(at).starts_with(literal)) {
+      return literal.size();
+    }
+  }
+  return 0;
+}
+
+std::optional<QueryPlan::Span>
+QueryPlan::shift_and(std::string_view input, size_t from) const {
+  const uint64_t last = uint64_t{1} << (num_positions - 1);
+  uint64_t positions = 0;
+  for (size_t i = from; i < input.size(); i++) {
+    positions =
+        ((positions << 1) | 1) & masks[static_cast<unsigned char>(input[i])];
+    // every match has the same length, so the first to end is the leftmost
+    if (positions & last) {
+      return Span{i + 1 - num_positions, num_positions};
+    }
+  }
+  return std::nullopt;
+}
+
+bool QueryPlan::equals_caseless(std::string_view candidate) const {
+  return std::ranges::equal(candidate, folded, {}, [](char byte) {
+    return static_cast<char>(to_lower(static_cast<unsigned char>(byte)));
+  });
+}
+
+// Walks the occurrences of both cases of the first byte in order, each found
+// with memchr, and checks the rest of the literal at the earlier one.
+std::optional<QueryPlan::Span>
+QueryPlan::find_caseless(std::string_view input, size_t from) const {
+  const char *data = input.data();
+  auto next = [&](unsigned char byte, size_t at) {
+    if (at >= input.size()) {
+      return std::string_view::npos;
+    }
+    const void *found = std::memchr(data + at, byte, input.size() - at);
+    return found == nullptr
+               ? std::string_view::npos
+               : static_cast<size_t>(static_cast<const char *>(found) - data);
+  };
+  auto lower = static_cast<unsigned char>(folded.front());
+  unsigned char upper = to_upper(lower);
+  size_t lower_at = next(lower, from);
+  size_t upper_at = lower == upper ? std::string_view::npos : next(upper, from);
+  while (true) {
+    size_t at = std::min(lower_at, upper_at);
+    if (at == std::string_view::npos || input.size() - at < folded.size()) {
+      return std::nullopt;
+    }
+    if (equals_caseless(input.substr(at, folded.size()))) {
+      return Span{at, folded.size()};
+    }
+    if (at == lower_at) {
+      lower_at = next(lower, at + 1);
+    } else {
+      upper_at = next(upper, at + 1);
+    }
+  }
+}
+
+std::optional<QueryPlan::Span> QueryPlan::find(std::string_view input,
+                                               size_t from) const {
+  if (from >= input.size()) {
+    return std::nullopt;
+  }
+  const char *data = input.data();
+  switch (chosen) {
+  case Engine::MEMCHR: {
+    const void *found =
+        std::memchr(data + from, literal_set.front()[0], input.size() - from);
+    if (found == nullptr) {
+      return std::nullopt;
+    }
+    return Span{static_cast<size_t>(static_cast<const char *>(found) - data),
+                1};
+  }
+  case Engine::MEMMEM: {
+    const std::string &needle = literal_set.front();
+    const void *found = memmem(data + from, input.size() - from, needle.data(),
+                               needle.size());
+    if (found == nullptr) {
+      return std::nullopt;
+    }
+    return Span{static_cast<size_t>(static_cast<const char *>(found) - data),
+                needle.size()};
+  }
+  case Engine::CASELESS_LITERAL:
+    return find_caseless(input, from);
+  case Engine::LITERAL_SET: {
+    for (size_t i = from; i < input.size(); i++) {
+      if (!first_bytes.test(static_cast<unsigned char>(input[i]))) {
+        continue;
+      }
+      if (size_t length = longest_literal_at(input, i); length != 0) {
+        return Span{i, length};
+      }
+    }
+    return std::nullopt;
+  }
+  case Engine::BIT_PARALLEL:
+    return shift_and(input, from);
+  case Engine::DFA:
+  case Engine::NFA:
+    break;
+  }
+  return std::nullopt;
+}
+
+RegexMatch QueryPlan::exact_match(std::string_view input) const {
+  if (chosen == Engine::DFA) {
+    return dfa->exact_match(input);
+  }
+  RegexMatch result{.success = false, .start = 0};
+  bool matched = false;
+  switch (chosen) {
+  case Engine::MEMCHR:
+  case Engine::MEMMEM:
+    matched = input == literal_set.front();
+    break;
+  case Engine::CASELESS_LITERAL:
+    matched = equals_caseless(input);
+    break;
+  case Engine::LITERAL_SET:
+    matched = !input.empty() && longest_literal_at(input, 0) == input.size();
+    break;
+  case Engine::BIT_PARALLEL:
+    matched = input.size() == num_positions &&
+              shift_and(input, 0).has_value();
+    break;
+  case Engine::DFA:
+  case Engine::NFA:
+    break;
+  }
+  if (matched) {
+    result.success = true;
+    result.length = input.size();
+    result.match = std::string{input};
+  }
+  return result;
+}
+
+RegexMatch QueryPlan::find_first_match(std::string_view input) const {
+  if (chosen == Engine::DFA) {
+    return dfa->find_first_match(input);
+  }
+  // where the NFA reports giving up
+  RegexMatch result{.success = false, .start = input.size()};
+  if (auto span = find(input, 0)) {
+    result.success = true;
+    result.start = span->start;
+    result.length = span->length;
+    result.match = std::string{input.substr(span->start, span->length)};
+  }
+  return result;
+}
+
+bool QueryPlan::is_match(std::string_view input) const {
+  if (chosen == Engine::DFA) {
+    return dfa->is_match(input);
+  }
+  return find(input, 0).has_value();
+}
+
+size_t QueryPlan::count_matches(std::string_view input) const {
+  if (chosen == Engine::DFA) {
+    return dfa->count_matches(input);
+  }
+  size_t count = 0;
+  size_t from = 0;
+  while (auto span = find(input, from)) {
+    count++;
+    from = span->start + span->length;
+  }
+  return count;
+}
+
+Capture QueryPlan::next_match(std::string_view input, size_t from) const {
+  if (chosen == Engine::DFA) {
+    return dfa->next_match(input, from);
+  }
+  if (auto span = find(input, from)) {
+    return Capture{span->start, span->start + span->length};
+  }
+  return Capture{};
+}
+
+std::vector<RegexMatch>
+QueryPlan::find_all_matches(std::string_view input) const {
+  if (chosen == Engine::DFA) {
+    return dfa->find_all_matches(input);
+  }
+  std::vector<RegexMatch> matches{};
+  size_t from = 0;
+  while (auto span = find(input, from)) {
+    std::string_view match = input.substr(span->start, span->length);
+    matches.push_back(RegexMatch{.success = true,
+                                 .start = span->start,
+                                 .length = span->length,
+                                 .match = std::string{match}});
+    from = span->start + span->length;
+  }
+  return matches;
+}
+
+} // namespace bp
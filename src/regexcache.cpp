@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <functional>
+#include <libbearpig/regexcache.h>
+
+namespace bp {
+
+size_t RegexCache::KeyHash::operator()(const KeyView &key) const {
+  size_t hash = std::hash<std::string_view>{}(key.pattern);
+  return hash ^ (static_cast<size_t>(key.flags) * 0x9e3779b97f4a7c15ULL);
+}
+
+RegexCache::RegexCache(size_t capacity, size_t num_shards)
+    : num_shards{std::max<size_t>(num_shards, 1)},
+      shard_capacity{std::max<size_t>(capacity / this->num_shards, 1)},
+      shards{std::make_unique<Shard[]>(this->num_shards)} {}
+
+std::shared_ptr<const NFA> RegexCache::get(std::string_view pattern,
+                                           RegexFlags flags) {
+  KeyView key{pattern, flags};
+  Shard &shard = shard_for(KeyHash{}(key));
+  {
+    std::lock_guard lock{shard.mutex};
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      shard.hits++;
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      return it->second->nfa;
+    }
+    shard.misses++;
+  }
+
+  // compile without holding the lock, a racing thread compiling the same
+  // pattern just loses and uses whichever entry got in first
+  std::optional<NFA> compiled = try_compile(pattern, flags);
+  if (!compiled) {
+    return nullptr;
+  }
+  auto nfa = std::make_shared<const NFA>(std::move(*compiled));
+
+  std::lock_guard lock{shard.mutex};
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return it->second->nfa;
+  }
+  shard.lru.push_front(Entry{Key{std::string{pattern}, flags}, nfa});
+  shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+  while (shard.lru.size() > shard_capacity) {
+    shard.index.erase(shard.lru.back().key);
+    shard.lru.pop_back();
+    shard.evictions++;
+  }
+  return nfa;
+}
+
+RegexCache::Stats RegexCache::stats() const {
+  Stats stats{};
+  for (size_t i = 0; i < num_shards; i++) {
+    std::lock_guard lock{shards[i].mutex};
+    stats.hits += shards[i].hits;
+    stats.misses += shards[i].misses;
+    stats.evictions += shards[i].evictions;
+    stats.size += shards[i].lru.size();
+  }
+  return stats;
+}
+
+void RegexCache::clear() {
+  for (size_t i = 0; i < num_shards; i++) {
+    std::lock_guard lock{shards[i].mutex};
+    shards[i].index.clear();
+    shards[i].lru.clear();
+  }
+}
+
+} // namespace bp
@@ -1,26 +1,23 @@
 #include "libbearpig/regexparser.h"
 #include "libbearpig/regexast.h"
 #include "libbearpig/regextokens.h"
+#include "libbearpig/trace.h"
 #include <algorithm>
+#include <array>
 #include <memory>
 #include <spdlog/spdlog.h>
 
-namespace {
-
-void print_expected(std::string_view func, bp::RegexTokenType expected,
-                    bp::RegexTokenType actual) {
-  spdlog::debug("{}::expecting {}, current_token: {}", func,
-                to_string(expected), to_string(actual));
-}
+namespace bp {
 
+namespace {
+// Thrown by parse_error() and caught in parse(), so that the recursive descent
+// does not have to check every step for a failed one.
+struct ParseError {};
 } // namespace
 
-namespace bp {
-
 void RegexParser::end_of_input_error() {
-  print_error_message_and_exit(
-      fmt::format("Parser unexpectedly reached end of input"),
-      current_token_idx);
+  parse_error(fmt::format("Parser unexpectedly reached end of input"),
+              current_token_idx);
 }
 
 template <typename... Rs>
@@ -29,42 +26,39 @@ void RegexParser::unexpected_token_error(std::string_view func,
   std::ostringstream oss;
   (oss << ... << fmt::format("{} ", to_string(expected)));
 
-  print_error_message_and_exit(
-      fmt::format("Unexpected token at {} in {}: got {}, expected: {}",
-                  current_token_idx, func, to_string(current_token.tokentype),
-                  oss.str()),
-      current_token_idx);
+  parse_error(fmt::format("Unexpected token at {} in {}: got {}, expected: {}",
+                          current_token_idx, func,
+                          to_string(current_token->tokentype), oss.str()),
+              current_token_idx);
 }
 
 void RegexParser::unexpected_token_error(std::string_view func,
                                          const RegexTokenType &expected) {
-  print_error_message_and_exit(
-      fmt::format("Unexpected token at {} in {}: got {}, expected: {}",
-                  current_token_idx, func, to_string(current_token.tokentype),
-                  to_string(expected)),
-      current_token_idx);
+  parse_error(fmt::format("Unexpected token at {} in {}: got {}, expected: {}",
+                          current_token_idx, func,
+                          to_string(current_token->tokentype),
+                          to_string(expected)),
+              current_token_idx);
 }
 
-void RegexParser::print_error_message_and_exit(const std::string &msg,
-                                               int loc) {
+void RegexParser::parse_error(const std::string &msg, int loc) {
   std::stringstream ss;
-  std::for_each(tokenstream.cbegin(), tokenstream.cend(),
-                [&ss](RegexToken t) { ss << t.data; });
+  std::for_each(tokenstream.begin(), tokenstream.end(),
+                [&ss](RegexToken t) { ss << t.text(); });
   spdlog::error(msg);
   spdlog::error(ss.str());
   spdlog::error("\033[31m{:~>{}}\033[0m", "^", loc + 1);
-  exit(1);
+  throw ParseError{};
 }
 
 void RegexParser::advance() {
-  spdlog::debug("{}::current_token: {} idx: {}", __func__,
-                to_string(current_token.tokentype), current_token_idx);
+  BP_TRACE(PARSE_ADVANCE, current_token_idx, current_token->tokentype);
   current_token_idx++;
   if (current_token_idx < tokenstream.size()) {
-    current_token = tokenstream.at(current_token_idx);
+    current_token = &tokenstream[current_token_idx];
   } else {
-    spdlog::debug("terminating");
-    current_token = RegexToken{RegexTokenType::EOS, current_token_idx, 0};
+    eos_token.column = current_token_idx;
+    current_token = &eos_token;
   }
 }
 
@@ -73,8 +67,8 @@ void RegexParser::consume(RegexTokenType expected) {
 }
 
 void RegexParser::consume(std::string_view func, RegexTokenType expected) {
-  print_expected(func, expected, current_token.tokentype);
-  if (current_token.tokentype == expected or
+  BP_TRACE(PARSE_EXPECT, expected, current_token->tokentype);
+  if (current_token->tokentype == expected or
       expected == RegexTokenType::ACCEPT_ANY) {
     advance();
   } else {
@@ -86,27 +80,49 @@ void RegexParser::consume(std::string_view func, RegexTokenType expected) {
 
 bool RegexParser::parse() {
   spdlog::debug("{}::current_token: {} idx: {}", __func__,
-                to_string(current_token.tokentype), current_token_idx);
-  return parse_top_level();
+                to_string(current_token->tokentype), current_token_idx);
+  try {
+    return parse_top_level();
+  } catch (const ParseError &) {
+    expression_top.reset();
+    return false;
+  }
 }
 
 bool RegexParser::parse_top_level() {
-  std::unique_ptr<AlternativeExp> exp =
-      std::make_unique<AlternativeExp>(parse_exp());
-  if (current_token.tokentype != RegexTokenType::EOS || !is_done())
+  parse_inline_flags();
+  ArenaPtr<AlternativeExp> exp =
+      make_arena<AlternativeExp>(resource, parse_exp());
+  if (current_token->tokentype != RegexTokenType::EOS || !is_done())
     unexpected_token_error(__func__, RegexTokenType::EOS);
   expression_top.swap(exp);
   return true;
 }
 
+// Only (?i) at the very start is understood, it applies to the whole pattern.
+void RegexParser::parse_inline_flags() {
+  static constexpr std::array types = {
+      RegexTokenType::PAREN_OPEN, RegexTokenType::OPTIONAL,
+      RegexTokenType::CHARACTER, RegexTokenType::PAREN_CLOSE};
+  if (tokenstream.size() < types.size() || tokenstream[2].data != 'i' ||
+      !std::ranges::equal(tokenstream.first(types.size()), types, {},
+                          &RegexToken::tokentype)) {
+    return;
+  }
+  case_insensitive = true;
+  for (RegexTokenType type : types) {
+    consume_wf(type);
+  }
+}
+
 AlternativeExp RegexParser::parse_exp() { return parse_alternative(); }
 
 AlternativeExp RegexParser::parse_alternative() {
-  AlternativeExp alternative;
+  AlternativeExp alternative{resource};
   ConcatExp first = parse_simple_exp();
   alternative.alternatives.push_back(std::move(first));
 
-  if (current_token.tokentype == RegexTokenType::ALTERNATIVE) {
+  if (current_token->tokentype == RegexTokenType::ALTERNATIVE) {
     consume_wf(RegexTokenType::ALTERNATIVE);
     AlternativeExp next = parse_alternative();
     for (ConcatExp &e : next.alternatives) {
@@ -119,16 +135,16 @@ AlternativeExp RegexParser::parse_alternative() {
 ConcatExp RegexParser::parse_simple_exp() { return parse_concatenation_exp(); }
 
 ConcatExp RegexParser::parse_concatenation_exp() {
-  std::vector<RegexTokenType> types = {
+  static constexpr std::array types = {
       RegexTokenType::PAREN_OPEN, RegexTokenType::SQUARE_OPEN,
       RegexTokenType::ANY, RegexTokenType::CHARACTER, RegexTokenType::ESCAPE};
   QuantifiedExp quantified_exp = parse_quantified_exp();
-  ConcatExp concat;
+  ConcatExp concat{resource};
   concat.exps.push_back(std::move(quantified_exp));
-  if (current_token.tokentype == RegexTokenType::EOS)
+  if (current_token->tokentype == RegexTokenType::EOS)
     return concat;
   while (std::ranges::any_of(types, [this](RegexTokenType type) {
-    return current_token.tokentype == type;
+    return current_token->tokentype == type;
   })) {
     ConcatExp next_concat = parse_concatenation_exp();
     concat.merge(next_concat);
@@ -140,7 +156,7 @@ QuantifiedExp RegexParser::parse_quantified_exp() {
   QuantifiedExp quantified_exp{};
   auto e = parse_elementary_exp();
   quantified_exp.exp = std::move(e);
-  switch (current_token.tokentype) {
+  switch (current_token->tokentype) {
   case (RegexTokenType::STAR): {
     consume_wf(RegexTokenType::STAR);
     quantified_exp.quantifier = QuantifiedExp::Quantifier::STAR;
@@ -165,10 +181,7 @@ QuantifiedExp RegexParser::parse_quantified_exp() {
 }
 
 ElementaryExp RegexParser::parse_elementary_exp() {
-  spdlog::debug("{}::current_token: {} ({}) at {}", __func__,
-                current_token.data, to_string(current_token.tokentype),
-                current_token.column);
-  switch (current_token.tokentype) {
+  switch (current_token->tokentype) {
   case (RegexTokenType::PAREN_OPEN): {
     return parse_group();
   }
@@ -193,31 +206,24 @@ ElementaryExp RegexParser::parse_elementary_exp() {
 }
 
 RChar RegexParser::parse_character(bool single) {
-  spdlog::debug("{}::expecting {}, current_token: {}", __func__,
-                to_string(RegexTokenType::CHARACTER),
-                to_string(current_token.tokentype));
+  BP_TRACE(PARSE_EXPECT, RegexTokenType::CHARACTER, current_token->tokentype);
   RChar character;
   character.idx = current_token_idx;
-  character.character = tokenstream.at(current_token_idx);
-  if (current_token.tokentype == RegexTokenType::ESCAPE)
+  character.character = *current_token;
+  if (current_token->tokentype == RegexTokenType::ESCAPE)
     return parse_escape_seq();
   consume_wf(RegexTokenType::CHARACTER);
   return character;
 }
 
 RChar RegexParser::parse_escape_seq() {
-  spdlog::debug("{}::current {} next: {}", __func__,
-                to_string(current_token.tokentype),
-                to_string(tokenstream.at(current_token_idx + 1).tokentype));
   RChar esc;
   esc.idx = current_token_idx;
   esc.is_escape = true;
   consume_wf(RegexTokenType::ESCAPE);
-  auto escaped_token = current_token;
+  const RegexToken &escaped_token = *current_token;
   esc.character = escaped_token;
   consume_wf(RegexTokenType::ACCEPT_ANY);
-  spdlog::debug("{}::escaped token: '{}' ({})", __func__, escaped_token.data,
-                to_string(escaped_token.tokentype));
   return esc;
 }
 
@@ -230,51 +236,44 @@ GroupExp RegexParser::parse_group() {
   consume_wf(RegexTokenType::PAREN_OPEN);
 
   GroupExp group;
-  group.subExp = std::make_unique<AlternativeExp>(parse_exp());
+  group.subExp = make_arena<AlternativeExp>(resource, parse_exp());
 
   consume_wf(RegexTokenType::PAREN_CLOSE);
   return group;
 }
 
 SetExp RegexParser::parse_set() {
-  spdlog::debug("{}::attempting to parse set", __func__);
   consume_wf(RegexTokenType::SQUARE_OPEN);
-  SetExp e;
+  SetExp e{resource};
 
-  if (current_token.tokentype == RegexTokenType::CARET) {
+  if (current_token->tokentype == RegexTokenType::CARET) {
     consume_wf(RegexTokenType::CARET);
     e.negative = true;
   }
   e.items = std::move(parse_set_items());
 
   consume_wf(RegexTokenType::SQUARE_CLOSE);
-  spdlog::debug("{}::successfully parsed a {}set", __func__,
-                e.negative ? "negative " : "");
   return e;
 }
 
-std::vector<SetItem> RegexParser::parse_set_items() {
-  std::vector<SetItem> items;
-  while (current_token.tokentype == RegexTokenType::CHARACTER ||
-         current_token.tokentype == RegexTokenType::ESCAPE) {
+std::pmr::vector<SetItem> RegexParser::parse_set_items() {
+  std::pmr::vector<SetItem> items{resource};
+  while (current_token->tokentype == RegexTokenType::CHARACTER ||
+         current_token->tokentype == RegexTokenType::ESCAPE) {
     items.emplace_back(std::move(parse_set_item()));
   }
   return items;
 }
 
 SetItem RegexParser::parse_set_item() {
-  spdlog::debug("{}::attempting to a parse set item!", __func__);
   SetItem item;
 
   item.start = std::move(parse_character());
-  if (current_token.tokentype == RegexTokenType::DASH) {
+  if (current_token->tokentype == RegexTokenType::DASH) {
     consume_wf(RegexTokenType::DASH);
     item.range = true;
     item.stop = parse_character(true);
   }
-  spdlog::debug("{}::parsed a {}set item! start:{}{}", __func__,
-                item.range ? "range " : "", item.start.to_string(),
-                item.range ? fmt::format("-{}", item.stop.to_string()) : "");
   return item;
 }
 } // namespace bp
@@ -1,4 +1,6 @@
 #include <libbearpig/regexscanner.h>
+#include <libbearpig/trace.h>
+#include <libbearpig/utf8.h>
 
 #include <spdlog/spdlog.h>
 
@@ -14,7 +16,21 @@ std::vector<RegexToken> RegexScanner::tokenize() {
   if (input.empty()) {
     return tokens;
   }
-  spdlog::debug(input.size());
+  // every character becomes one token, multi-byte ones fewer
+  tokens.reserve(input.size() - current_column);
+  while (current_column < input.size()) {
+    tokens.emplace_back(next());
+  }
+  return tokens;
+}
+
+std::pmr::vector<RegexToken>
+RegexScanner::tokenize(std::pmr::memory_resource *resource) {
+  std::pmr::vector<RegexToken> tokens{resource};
+  if (input.empty()) {
+    return tokens;
+  }
+  tokens.reserve(input.size() - current_column);
   while (current_column < input.size()) {
     tokens.emplace_back(next());
   }
@@ -24,7 +40,6 @@ std::vector<RegexToken> RegexScanner::tokenize() {
 RegexToken RegexScanner::next() {
   char current_char = input.at(current_column);
   RegexToken token;
-  spdlog::debug("current_char={}, column = {}", current_char, current_column);
   switch (current_char) {
   case ('*'): {
     token =
@@ -95,9 +110,16 @@ RegexToken RegexScanner::next() {
   default: {
     token = RegexToken{RegexTokenType::CHARACTER, current_column,
                        input[current_column]};
+    char32_t codepoint;
+    size_t length = decode_utf8(input.substr(current_column), codepoint);
+    if (length > 1) {
+      token.codepoint = codepoint;
+      token.length = length;
+    }
   }
   }
-  current_column++;
+  BP_TRACE(SCAN_TOKEN, current_column, token.tokentype);
+  current_column += token.length;
   return token;
 }
 
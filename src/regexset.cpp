@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <bit>
+#include <libbearpig/regexset.h>
+#include <map>
+#include <spdlog/spdlog.h>
+
+namespace bp {
+
+bool RegexSet::Matches::empty() const {
+  return std::all_of(bits.begin(), bits.end(),
+                     [](uint64_t word) { return word == 0; });
+}
+
+size_t RegexSet::Matches::count() const {
+  size_t count = 0;
+  for (uint64_t word : bits) {
+    count += std::popcount(word);
+  }
+  return count;
+}
+
+std::vector<size_t> RegexSet::Matches::patterns() const {
+  std::vector<size_t> patterns;
+  for (size_t i = 0; i < bits.size(); i++) {
+    for (uint64_t word = bits[i]; word != 0; word &= word - 1) {
+      patterns.push_back(i * 64 + std::countr_zero(word));
+    }
+  }
+  return patterns;
+}
+
+RegexSet::Scratch &RegexSet::Scratch::for_this_thread() {
+  static thread_local Scratch scratch;
+  return scratch;
+}
+
+std::optional<RegexSet> RegexSet::compile(std::span<const std::string> patterns,
+                                          RegexFlags flags,
+                                          size_t max_states) {
+  // the set's DFA replaces anything the planner would pick per pattern
+  std::vector<std::optional<NFA>> nfas =
+      compile_all(patterns, flags | RegexFlags::NFA_ONLY);
+  std::vector<const NFA *> pointers;
+  for (size_t i = 0; i < nfas.size(); i++) {
+    if (!nfas[i]) {
+      spdlog::error("pattern {} of the set, {}, has an error", i, patterns[i]);
+      return std::nullopt;
+    }
+    pointers.push_back(&*nfas[i]);
+  }
+  return from_nfas(pointers, max_states);
+}
+
+RegexSet RegexSet::from_nfas(std::span<const NFA *const> nfas,
+                             size_t max_states) {
+  RegexSet set;
+  set.set_id = next_program_id();
+  set.patterns = nfas.size();
+  // room for the dead state, a start state and one to step to
+  set.max_states = std::max<size_t>(max_states, 3);
+  set.words_per_set = (nfas.size() + 63) / 64;
+
+  for (uint32_t pattern = 0; pattern < nfas.size(); pattern++) {
+    const NFA &nfa = *nfas[pattern];
+    uint32_t base = set.accept_of.size();
+    set.starts.push_back(base);
+    for (size_t state = 0; state < nfa.num_states(); state++) {
+      set.edge_offsets.push_back(set.edges.size());
+      for (FlatEdge edge : nfa.edges_of(state)) {
+        edge.to += base;
+        set.edges.push_back(edge);
+      }
+      set.accept_of.push_back(state == nfa.accept_id ? pattern : UINT32_MAX);
+    }
+  }
+  set.edge_offsets.push_back(set.edges.size());
+
+  for (const NFA *nfa : nfas) {
+    std::map<std::pair<uint8_t, uint8_t>, uint8_t> refined;
+    for (size_t byte = 0; byte < 256; byte++) {
+      auto [it, inserted] = refined.try_emplace(
+          {set.byte_classes[byte], nfa->byte_classes[byte]}, refined.size());
+      set.byte_classes[byte] = it->second;
+    }
+    set.num_classes = refined.size();
+  }
+  return set;
+}
+
+void RegexSet::prepare(Scratch &scratch) const {
+  if (scratch.set_id == set_id) {
+    return;
+  }
+  scratch.set_id = set_id;
+  scratch.num_classes = num_classes;
+  scratch.mark.assign(accept_of.size(), 0);
+  scratch.generation = 0;
+  flush(scratch);
+}
+
+void RegexSet::flush(Scratch &scratch) const {
+  if (!scratch.sets.empty()) {
+    scratch.num_flushes++;
+  }
+  scratch.sets.clear();
+  scratch.ids.clear();
+  scratch.transitions.clear();
+  scratch.accepts.clear();
+  scratch.accept_ids.clear();
+  scratch.accept_sets.assign(words_per_set, 0);
+  scratch.accept_ids.emplace(std::vector<uint64_t>(words_per_set, 0), NONE);
+  scratch.whole_start = UNKNOWN;
+  scratch.anywhere_start = UNKNOWN;
+
+  // the empty set is the dead state, it never leaves itself
+  scratch.ids.emplace(std::vector<uint32_t>{}, DEAD);
+  scratch.sets.emplace_back();
+  scratch.accepts.push_back(NONE);
+  scratch.transitions.resize(num_classes, DEAD);
+}
+
+// With restart every pattern's start state joins every set, which is
+// searching from each offset at once. Those sets carry the restart marker to
+// keep them apart from the anchored ones.
+uint32_t RegexSet::start_state(Scratch &scratch, bool restart) const {
+  uint32_t &start = restart ? scratch.anywhere_start : scratch.whole_start;
+  if (start == UNKNOWN) {
+    scratch.states = starts;
+    close(scratch);
+    if (restart) {
+      scratch.states.push_back(accept_of.size());
+    }
+    // interning never flushes the state it returns
+    start = intern(scratch);
+  }
+  return start;
+}
+
+uint32_t RegexSet::compute_next_state(Scratch &scratch, uint32_t state,
+                                      unsigned char byte) const {
+  scratch.states.clear();
+  const std::vector<uint32_t> &from = scratch.sets[state];
+  // sorted, so the marker comes last
+  bool restart = !from.empty() && from.back() == accept_of.size();
+  for (uint32_t id : std::span{from}.first(from.size() - restart)) {
+    for (uint32_t i = edge_offsets[id]; i < edge_offsets[id + 1]; i++) {
+      if (edges[i].accepts(byte)) {
+        scratch.states.push_back(edges[i].to);
+      }
+    }
+  }
+  if (restart) {
+    scratch.states.insert(scratch.states.end(), starts.begin(), starts.end());
+  }
+  close(scratch);
+  if (restart) {
+    scratch.states.push_back(accept_of.size());
+  }
+
+  size_t flushes_before = scratch.num_flushes;
+  uint32_t next = intern(scratch);
+  // a flush drops the state we came from, so there is nothing to cache into
+  if (scratch.num_flushes == flushes_before) {
+    scratch.transitions[state * num_classes + byte_classes[byte]] = next;
+  }
+  return next;
+}
+
+// Replaces scratch.states with their epsilon closure, sorted.
+void RegexSet::close(Scratch &scratch) const {
+  std::vector<uint32_t> &states = scratch.states;
+  std::vector<uint32_t> &mark = scratch.mark;
+  uint32_t generation = ++scratch.generation;
+  std::vector<uint32_t> &stack = scratch.stack;
+  stack.clear();
+  for (uint32_t state : states) {
+    if (mark[state] != generation) {
+      mark[state] = generation;
+      stack.push_back(state);
+    }
+  }
+  states.clear();
+  while (!stack.empty()) {
+    uint32_t state = stack.back();
+    stack.pop_back();
+    states.push_back(state);
+    for (uint32_t i = edge_offsets[state]; i < edge_offsets[state + 1]; i++) {
+      if (edges[i].is_epsilon() && mark[edges[i].to] != generation) {
+        mark[edges[i].to] = generation;
+        stack.push_back(edges[i].to);
+      }
+    }
+  }
+  std::sort(states.begin(), states.end());
+}
+
+uint32_t RegexSet::intern(Scratch &scratch) const {
+  auto found = scratch.ids.find(scratch.states);
+  if (found != scratch.ids.end()) {
+    return found->second;
+  }
+  if (scratch.sets.size() >= max_states) {
+    flush(scratch);
+  }
+  uint32_t id = scratch.sets.size();
+  scratch.ids.emplace(scratch.states, id);
+  scratch.sets.push_back(scratch.states);
+  scratch.accepts.push_back(accept_set_of(scratch));
+  scratch.transitions.resize(scratch.transitions.size() + num_classes,
+                             UNKNOWN);
+  return id;
+}
+
+uint32_t RegexSet::accept_set_of(Scratch &scratch) const {
+  std::vector<uint64_t> &accepted = scratch.accepted;
+  accepted.assign(words_per_set, 0);
+  for (uint32_t state : scratch.states) {
+    if (state < accept_of.size() && accept_of[state] != UINT32_MAX) {
+      accepted[accept_of[state] / 64] |= uint64_t{1} << accept_of[state] % 64;
+    }
+  }
+  auto [it, inserted] =
+      scratch.accept_ids.try_emplace(accepted, scratch.accept_ids.size());
+  if (inserted) {
+    scratch.accept_sets.insert(scratch.accept_sets.end(), accepted.begin(),
+                               accepted.end());
+  }
+  return it->second;
+}
+
+void RegexSet::add_accepted(const Scratch &scratch, Matches &found,
+                            uint32_t set) const {
+  const uint64_t *words = &scratch.accept_sets[set * words_per_set];
+  for (size_t i = 0; i < words_per_set; i++) {
+    found.bits[i] |= words[i];
+  }
+}
+
+RegexSet::Matches RegexSet::exact_matches(std::string_view input) const {
+  return exact_matches(input, Scratch::for_this_thread());
+}
+
+RegexSet::Matches RegexSet::exact_matches(std::string_view input,
+                                          Scratch &scratch) const {
+  prepare(scratch);
+  Matches found{patterns};
+  uint32_t state = start_state(scratch, false);
+  for (size_t i = 0; i < input.size() && state != DEAD; i++) {
+    state = next_state(scratch, state, input[i]);
+  }
+  add_accepted(scratch, found, scratch.accepts[state]);
+  return found;
+}
+
+RegexSet::Matches RegexSet::matches(std::string_view input) const {
+  return matches(input, Scratch::for_this_thread());
+}
+
+RegexSet::Matches RegexSet::matches(std::string_view input,
+                                    Scratch &scratch) const {
+  prepare(scratch);
+  Matches found{patterns};
+  uint32_t state = start_state(scratch, true);
+  // a state keeps accepting on runs of input like [a-z]+, adding the same
+  // set again would change nothing
+  uint32_t last_added = NONE;
+  auto collect = [&] {
+    uint32_t set = scratch.accepts[state];
+    if (set != NONE && set != last_added) {
+      add_accepted(scratch, found, set);
+      last_added = set;
+    }
+  };
+  collect();
+  for (unsigned char byte : input) {
+    size_t flushes_before = scratch.num_flushes;
+    state = next_state(scratch, state, byte);
+    if (scratch.num_flushes != flushes_before) {
+      // a flush numbers the accept sets anew
+      last_added = NONE;
+    }
+    collect();
+  }
+  return found;
+}
+
+} // namespace bp
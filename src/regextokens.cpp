@@ -1,4 +1,5 @@
 #include <libbearpig/regextokens.h>
+#include <libbearpig/utf8.h>
 
 namespace bp {
 std::string to_string(RegexTokenType t) {
@@ -65,6 +66,10 @@ std::string to_string(RegexTokenType t) {
   }
   }
 }
+std::string RegexToken::text() const {
+  return length == 1 ? std::string{data} : encode_utf8(codepoint);
+}
+
 RegexToken invalid = RegexToken{RegexTokenType::INVALID, 0, 0};
 const RegexToken &invalid_token() { return invalid; };
 } // namespace bp
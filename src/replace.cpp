@@ -0,0 +1,87 @@
+#include <libbearpig/replace.h>
+
+namespace bp {
+
+Capture MatchIterator::next() {
+  if (from > input.size()) {
+    return Capture{};
+  }
+  Capture match = nfa.next_match(input, from, scratch);
+  if (!match.matched()) {
+    from = input.size() + 1;
+    return match;
+  }
+  // the same step as find_all_matches, past an empty match by one byte
+  from = match.end > match.start ? match.end : match.end + 1;
+  return match;
+}
+
+void Split::next(iterator &it) {
+  if (rest > input.size()) {
+    it.split = nullptr;
+    return;
+  }
+  Capture match = matches.next();
+  if (!match.matched()) {
+    it.piece = input.substr(rest);
+    rest = input.size() + 1;
+    return;
+  }
+  it.piece = input.substr(rest, match.start - rest);
+  rest = match.end;
+}
+
+namespace {
+// The one loop behind every replace_all, for any way of writing the output.
+template <typename Write, typename Replace>
+size_t replace(const NFA &nfa, std::string_view input, Write &&write,
+               Replace &&replace_match) {
+  MatchIterator matches{nfa, input};
+  size_t replaced = 0;
+  size_t copied = 0;
+  for (Capture match = matches.next(); match.matched();
+       match = matches.next()) {
+    if (match.start > copied) {
+      write(input.substr(copied, match.start - copied));
+    }
+    replace_match(match.in(input));
+    copied = match.end;
+    replaced++;
+  }
+  if (copied < input.size()) {
+    write(input.substr(copied));
+  }
+  return replaced;
+}
+} // namespace
+
+size_t replace_all(const NFA &nfa, std::string_view input,
+                   std::string_view replacement, const Sink &out) {
+  return replace(nfa, input, out,
+                 [&](std::string_view) { out(replacement); });
+}
+
+size_t replace_all(const NFA &nfa, std::string_view input,
+                   const Replacer &replacer, const Sink &out) {
+  return replace(nfa, input, out,
+                 [&](std::string_view match) { replacer(match, out); });
+}
+
+size_t replace_all(const NFA &nfa, std::string_view input,
+                   std::string_view replacement, std::string &out) {
+  out.reserve(out.size() + input.size());
+  auto append = [&](std::string_view piece) { out.append(piece); };
+  return replace(nfa, input, append,
+                 [&](std::string_view) { out.append(replacement); });
+}
+
+size_t replace_all(const NFA &nfa, std::string_view input,
+                   const Replacer &replacer, std::string &out) {
+  out.reserve(out.size() + input.size());
+  Sink append = [&](std::string_view piece) { out.append(piece); };
+  return replace(nfa, input, append, [&](std::string_view match) {
+    replacer(match, append);
+  });
+}
+
+} // namespace bp
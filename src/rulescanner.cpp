@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <libbearpig/rulescanner.h>
+#include <map>
+#include <spdlog/spdlog.h>
+
+namespace bp {
+
+std::optional<RuleScanner>
+RuleScanner::from_rules(std::span<const NFA *const> rules, size_t max_states) {
+  RuleScanner scanner;
+  scanner.rules = rules.size();
+
+  // Lay the rules' NFAs out side by side, so a DFA state can be a set of
+  // states of all of them at once.
+  std::vector<uint32_t> edge_offsets;
+  std::vector<FlatEdge> edges;
+  std::vector<uint32_t> accept_of;
+  std::vector<uint32_t> starts;
+  for (uint32_t rule = 0; rule < rules.size(); rule++) {
+    const NFA &nfa = *rules[rule];
+    uint32_t base = accept_of.size();
+    starts.push_back(base);
+    for (size_t state = 0; state < nfa.num_states(); state++) {
+      edge_offsets.push_back(edges.size());
+      for (FlatEdge edge : nfa.edges_of(state)) {
+        edge.to += base;
+        edges.push_back(edge);
+      }
+      accept_of.push_back(state == nfa.accept_id ? rule : NO_RULE);
+    }
+  }
+  edge_offsets.push_back(edges.size());
+
+  // bytes share a class if they do in every rule
+  for (const NFA *nfa : rules) {
+    std::map<std::pair<uint8_t, uint8_t>, uint8_t> refined;
+    for (size_t byte = 0; byte < 256; byte++) {
+      auto [it, inserted] = refined.try_emplace(
+          {scanner.byte_classes[byte], nfa->byte_classes[byte]},
+          refined.size());
+      scanner.byte_classes[byte] = it->second;
+    }
+    scanner.num_classes = refined.size();
+  }
+  std::array<unsigned char, 256> representatives{};
+  for (int byte = 255; byte >= 0; byte--) {
+    representatives[scanner.byte_classes[byte]] = byte;
+  }
+
+  std::vector<uint32_t> mark(accept_of.size(), 0);
+  uint32_t generation = 0;
+  std::vector<uint32_t> stack;
+  auto close = [&](std::vector<uint32_t> &set) {
+    generation++;
+    stack.clear();
+    for (uint32_t state : set) {
+      if (mark[state] != generation) {
+        mark[state] = generation;
+        stack.push_back(state);
+      }
+    }
+    set.clear();
+    while (!stack.empty()) {
+      uint32_t state = stack.back();
+      stack.pop_back();
+      set.push_back(state);
+      for (uint32_t i = edge_offsets[state]; i < edge_offsets[state + 1]; i++) {
+        if (edges[i].is_epsilon() && mark[edges[i].to] != generation) {
+          mark[edges[i].to] = generation;
+          stack.push_back(edges[i].to);
+        }
+      }
+    }
+    std::sort(set.begin(), set.end());
+  };
+
+  // subset construction, DEAD is the empty set
+  std::vector<uint32_t> table;
+  std::map<std::vector<uint32_t>, uint32_t> ids;
+  std::vector<std::vector<uint32_t>> sets;
+  auto intern = [&](std::vector<uint32_t> &set) {
+    auto [it, inserted] = ids.try_emplace(set, sets.size());
+    if (inserted) {
+      uint32_t rule = NO_RULE;
+      for (uint32_t state : set) {
+        rule = std::min(rule, accept_of[state]);
+      }
+      sets.push_back(set);
+      scanner.accept_rule.push_back(rule);
+      table.resize(table.size() + scanner.num_classes, DEAD);
+    }
+    return it->second;
+  };
+  std::vector<uint32_t> set;
+  intern(set);
+  set = starts;
+  close(set);
+  scanner.start = intern(set);
+
+  for (uint32_t id = 1; id < sets.size(); id++) {
+    for (size_t cls = 0; cls < scanner.num_classes; cls++) {
+      set.clear();
+      for (uint32_t state : sets[id]) {
+        for (uint32_t i = edge_offsets[state]; i < edge_offsets[state + 1];
+             i++) {
+          if (edges[i].accepts(representatives[cls])) {
+            set.push_back(edges[i].to);
+          }
+        }
+      }
+      if (set.empty()) {
+        continue;
+      }
+      close(set);
+      uint32_t next = intern(set);
+      if (sets.size() > max_states) {
+        spdlog::error("the scanner for {} rules needs more than {} states",
+                      rules.size(), max_states);
+        return std::nullopt;
+      }
+      table[id * scanner.num_classes + cls] = next;
+    }
+  }
+  scanner.table = StateTable{table, sets.size()};
+  return scanner;
+}
+
+RuleScanner::Token RuleScanner::next_token(std::string_view input,
+                                           size_t at) const {
+  return table.visit([&](auto ids) { return next_token(ids, input, at); });
+}
+
+template <typename StateId>
+RuleScanner::Token RuleScanner::next_token(std::span<const StateId> ids,
+                                           std::string_view input,
+                                           size_t at) const {
+  uint32_t state = start;
+  Token token{NO_RULE, at, 1};
+  for (size_t i = at; i < input.size(); i++) {
+    state = ids[state * num_classes +
+                byte_classes[static_cast<unsigned char>(input[i])]];
+    if (state == DEAD) {
+      break;
+    }
+    if (accept_rule[state] != NO_RULE) {
+      token.rule = accept_rule[state];
+      token.length = i + 1 - at;
+    }
+  }
+  return token;
+}
+
+std::vector<RuleScanner::Token>
+RuleScanner::tokenize(std::string_view input) const {
+  std::vector<Token> tokens;
+  table.visit([&](auto ids) {
+    for (size_t at = 0; at < input.size();) {
+      tokens.push_back(next_token(ids, input, at));
+      at = tokens.back().start + tokens.back().length;
+    }
+  });
+  return tokens;
+}
+
+} // namespace bp
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <fstream>
+#include <libbearpig/regexparser.h>
+#include <libbearpig/regexscanner.h>
+#include <libbearpig/scannerspec.h>
+#include <libbearpig/serialize.h>
+#include <libbearpig/threadpool.h>
+#include <map>
+#include <spdlog/spdlog.h>
+#include <sstream>
+
+namespace bp {
+
+namespace {
+
+bool is_name(std::string_view text) {
+  auto name_char = [](char c) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9');
+  };
+  return !text.empty() && !(text[0] >= '0' && text[0] <= '9') &&
+         std::all_of(text.begin(), text.end(), name_char);
+}
+
+bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+std::string_view trim(std::string_view text) {
+  while (!text.empty() && is_space(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && is_space(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+// cuts the first word off rest
+std::string_view next_word(std::string_view &rest) {
+  rest = trim(rest);
+  size_t end = 0;
+  while (end < rest.size() && !is_space(rest[end])) {
+    end++;
+  }
+  std::string_view word = rest.substr(0, end);
+  rest = trim(rest.substr(end));
+  return word;
+}
+
+// Replaces {name} with the macro in parentheses. Braces around something that
+// is not a name are left alone, they stand for themselves in a pattern.
+std::optional<std::string>
+expand(std::string_view pattern,
+       const std::map<std::string, std::string, std::less<>> &macros,
+       size_t line) {
+  std::string expanded;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+      expanded += pattern.substr(i, 2);
+      i++;
+      continue;
+    }
+    size_t close = pattern.find('}', i);
+    if (pattern[i] != '{' || close == std::string_view::npos ||
+        !is_name(pattern.substr(i + 1, close - i - 1))) {
+      expanded += pattern[i];
+      continue;
+    }
+    std::string_view name = pattern.substr(i + 1, close - i - 1);
+    auto macro = macros.find(name);
+    if (macro == macros.end()) {
+      spdlog::error("line {}: undefined macro {}", line, name);
+      return std::nullopt;
+    }
+    expanded += '(' + macro->second + ')';
+    i = close;
+  }
+  return expanded;
+}
+
+// Only parses the pattern, which is cheap next to compiling it, so that a
+// syntax error is found with its line even when the rule will be cached.
+bool parses(std::string_view pattern) {
+  RegexScanner scanner{pattern};
+  auto tokens = scanner.tokenize();
+  RegexParser parser{tokens};
+  return parser.parse();
+}
+
+} // namespace
+
+std::optional<ScannerSpec> ScannerSpec::parse(std::string_view text) {
+  std::vector<std::string_view> lines;
+  for (size_t start = 0; start <= text.size();) {
+    size_t end = std::min(text.find('\n', start), text.size());
+    lines.push_back(text.substr(start, end - start));
+    start = end + 1;
+  }
+  bool has_macros = std::any_of(lines.begin(), lines.end(),
+                                [](auto line) { return trim(line) == "%%"; });
+
+  ScannerSpec spec;
+  std::map<std::string, std::string, std::less<>> macros;
+  std::map<std::string, size_t, std::less<>> rule_lines;
+  bool in_rules = !has_macros;
+  for (size_t i = 0; i < lines.size(); i++) {
+    size_t line = i + 1;
+    std::string_view rest = trim(lines[i]);
+    if (rest.empty() || rest.front() == '#') {
+      continue;
+    }
+    if (rest == "%%") {
+      in_rules = true;
+      continue;
+    }
+    std::string_view name = next_word(rest);
+    std::string_view pattern = next_word(rest);
+    if (!is_name(name)) {
+      spdlog::error("line {}: {} is not a name", line, name);
+      return std::nullopt;
+    }
+    if (pattern.empty()) {
+      spdlog::error("line {}: {} has no pattern", line, name);
+      return std::nullopt;
+    }
+    auto expanded = expand(pattern, macros, line);
+    if (!expanded) {
+      return std::nullopt;
+    }
+    if (!in_rules) {
+      if (!rest.empty()) {
+        spdlog::error("line {}: macro {} has more than a pattern", line, name);
+        return std::nullopt;
+      }
+      macros.insert_or_assign(std::string{name}, std::move(*expanded));
+      continue;
+    }
+    auto [earlier, inserted] = rule_lines.try_emplace(std::string{name}, line);
+    if (!inserted) {
+      spdlog::error("line {}: rule {} is already defined on line {}", line,
+                    name, earlier->second);
+      return std::nullopt;
+    }
+    if (!parses(*expanded)) {
+      spdlog::error("line {}: rule {}: {} does not parse", line, name,
+                    pattern);
+      return std::nullopt;
+    }
+    spec.token_rules.push_back(ScannerRule{std::string{name},
+                                           std::move(*expanded),
+                                           std::string{rest}, line});
+  }
+  return spec;
+}
+
+std::optional<ScannerSpec> ScannerSpec::load(const std::filesystem::path &path) {
+  std::ifstream in{path};
+  if (!in) {
+    spdlog::error("could not open {}", path.string());
+    return std::nullopt;
+  }
+  std::ostringstream text;
+  text << in.rdbuf();
+  return parse(text.str());
+}
+
+uint64_t ScannerSpec::content_hash(std::string_view pattern, RegexFlags flags) {
+  // FNV-1a, it only has to be stable across runs
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto mix = [&hash](uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+      hash = (hash ^ ((value >> (8 * i)) & 0xFF)) * 0x100000001b3ULL;
+    }
+  };
+  mix(SERIALIZE_VERSION);
+  mix(static_cast<uint64_t>(flags));
+  for (char c : pattern) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::optional<RuleScanner>
+ScannerSpec::build(RegexFlags flags, const std::filesystem::path &cache_dir,
+                   BuildStats *stats, size_t num_threads) const {
+  bool caching = !cache_dir.empty();
+  if (caching) {
+    std::error_code error;
+    std::filesystem::create_directories(cache_dir, error);
+    if (error) {
+      spdlog::warn("not caching rules, cannot create {}: {}",
+                   cache_dir.string(), error.message());
+      caching = false;
+    }
+  }
+  auto cache_file = [&](const ScannerRule &rule) {
+    return cache_dir /
+           fmt::format("{:016x}.nfa", content_hash(rule.pattern, flags));
+  };
+
+  // Every rule's NFA goes into its own slot and the scanner is built from
+  // them in the order of the spec, so it comes out the same for any number
+  // of threads.
+  ThreadPool pool{num_threads};
+  std::vector<NFA> nfas(token_rules.size());
+  std::vector<uint8_t> cached(token_rules.size(), false);
+  if (caching) {
+    for (size_t i = 0; i < token_rules.size(); i++) {
+      pool.submit([&, i] {
+        std::filesystem::path file = cache_file(token_rules[i]);
+        if (std::filesystem::exists(file)) {
+          // the scanner never asks a rule's plan, like compile_all below
+          if (auto nfa = load_nfa(file, RegexFlags::NFA_ONLY)) {
+            nfas[i] = std::move(*nfa);
+            cached[i] = true;
+          }
+        }
+      });
+    }
+    pool.wait();
+  }
+
+  std::vector<size_t> missing;
+  std::vector<std::string> patterns;
+  for (size_t i = 0; i < token_rules.size(); i++) {
+    if (!cached[i]) {
+      spdlog::debug("compiling rule {} from line {}", token_rules[i].name,
+                    token_rules[i].line);
+      missing.push_back(i);
+      patterns.push_back(token_rules[i].pattern);
+    }
+  }
+  std::vector<std::optional<NFA>> compiled =
+      compile_all(patterns, flags | RegexFlags::NFA_ONLY, pool);
+  for (size_t j = 0; j < missing.size(); j++) {
+    if (!compiled[j]) {
+      const ScannerRule &rule = token_rules[missing[j]];
+      spdlog::error("line {}: rule {}: {} has an error", rule.line, rule.name,
+                    rule.pattern);
+      return std::nullopt;
+    }
+    nfas[missing[j]] = std::move(*compiled[j]);
+    if (!caching) {
+      continue;
+    }
+    // save() renames the file into place, so a concurrent build never maps
+    // a half written one
+    pool.submit([&, i = missing[j]] {
+      if (!save(nfas[i], cache_file(token_rules[i]))) {
+        spdlog::warn("could not cache rule {}", token_rules[i].name);
+      }
+    });
+  }
+  pool.wait();
+  if (stats != nullptr) {
+    stats->compiled = missing.size();
+    stats->cached = token_rules.size() - missing.size();
+  }
+
+  std::vector<const NFA *> rules;
+  for (const NFA &nfa : nfas) {
+    rules.push_back(&nfa);
+  }
+  return RuleScanner::from_rules(rules);
+}
+
+} // namespace bp
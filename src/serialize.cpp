@@ -0,0 +1,338 @@
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <libbearpig/serialize.h>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace bp {
+
+namespace {
+
+constexpr std::array<char, 8> MAGIC{'B', 'E', 'A', 'R', 'P', 'I', 'G', '\0'};
+// written in native byte order, reads back differently on the other endianness
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr size_t SECTION_ALIGNMENT = 64;
+
+enum class AutomatonKind : uint32_t {
+  NFA = 1,
+  DFA = 2,
+};
+
+struct Section {
+  uint64_t offset;
+  uint64_t count;
+};
+
+struct FileHeader {
+  std::array<char, 8> magic;
+  uint32_t byte_order;
+  uint32_t version;
+  AutomatonKind kind;
+  uint32_t num_classes;
+  // accepting state for NFAs, start state for DFAs
+  uint32_t special_state;
+  uint32_t starts_with_any;
+  std::array<uint64_t, 4> first_bytes;
+  std::array<uint8_t, 256> byte_classes;
+  // NFA: edge offsets, edges. DFA: transition table, accepting flags.
+  std::array<Section, 2> sections;
+  uint64_t file_size;
+  // capture groups of an NFA, their tags are part of the edges
+  uint32_t num_groups;
+  // bytes per state id in a DFA's transition table
+  uint32_t state_width;
+  // the rest of the PatternProperties besides first_bytes
+  uint64_t min_length;
+  uint64_t max_length;
+  std::array<uint64_t, 4> last_bytes;
+};
+static_assert(std::is_trivially_copyable_v<FileHeader>);
+static_assert(sizeof(FileHeader) == 416, "the layout is part of the format");
+
+size_t align_up(size_t offset) {
+  return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT *
+         SECTION_ALIGNMENT;
+}
+
+std::array<uint64_t, 4> pack_bits(const std::bitset<256> &bits) {
+  std::array<uint64_t, 4> packed{};
+  for (size_t i = 0; i < 256; i++) {
+    if (bits.test(i)) {
+      packed[i / 64] |= uint64_t{1} << (i % 64);
+    }
+  }
+  return packed;
+}
+
+std::bitset<256> unpack_bits(const std::array<uint64_t, 4> &packed) {
+  std::bitset<256> bits;
+  for (size_t i = 0; i < 256; i++) {
+    bits.set(i, (packed[i / 64] >> (i % 64)) & 1);
+  }
+  return bits;
+}
+
+PatternProperties properties_of(const FileHeader &header) {
+  PatternProperties properties;
+  properties.min_length = header.min_length;
+  properties.max_length = header.max_length;
+  properties.first_bytes = unpack_bits(header.first_bytes);
+  properties.last_bytes = unpack_bits(header.last_bytes);
+  return properties;
+}
+
+struct Mapping {
+  void *address;
+  size_t size;
+  ~Mapping() { munmap(address, size); }
+};
+
+// Writes all of bytes, going on after short writes.
+bool write_all(int fd, std::span<const std::byte> bytes) {
+  while (!bytes.empty()) {
+    ssize_t written = write(fd, bytes.data(), bytes.size());
+    if (written < 0 && errno != EINTR) {
+      return false;
+    }
+    bytes = bytes.subspan(std::max<ssize_t>(written, 0));
+  }
+  return true;
+}
+
+// Never writes path in place: a process with it mapped would see its pages
+// truncated under it and die of SIGBUS.
+bool write_file(const std::filesystem::path &path, FileHeader header,
+                std::span<const std::byte> first,
+                std::span<const std::byte> second) {
+  header.sections[0].offset = align_up(sizeof(FileHeader));
+  header.sections[1].offset =
+      align_up(header.sections[0].offset + first.size());
+  header.file_size = header.sections[1].offset + second.size();
+
+  // unique among the threads and processes saving to the same path
+  static std::atomic<uint64_t> saves{0};
+  std::string partial =
+      fmt::format("{}.{}.{}.tmp", path.string(), getpid(), saves++);
+  int fd = open(partial.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    spdlog::error("could not create {}: {}", partial, strerror(errno));
+    return false;
+  }
+  size_t position = 0;
+  auto write_at = [&](size_t offset, std::span<const std::byte> bytes) {
+    static constexpr std::array<std::byte, SECTION_ALIGNMENT> zeros{};
+    bool written =
+        write_all(fd, std::span{zeros}.first(offset - position)) &&
+        write_all(fd, bytes);
+    position = offset + bytes.size();
+    return written;
+  };
+  bool written = write_at(0, std::as_bytes(std::span{&header, 1})) &&
+                 write_at(header.sections[0].offset, first) &&
+                 write_at(header.sections[1].offset, second) &&
+                 fsync(fd) == 0;
+  written = close(fd) == 0 && written;
+  if (!written || std::rename(partial.c_str(), path.c_str()) != 0) {
+    spdlog::error("could not write automaton to {}: {}", path.string(),
+                  strerror(errno));
+    unlink(partial.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Maps path and checks everything about it but the table contents.
+std::shared_ptr<Mapping> map_file(const std::filesystem::path &path,
+                                  AutomatonKind kind) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    spdlog::error("could not open {}: {}", path.string(), strerror(errno));
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < sizeof(FileHeader)) {
+    spdlog::error("{} is too small to hold an automaton", path.string());
+    close(fd);
+    return nullptr;
+  }
+  void *address = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    spdlog::error("could not map {}: {}", path.string(), strerror(errno));
+    return nullptr;
+  }
+  auto mapping = std::make_shared<Mapping>(address, info.st_size);
+
+  const auto *header = static_cast<const FileHeader *>(address);
+  std::string_view problem;
+  if (header->magic != MAGIC) {
+    problem = "not a bearpig automaton";
+  } else if (header->byte_order != BYTE_ORDER_MARK) {
+    problem = "written on a machine with a different byte order";
+  } else if (header->version != SERIALIZE_VERSION) {
+    problem = "written by an incompatible version";
+  } else if (header->kind != kind) {
+    problem = "holds a different kind of automaton";
+  } else if (header->file_size != mapping->size) {
+    problem = "truncated";
+  }
+  if (!problem.empty()) {
+    spdlog::error("cannot load {}: {}", path.string(), problem);
+    return nullptr;
+  }
+  return mapping;
+}
+
+template <typename T>
+std::optional<std::span<const T>> section(const Mapping &mapping,
+                                          const Section &section) {
+  if (section.offset % alignof(T) != 0 || section.offset > mapping.size ||
+      section.count > (mapping.size - section.offset) / sizeof(T)) {
+    return std::nullopt;
+  }
+  const auto *base = static_cast<const std::byte *>(mapping.address);
+  return std::span<const T>{
+      reinterpret_cast<const T *>(base + section.offset), section.count};
+}
+
+} // namespace
+
+// Befriended by NFA and DFA to get at their tables.
+struct Serializer {
+  static bool save(const NFA &nfa, const std::filesystem::path &path) {
+    FileHeader header{.magic = MAGIC,
+                      .byte_order = BYTE_ORDER_MARK,
+                      .version = SERIALIZE_VERSION,
+                      .kind = AutomatonKind::NFA,
+                      .num_classes = static_cast<uint32_t>(nfa.num_classes),
+                      .special_state = static_cast<uint32_t>(nfa.accept_id),
+                      .starts_with_any = nfa.starts_with_any,
+                      .first_bytes = pack_bits(nfa.analysis.first_bytes),
+                      .byte_classes = nfa.byte_classes,
+                      .num_groups = static_cast<uint32_t>(nfa.num_groups),
+                      .min_length = nfa.analysis.min_length,
+                      .max_length = nfa.analysis.max_length,
+                      .last_bytes = pack_bits(nfa.analysis.last_bytes)};
+    header.sections[0].count = nfa.edge_offsets.size();
+    header.sections[1].count = nfa.edges.size();
+    return write_file(path, header, std::as_bytes(nfa.edge_offsets),
+                      std::as_bytes(nfa.edges));
+  }
+
+  static bool save(const DFA &dfa, const std::filesystem::path &path) {
+    FileHeader header{.magic = MAGIC,
+                      .byte_order = BYTE_ORDER_MARK,
+                      .version = SERIALIZE_VERSION,
+                      .kind = AutomatonKind::DFA,
+                      .num_classes = static_cast<uint32_t>(dfa.num_classes),
+                      .special_state = dfa.start,
+                      .starts_with_any = dfa.starts_with_any,
+                      .first_bytes = pack_bits(dfa.analysis.first_bytes),
+                      .byte_classes = dfa.byte_classes,
+                      .state_width = static_cast<uint32_t>(dfa.table.width()),
+                      .min_length = dfa.analysis.min_length,
+                      .max_length = dfa.analysis.max_length,
+                      .last_bytes = pack_bits(dfa.analysis.last_bytes)};
+    header.sections[0].count = dfa.table.size();
+    header.sections[1].count = dfa.accepting.size();
+    return write_file(path, header, dfa.table.data(),
+                      std::as_bytes(dfa.accepting));
+  }
+
+  static std::optional<NFA> load_nfa(const std::filesystem::path &path,
+                                     RegexFlags flags) {
+    auto mapping = map_file(path, AutomatonKind::NFA);
+    if (!mapping) {
+      return std::nullopt;
+    }
+    const auto *header = static_cast<const FileHeader *>(mapping->address);
+    auto edge_offsets = section<uint32_t>(*mapping, header->sections[0]);
+    auto edges = section<FlatEdge>(*mapping, header->sections[1]);
+    if (!edge_offsets || !edges || edge_offsets->empty() ||
+        edge_offsets->back() != edges->size() ||
+        header->special_state >= edge_offsets->size() - 1 ||
+        header->num_groups > NFA::MAX_GROUPS) {
+      spdlog::error("cannot load {}: corrupt tables", path.string());
+      return std::nullopt;
+    }
+
+    NFA nfa;
+    nfa.states.clear();
+    nfa.accept_id = header->special_state;
+    nfa.num_classes = header->num_classes;
+    nfa.byte_classes = header->byte_classes;
+    nfa.analysis = properties_of(*header);
+    nfa.starts_with_any = header->starts_with_any;
+    nfa.num_groups = header->num_groups;
+    nfa.edge_offsets = *edge_offsets;
+    nfa.edges = *edges;
+    nfa.storage = std::move(mapping);
+    nfa.program_id = next_program_id();
+    // plans are redone rather than stored
+    if (!has_flag(flags, RegexFlags::NFA_ONLY)) {
+      nfa.plan_query();
+    }
+    return nfa;
+  }
+
+  static std::optional<DFA> load_dfa(const std::filesystem::path &path) {
+    auto mapping = map_file(path, AutomatonKind::DFA);
+    if (!mapping) {
+      return std::nullopt;
+    }
+    const auto *header = static_cast<const FileHeader *>(mapping->address);
+    // the table's count is in ids of state_width bytes
+    Section ids = header->sections[0];
+    std::optional<StateTable> table;
+    if (header->state_width <= 4 && ids.count <= SIZE_MAX / 4) {
+      ids.count *= header->state_width;
+      if (auto bytes = section<std::byte>(*mapping, ids)) {
+        table = StateTable::view(*bytes, header->state_width);
+      }
+    }
+    auto accepting = section<uint8_t>(*mapping, header->sections[1]);
+    if (!table || !accepting || header->num_classes == 0 ||
+        table->size() != accepting->size() * header->num_classes ||
+        header->special_state >= accepting->size()) {
+      spdlog::error("cannot load {}: corrupt tables", path.string());
+      return std::nullopt;
+    }
+
+    DFA dfa;
+    dfa.start = header->special_state;
+    dfa.num_classes = header->num_classes;
+    dfa.byte_classes = header->byte_classes;
+    dfa.analysis = properties_of(*header);
+    dfa.starts_with_any = header->starts_with_any;
+    dfa.table = std::move(*table);
+    dfa.accepting = *accepting;
+    dfa.storage = std::move(mapping);
+    return dfa;
+  }
+};
+
+bool save(const NFA &nfa, const std::filesystem::path &path) {
+  return Serializer::save(nfa, path);
+}
+
+bool save(const DFA &dfa, const std::filesystem::path &path) {
+  return Serializer::save(dfa, path);
+}
+
+std::optional<NFA> load_nfa(const std::filesystem::path &path,
+                            RegexFlags flags) {
+  return Serializer::load_nfa(path, flags);
+}
+
+std::optional<DFA> load_dfa(const std::filesystem::path &path) {
+  return Serializer::load_dfa(path);
+}
+
+} // namespace bp
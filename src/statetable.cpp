@@ -0,0 +1,48 @@
+#include <cstring>
+#include <libbearpig/statetable.h>
+
+namespace bp {
+
+namespace {
+template <typename StateId>
+std::vector<std::byte> narrow(std::span<const uint32_t> table) {
+  std::vector<std::byte> bytes(table.size() * sizeof(StateId));
+  for (size_t i = 0; i < table.size(); i++) {
+    auto id = static_cast<StateId>(table[i]);
+    std::memcpy(bytes.data() + i * sizeof(StateId), &id, sizeof(StateId));
+  }
+  return bytes;
+}
+} // namespace
+
+StateTable::StateTable(std::span<const uint32_t> table, size_t num_states)
+    : id_width{width_for(num_states)} {
+  std::vector<std::byte> narrowed;
+  switch (id_width) {
+  case 1:
+    narrowed = narrow<uint8_t>(table);
+    break;
+  case 2:
+    narrowed = narrow<uint16_t>(table);
+    break;
+  default:
+    narrowed = narrow<uint32_t>(table);
+  }
+  auto owned = std::make_shared<const std::vector<std::byte>>(std::move(narrowed));
+  bytes = *owned;
+  storage = std::move(owned);
+}
+
+std::optional<StateTable> StateTable::view(std::span<const std::byte> bytes,
+                                           size_t width) {
+  if ((width != 1 && width != 2 && width != 4) || bytes.size() % width != 0 ||
+      reinterpret_cast<uintptr_t>(bytes.data()) % width != 0) {
+    return std::nullopt;
+  }
+  StateTable table;
+  table.bytes = bytes;
+  table.id_width = width;
+  return table;
+}
+
+} // namespace bp
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <libbearpig/threadpool.h>
+
+namespace bp {
+
+namespace {
+// the pool the calling thread works for, and its index in it
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local size_t current_index = ThreadPool::NOT_A_WORKER;
+} // namespace
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    workers.emplace_back([this, i] { work(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  wait();
+  {
+    std::lock_guard lock{sleep_mutex};
+    stopping = true;
+  }
+  work_available.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+size_t ThreadPool::current_worker() const {
+  return current_pool == this ? current_index : NOT_A_WORKER;
+}
+
+void ThreadPool::submit(Task task) {
+  size_t index = current_worker();
+  if (index == NOT_A_WORKER) {
+    index = next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+  }
+  unfinished.fetch_add(1);
+  {
+    // under the lock so a worker about to sleep cannot miss it, and counted
+    // before it is pushed so a quick thief never takes the count below zero
+    std::lock_guard lock{sleep_mutex};
+    queued.fetch_add(1);
+  }
+  {
+    std::lock_guard lock{queues[index]->mutex};
+    queues[index]->tasks.push_back(std::move(task));
+  }
+  work_available.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock lock{sleep_mutex};
+  all_done.wait(lock, [this] { return unfinished.load() == 0; });
+}
+
+// Own deque from the back, then everybody else's from the front, starting
+// with the next worker so thieves spread out.
+bool ThreadPool::pop(size_t index, Task &task) {
+  for (size_t i = 0; i < queues.size(); i++) {
+    Queue &queue = *queues[(index + i) % queues.size()];
+    std::lock_guard lock{queue.mutex};
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    queued.fetch_sub(1);
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::work(size_t index) {
+  current_pool = this;
+  current_index = index;
+  Task task;
+  while (true) {
+    if (pop(index, task)) {
+      task();
+      task = nullptr;
+      if (unfinished.fetch_sub(1) == 1) {
+        std::lock_guard lock{sleep_mutex};
+        all_done.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock lock{sleep_mutex};
+    work_available.wait(lock,
+                        [this] { return stopping || queued.load() != 0; });
+    if (stopping && queued.load() == 0) {
+      return;
+    }
+  }
+}
+
+} // namespace bp
@@ -0,0 +1,73 @@
+#include <libbearpig/trace.h>
+
+namespace bp {
+
+const char *to_string(TraceEvent event) {
+  switch (event) {
+  case (TraceEvent::SCAN_TOKEN): {
+    return "SCAN_TOKEN";
+  }
+  case (TraceEvent::PARSE_ADVANCE): {
+    return "PARSE_ADVANCE";
+  }
+  case (TraceEvent::PARSE_EXPECT): {
+    return "PARSE_EXPECT";
+  }
+  case (TraceEvent::GEN_ALTERNATIVE): {
+    return "GEN_ALTERNATIVE";
+  }
+  case (TraceEvent::GEN_CONCAT): {
+    return "GEN_CONCAT";
+  }
+  case (TraceEvent::GEN_QUANTIFIED): {
+    return "GEN_QUANTIFIED";
+  }
+  case (TraceEvent::GEN_GROUP): {
+    return "GEN_GROUP";
+  }
+  case (TraceEvent::GEN_SET): {
+    return "GEN_SET";
+  }
+  case (TraceEvent::GEN_SET_ITEM): {
+    return "GEN_SET_ITEM";
+  }
+  case (TraceEvent::GEN_CHAR): {
+    return "GEN_CHAR";
+  }
+  case (TraceEvent::GEN_ANY): {
+    return "GEN_ANY";
+  }
+  case (TraceEvent::GEN_ACCEPT): {
+    return "GEN_ACCEPT";
+  }
+  case (TraceEvent::DFA_STATE_ADDED): {
+    return "DFA_STATE_ADDED";
+  }
+  case (TraceEvent::DFA_FLUSH): {
+    return "DFA_FLUSH";
+  }
+  case (TraceEvent::MATCH_ATTEMPT): {
+    return "MATCH_ATTEMPT";
+  }
+  default: {
+    return "UNKNOWN";
+  }
+  }
+}
+
+TraceBuffer &TraceBuffer::for_this_thread() {
+  static thread_local TraceBuffer buffer;
+  return buffer;
+}
+
+std::vector<TraceRecord> TraceBuffer::snapshot() const {
+  std::vector<TraceRecord> ordered;
+  size_t kept = recorded < CAPACITY ? recorded : CAPACITY;
+  ordered.reserve(kept);
+  for (size_t i = recorded - kept; i < recorded; i++) {
+    ordered.push_back(records[i % CAPACITY]);
+  }
+  return ordered;
+}
+
+} // namespace bp
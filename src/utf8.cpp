@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <libbearpig/utf8.h>
+
+namespace bp {
+
+namespace {
+
+constexpr char32_t SURROGATE_FIRST = 0xD800;
+constexpr char32_t SURROGATE_LAST = 0xDFFF;
+// largest code point encoded in 1, 2 and 3 bytes
+constexpr std::array<char32_t, 3> MAX_FOR_LENGTH{0x7F, 0x7FF, 0xFFFF};
+
+size_t encode(char32_t codepoint, std::array<uint8_t, 4> &bytes) {
+  if (codepoint <= 0x7F) {
+    bytes[0] = codepoint;
+    return 1;
+  }
+  if (codepoint <= 0x7FF) {
+    bytes[0] = 0xC0 | (codepoint >> 6);
+    bytes[1] = 0x80 | (codepoint & 0x3F);
+    return 2;
+  }
+  if (codepoint <= 0xFFFF) {
+    bytes[0] = 0xE0 | (codepoint >> 12);
+    bytes[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+    bytes[2] = 0x80 | (codepoint & 0x3F);
+    return 3;
+  }
+  bytes[0] = 0xF0 | (codepoint >> 18);
+  bytes[1] = 0x80 | ((codepoint >> 12) & 0x3F);
+  bytes[2] = 0x80 | ((codepoint >> 6) & 0x3F);
+  bytes[3] = 0x80 | (codepoint & 0x3F);
+  return 4;
+}
+
+} // namespace
+
+size_t decode_utf8(std::string_view input, char32_t &codepoint) {
+  if (input.empty()) {
+    return 0;
+  }
+  auto lead = static_cast<unsigned char>(input[0]);
+  size_t length;
+  char32_t min;
+  if (lead < 0x80) {
+    codepoint = lead;
+    return 1;
+  } else if ((lead & 0xE0) == 0xC0) {
+    length = 2;
+    min = 0x80;
+    codepoint = lead & 0x1F;
+  } else if ((lead & 0xF0) == 0xE0) {
+    length = 3;
+    min = 0x800;
+    codepoint = lead & 0x0F;
+  } else if ((lead & 0xF8) == 0xF0) {
+    length = 4;
+    min = 0x10000;
+    codepoint = lead & 0x07;
+  } else {
+    return 0;
+  }
+  if (input.size() < length) {
+    return 0;
+  }
+  for (size_t i = 1; i < length; i++) {
+    auto byte = static_cast<unsigned char>(input[i]);
+    if ((byte & 0xC0) != 0x80) {
+      return 0;
+    }
+    codepoint = (codepoint << 6) | (byte & 0x3F);
+  }
+  // overlong encodings, surrogates and values past the last code point
+  if (codepoint < min || codepoint > MAX_CODEPOINT ||
+      (codepoint >= SURROGATE_FIRST && codepoint <= SURROGATE_LAST)) {
+    return 0;
+  }
+  return length;
+}
+
+std::string encode_utf8(char32_t codepoint) {
+  std::array<uint8_t, 4> bytes;
+  size_t length = encode(codepoint, bytes);
+  return std::string{bytes.begin(), bytes.begin() + length};
+}
+
+namespace {
+
+// Cuts a piece off the end of current and pushes it if current spans
+// surrogates, several encoded lengths, or bytes that do not line up. Returns
+// false once current is a single sequence of byte ranges.
+bool split_once(CodepointRange &current, std::vector<CodepointRange> &stack) {
+  if (current.first <= SURROGATE_LAST && current.last >= SURROGATE_FIRST) {
+    if (current.last > SURROGATE_LAST) {
+      stack.push_back({SURROGATE_LAST + 1, current.last});
+    }
+    // leaves current empty if it started among the surrogates
+    current.last = SURROGATE_FIRST - 1;
+    return true;
+  }
+  for (char32_t max : MAX_FOR_LENGTH) {
+    if (current.first <= max && max < current.last) {
+      stack.push_back({max + 1, current.last});
+      current.last = max;
+      return true;
+    }
+  }
+  if (current.last <= 0x7F) {
+    return false;
+  }
+  for (int i = 1; i < 4; i++) {
+    char32_t mask = (char32_t{1} << (6 * i)) - 1;
+    if ((current.first & ~mask) == (current.last & ~mask)) {
+      continue;
+    }
+    if ((current.first & mask) != 0) {
+      stack.push_back({(current.first | mask) + 1, current.last});
+      current.last = current.first | mask;
+      return true;
+    }
+    if ((current.last & mask) != mask) {
+      stack.push_back({current.last & ~mask, current.last});
+      current.last = (current.last & ~mask) - 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+// Splits range the same way RE2 and Rust's utf8-ranges do, until both ends of
+// every piece encode to the same length and only share a prefix of bytes
+// followed by whole continuation ranges.
+void utf8_sequences(CodepointRange range, std::vector<Utf8Sequence> &out) {
+  std::vector<CodepointRange> stack{range};
+  while (!stack.empty()) {
+    CodepointRange current = stack.back();
+    stack.pop_back();
+    current.last = std::min(current.last, MAX_CODEPOINT);
+    while (current.first <= current.last && split_once(current, stack)) {
+    }
+    if (current.first > current.last) {
+      continue;
+    }
+
+    std::array<uint8_t, 4> first;
+    std::array<uint8_t, 4> last;
+    Utf8Sequence sequence{.length = encode(current.first, first)};
+    encode(current.last, last);
+    for (size_t i = 0; i < sequence.length; i++) {
+      sequence.ranges[i] = ByteRange{first[i], last[i]};
+    }
+    out.push_back(sequence);
+  }
+}
+
+namespace {
+
+// Upper case letters that are a fixed distance from their lower case ones.
+// The distance wraps around for lower case letters that come first.
+struct CaseRange {
+  char32_t first;
+  char32_t last;
+  char32_t to_lower;
+};
+
+constexpr std::array<CaseRange, 10> CASE_RANGES{{
+    {U'A', U'Z', 0x20},
+    // Latin-1 without the multiplication sign
+    {0xC0, 0xD6, 0x20},
+    {0xD8, 0xDE, 0x20},
+    // Ÿ, whose lower case ÿ is the last letter of Latin-1
+    {0x178, 0x178, char32_t(0xFF - 0x178)},
+    // Greek without the reserved U+03A2
+    {0x391, 0x3A1, 0x20},
+    {0x3A3, 0x3AB, 0x20},
+    // Σ, σ and the final sigma ς are all one letter, every two of them are
+    // a pair here as variants are not looked up again
+    {0x3A3, 0x3A3, 0x1F},
+    {0x3C2, 0x3C2, 0x01},
+    // Cyrillic, the second row has its lower case letters before the first
+    {0x410, 0x42F, 0x20},
+    {0x400, 0x40F, 0x50},
+}};
+
+} // namespace
+
+void add_case_variants(std::vector<CodepointRange> &ranges) {
+  size_t size = ranges.size();
+  for (size_t i = 0; i < size; i++) {
+    CodepointRange range = ranges[i];
+    for (const CaseRange &upper : CASE_RANGES) {
+      // upper case letters in range, then lower case ones
+      char32_t first = std::max(range.first, upper.first);
+      char32_t last = std::min(range.last, upper.last);
+      if (first <= last) {
+        ranges.push_back({first + upper.to_lower, last + upper.to_lower});
+      }
+      first = std::max<char32_t>(range.first, upper.first + upper.to_lower);
+      last = std::min<char32_t>(range.last, upper.last + upper.to_lower);
+      if (first <= last) {
+        ranges.push_back({first - upper.to_lower, last - upper.to_lower});
+      }
+    }
+  }
+}
+
+void normalize_ranges(std::vector<CodepointRange> &ranges, bool complement) {
+  std::ranges::sort(ranges, {}, &CodepointRange::first);
+  std::vector<CodepointRange> merged;
+  for (CodepointRange range : ranges) {
+    if (!merged.empty() && range.first <= merged.back().last + 1) {
+      merged.back().last = std::max(merged.back().last, range.last);
+    } else {
+      merged.push_back(range);
+    }
+  }
+  if (complement) {
+    std::vector<CodepointRange> outside;
+    char32_t next = 0;
+    for (CodepointRange range : merged) {
+      if (range.first > next) {
+        outside.push_back({next, range.first - 1});
+      }
+      next = range.last + 1;
+    }
+    if (next <= MAX_CODEPOINT) {
+      outside.push_back({next, MAX_CODEPOINT});
+    }
+    merged = std::move(outside);
+  }
+  ranges = std::move(merged);
+}
+
+} // namespace bp
@@ -1,10 +1,18 @@
+#include "libbearpig/compile.h"
+#include "libbearpig/dfa.h"
 #include "libbearpig/nfa.h"
 #include "libbearpig/nfagenvisitor.h"
+#include "libbearpig/queryplan.h"
 #include "libbearpig/regexast.h"
 #include "libbearpig/regexparser.h"
 #include "libbearpig/regexscanner.h"
+#include <algorithm>
+#include <array>
 #include <gtest/gtest.h>
 #include <libbearpig/lib.h>
+#include <random>
+#include <regex>
+#include <thread>
 
 using namespace bp;
 
@@ -141,3 +149,487 @@ TEST(E2E, This_thing_i_found_online) {
     EXPECT_EQ(match.length, 1);
   }
 }
+
+TEST(E2E, Compile_runs_the_whole_pipeline) {
+  const std::string input{"xx abcabd yy"};
+  NFA nfa = compile("ab[cd]");
+
+  auto matches = nfa.find_all_matches(input);
+  EXPECT_EQ(matches.size(), 2);
+  EXPECT_EQ(matches[0].match, "abc");
+  EXPECT_EQ(matches[0].start, 3);
+  EXPECT_EQ(matches[1].match, "abd");
+  EXPECT_EQ(matches[1].start, 6);
+}
+
+TEST(E2E, One_scratch_can_serve_several_nfas) {
+  NFA digits = compile("[0-9]+");
+  NFA words = compile("[a-z]+");
+  MatchScratch scratch;
+
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(digits.find_first_match("abc 123", scratch).match, "123");
+    EXPECT_EQ(words.find_first_match("123 abc", scratch).match, "abc");
+  }
+  EXPECT_TRUE(digits.exact_match("42", scratch).success);
+  EXPECT_FALSE(words.exact_match("42", scratch).success);
+}
+
+TEST(E2E, Tiny_scratch_still_finds_the_longest_match) {
+  NFA nfa = compile("(a|b)*abb");
+  MatchScratch scratch{2};
+
+  auto match = nfa.find_first_match("xxbabababbab", scratch);
+  EXPECT_TRUE(match.success);
+  EXPECT_EQ(match.match, "babababb");
+  EXPECT_EQ(match.start, 2);
+}
+
+TEST(E2E, Nfa_can_be_shared_between_threads) {
+  const NFA nfa = compile("([a-zA-Z]+|[0-9][0-9]?)+");
+  const std::string input{
+      "aaaaaabcbcbabcbcbacbCBACBCBacbcbacb09090abCBab09cb0a)0"};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&nfa, &input] {
+      for (int i = 0; i < 100; i++) {
+        auto matches = nfa.find_all_matches(input);
+        EXPECT_EQ(matches.size(), 2);
+        EXPECT_EQ(matches[1].match, "0");
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+TEST(E2E, Scratch_counts_what_matching_did) {
+  NFA nfa = compile("ab+", RegexFlags::NFA_ONLY);
+  MatchScratch scratch;
+
+  auto matches = nfa.find_all_matches("xxabbb ab", scratch);
+  EXPECT_EQ(matches.size(), 2);
+  MatchStats first = scratch.stats();
+  EXPECT_EQ(first.prefilter_hits, 2);
+  // matches take two bytes, so none is tried at the end of input
+  EXPECT_EQ(first.candidate_starts, 2);
+  EXPECT_GT(first.dfa_cache_misses, 0);
+  EXPECT_GT(first.epsilon_closures, 0);
+  EXPECT_GT(first.peak_memory, 0);
+  EXPECT_EQ(first.dfa_cache_flushes, 0);
+
+  // the second run finds every DFA state in the cache
+  scratch.reset_stats();
+  nfa.find_all_matches("xxabbb ab", scratch);
+  MatchStats second = scratch.stats();
+  EXPECT_EQ(second.dfa_cache_misses, 0);
+  EXPECT_EQ(second.dfa_cache_hits,
+            first.dfa_cache_hits + first.dfa_cache_misses);
+  EXPECT_EQ(second.bytes_scanned, first.bytes_scanned);
+
+  MatchStats total;
+  total += first;
+  total += second;
+  EXPECT_EQ(total.bytes_scanned, 2 * first.bytes_scanned);
+}
+
+TEST(E2E, Captures_report_group_offsets) {
+  NFA nfa = compile("([a-z]+)=([0-9]+)");
+  EXPECT_EQ(nfa.num_captures(), 2);
+  const std::string input{"  key=42;"};
+  std::array<Capture, 3> groups;
+
+  EXPECT_TRUE(nfa.find_first_match(input, groups));
+  EXPECT_EQ(groups[0].in(input), "key=42");
+  EXPECT_EQ(groups[1].start, 2);
+  EXPECT_EQ(groups[1].end, 5);
+  EXPECT_EQ(groups[2].in(input), "42");
+
+  EXPECT_FALSE(nfa.exact_match(input, groups));
+  EXPECT_FALSE(groups[0].matched());
+  EXPECT_TRUE(nfa.exact_match("a=1", groups));
+  EXPECT_EQ(groups[1].in("a=1"), "a");
+}
+
+TEST(E2E, Captures_follow_the_preferred_path_of_the_longest_match) {
+  std::array<Capture, 3> groups;
+  MatchScratch scratch;
+
+  NFA split = compile("(a|ab)(c|bcd)");
+  EXPECT_TRUE(split.exact_match("abcd", groups, scratch));
+  EXPECT_EQ(groups[1].in("abcd"), "a");
+  EXPECT_EQ(groups[2].in("abcd"), "bcd");
+
+  // the first star takes everything it can, the second is left empty
+  NFA greedy = compile("(a*)(a*)");
+  EXPECT_TRUE(greedy.exact_match("aaa", groups, scratch));
+  EXPECT_EQ(groups[1].in("aaa"), "aaa");
+  EXPECT_TRUE(groups[2].matched());
+  EXPECT_EQ(groups[2].start, 3);
+
+  // a repeated group reports its last iteration, a skipped one nothing
+  NFA repeated = compile("(x)?(ab)*");
+  EXPECT_TRUE(repeated.exact_match("ababab", groups, scratch));
+  EXPECT_FALSE(groups[1].matched());
+  EXPECT_EQ(groups[2].start, 4);
+  EXPECT_EQ(groups[2].end, 6);
+}
+
+TEST(E2E, Planner_picks_the_cheapest_engine) {
+  auto engine = [](std::string_view pattern) {
+    return compile(pattern).plan()->engine();
+  };
+  EXPECT_EQ(engine("x"), Engine::MEMCHR);
+  EXPECT_EQ(engine("needle"), Engine::MEMMEM);
+  EXPECT_EQ(engine("(GET|POST|PUT)"), Engine::LITERAL_SET);
+  EXPECT_EQ(engine("[0-9][0-9]:[0-9][0-9]"), Engine::BIT_PARALLEL);
+  EXPECT_EQ(engine("[a-z]+@[a-z]+"), Engine::DFA);
+  EXPECT_EQ(engine("a*"), Engine::DFA);
+  EXPECT_EQ(compile("x", RegexFlags::NFA_ONLY).plan(), nullptr);
+
+  NFA nfa = compile("(ab|abcd)");
+  const QueryPlan *plan = nfa.plan();
+  EXPECT_EQ(plan->literals().size(), 2);
+  EXPECT_EQ(plan->literals().front(), "abcd");
+  EXPECT_NE(plan->describe().find("literal set"), std::string::npos);
+}
+
+TEST(E2E, Every_engine_matches_like_the_nfa) {
+  const std::string input{"x GET /a 12:34 ab abcd POST n@x xx 1:2 needle x"};
+  for (std::string_view pattern :
+       {"x", "needle", "(GET|POST|PUT)", "(ab|abcd)", "[0-9][0-9]:[0-9][0-9]",
+        "[a-z]+@[a-z]+", "a*", "x?"}) {
+    NFA planned = compile(pattern);
+    NFA nfa = compile(pattern, RegexFlags::NFA_ONLY);
+    auto expected = nfa.find_all_matches(input);
+    auto found = planned.find_all_matches(input);
+    ASSERT_EQ(found.size(), expected.size()) << pattern;
+    for (size_t i = 0; i < found.size(); i++) {
+      EXPECT_EQ(found[i].start, expected[i].start) << pattern;
+      EXPECT_EQ(found[i].match, expected[i].match) << pattern;
+    }
+    EXPECT_EQ(planned.find_first_match(input).start,
+              nfa.find_first_match(input).start)
+        << pattern;
+    EXPECT_EQ(planned.find_first_match("").success,
+              nfa.find_first_match("").success)
+        << pattern;
+    for (const auto &match : expected) {
+      EXPECT_TRUE(planned.exact_match(match.match).success) << pattern;
+    }
+    EXPECT_EQ(planned.exact_match(input).success,
+              nfa.exact_match(input).success)
+        << pattern;
+  }
+}
+
+TEST(E2E, Classes_match_whole_utf8_code_points) {
+  for (RegexFlags flags : {RegexFlags::NONE, RegexFlags::NFA_ONLY}) {
+    // "é" is two bytes, "€" three and "😀" four
+    EXPECT_TRUE(compile("caf.", flags).exact_match("café").success);
+    EXPECT_FALSE(compile("caf..", flags).exact_match("café").success);
+    EXPECT_TRUE(compile(".+", flags).exact_match("€😀").success);
+    EXPECT_TRUE(compile("[€$]5", flags).exact_match("€5").success);
+    EXPECT_TRUE(compile("[α-ω]+", flags).exact_match("λογος").success);
+    // accented ό is U+03CC, past ω
+    EXPECT_FALSE(compile("[α-ω]+", flags).exact_match("λόγος").success);
+    EXPECT_EQ(compile("ü", flags).find_first_match("grün").start, 2);
+
+    NFA negative = compile("[^a-z]+", flags);
+    EXPECT_TRUE(negative.exact_match("ÅÄÖ42").success);
+    EXPECT_FALSE(negative.exact_match("Ab").success);
+    auto match = negative.find_first_match("abc€de");
+    EXPECT_EQ(match.start, 3);
+    EXPECT_EQ(match.match, "€");
+  }
+}
+
+TEST(E2E, Case_insensitive_patterns_fold_letters) {
+  for (RegexFlags flags : {RegexFlags::NONE, RegexFlags::NFA_ONLY}) {
+    NFA inline_flag = compile("(?i)error_[a-c]+", flags);
+    EXPECT_TRUE(inline_flag.exact_match("Error_aBC").success);
+    EXPECT_FALSE(inline_flag.exact_match("Error_d").success);
+    auto matches = inline_flag.find_all_matches("ERROR_a;error_CC");
+    ASSERT_EQ(matches.size(), 2);
+    EXPECT_EQ(matches[1].match, "error_CC");
+
+    NFA flag = compile("straße", flags | RegexFlags::CASE_INSENSITIVE);
+    EXPECT_TRUE(flag.exact_match("STRAßE").success);
+    EXPECT_TRUE(compile("(?i)é", flags).exact_match("É").success);
+    EXPECT_TRUE(compile("(?i)λ", flags).exact_match("Λ").success);
+    EXPECT_TRUE(compile("(?i)ÿ", flags).exact_match("Ÿ").success);
+    EXPECT_TRUE(compile("(?i)Ÿ", flags).exact_match("ÿ").success);
+    NFA sigma = compile("(?i)[ς]", flags);
+    EXPECT_TRUE(sigma.exact_match("Σ").success);
+    EXPECT_TRUE(sigma.exact_match("σ").success);
+    for (const char *letter : {"Σ", "σ"}) {
+      EXPECT_TRUE(compile(std::string{"(?i)"} + letter, flags)
+                      .exact_match("ς")
+                      .success)
+          << letter;
+    }
+
+    // the set is folded before it is complemented
+    NFA negative = compile("(?i)[^a-z]+", flags);
+    EXPECT_FALSE(negative.exact_match("Q").success);
+    EXPECT_TRUE(negative.exact_match("12").success);
+    EXPECT_FALSE(compile("[a-z]", flags).exact_match("Q").success);
+  }
+
+  NFA caseless = compile("(?i)needle");
+  EXPECT_EQ(caseless.plan()->engine(), Engine::CASELESS_LITERAL);
+  const std::string input{"NEEDL neeDLE xneedlex NeEdLe"};
+  auto found = caseless.find_all_matches(input);
+  ASSERT_EQ(found.size(), 3);
+  EXPECT_EQ(found[0].start, 6);
+  EXPECT_EQ(found[1].match, "needle");
+  EXPECT_EQ(found[2].match, "NeEdLe");
+  EXPECT_TRUE(caseless.exact_match("nEEDLE").success);
+  // a byte set sequence that does not fold letters pairwise is no literal
+  EXPECT_NE(compile("[aA]b").plan()->engine(), Engine::CASELESS_LITERAL);
+}
+
+TEST(E2E, Line_oriented_matches_stay_within_their_line) {
+  for (RegexFlags flags : {RegexFlags::NONE, RegexFlags::NFA_ONLY}) {
+    NFA nfa = compile("a.*", flags | RegexFlags::LINE_ORIENTED);
+    auto matches = nfa.find_all_matches("xab\nac\n\na");
+    ASSERT_EQ(matches.size(), 3);
+    EXPECT_EQ(matches[0].match, "ab");
+    EXPECT_EQ(matches[1].match, "ac");
+    EXPECT_EQ(matches[2].start, 8);
+    EXPECT_EQ(compile("[^x]+", flags | RegexFlags::LINE_ORIENTED)
+                  .find_first_match("ab\ncd")
+                  .match,
+              "ab");
+    EXPECT_EQ(compile(".+", flags).find_first_match("ab\ncd").match,
+              "ab\ncd");
+  }
+}
+
+TEST(E2E, Is_match_and_count_matches_agree_with_the_full_search) {
+  const std::string input{"x GET /a 12:34 ab abcd POST n@x xx 1:2 needle x"};
+  for (std::string_view pattern :
+       {"x", "needle", "(GET|POST|PUT)", "(ab|abcd)", "[0-9][0-9]:[0-9][0-9]",
+        "[a-z]+@[a-z]+", "a*", "x?", "zz+", "(a|ab)(c|bcd)", ".*q"}) {
+    for (RegexFlags flags : {RegexFlags::NONE, RegexFlags::NFA_ONLY}) {
+      NFA nfa = compile(pattern, flags);
+      for (std::string_view haystack :
+           {std::string_view{input}, std::string_view{}}) {
+        EXPECT_EQ(nfa.is_match(haystack),
+                  nfa.find_first_match(haystack).success)
+            << pattern;
+        EXPECT_EQ(nfa.count_matches(haystack),
+                  nfa.find_all_matches(haystack).size())
+            << pattern;
+      }
+    }
+    auto dfa = DFA::from_nfa(compile(pattern));
+    ASSERT_TRUE(dfa.has_value());
+    EXPECT_EQ(dfa->is_match(input), dfa->find_first_match(input).success);
+    EXPECT_EQ(dfa->count_matches(input), dfa->find_all_matches(input).size());
+  }
+
+  // stops at the first accepting state instead of extending the match
+  NFA nfa = compile("a+", RegexFlags::NFA_ONLY);
+  MatchScratch scratch;
+  EXPECT_TRUE(nfa.is_match("bbbaaaaaaaa", scratch));
+  EXPECT_EQ(scratch.stats().bytes_scanned, 1);
+  EXPECT_EQ(scratch.stats().prefilter_hits, 1);
+}
+
+namespace {
+// A random pattern over a and b, in the syntax std::regex also reads. Nothing
+// repeated has repetitions inside, std::regex backtracks exponentially there.
+std::string random_pattern(std::mt19937 &random, int depth, bool repeats) {
+  std::string pattern;
+  int terms = 1 + random() % 2;
+  for (int term = 0; term < terms; term++) {
+    if (term > 0) {
+      pattern += '|';
+    }
+    int factors = 1 + random() % 3;
+    for (int factor = 0; factor < factors; factor++) {
+      char quantifier = repeats ? "*+?  "[random() % 5] : "?   "[random() % 4];
+      if (depth > 0 && random() % 3 == 0) {
+        bool repeated = quantifier == '*' || quantifier == '+';
+        pattern += '(' + random_pattern(random, depth - 1,
+                                        repeats && !repeated) + ')';
+      } else {
+        pattern += "ab"[random() % 2];
+      }
+      if (quantifier != ' ') {
+        pattern += quantifier;
+      }
+    }
+  }
+  return pattern;
+}
+} // namespace
+
+TEST(E2E, Reduced_nfas_match_like_std_regex) {
+  std::mt19937 random{44};
+  for (int i = 0; i < 300; i++) {
+    std::string pattern = random_pattern(random, 3, true);
+    NFA nfa = compile(pattern, RegexFlags::NFA_ONLY);
+    std::regex expected{pattern};
+    for (int length = 0; length <= 6; length++) {
+      for (int bits = 0; bits < (1 << length); bits++) {
+        std::string input;
+        for (int j = 0; j < length; j++) {
+          input += "ab"[(bits >> j) & 1];
+        }
+        ASSERT_EQ(nfa.exact_match(input).success,
+                  std::regex_match(input, expected))
+            << pattern << " on " << input;
+      }
+    }
+  }
+
+  // one state per byte of a literal and the accepting state, and about half
+  // of what was generated once groups and repetitions are involved
+  EXPECT_EQ(compile("abc", RegexFlags::NFA_ONLY).num_states(), 4);
+  EXPECT_EQ(compile("a|b|c", RegexFlags::NFA_ONLY).num_states(), 2);
+  EXPECT_LE(compile("x?y?z", RegexFlags::NFA_ONLY).num_states(), 4);
+  EXPECT_LE(compile("(a|b)*abb", RegexFlags::NFA_ONLY).num_states(), 11);
+  // equal tails merge however far they are from the end, and a chain of the
+  // same byte does not
+  EXPECT_EQ(compile("xab|yab|zab", RegexFlags::NFA_ONLY).num_states(), 4);
+  EXPECT_EQ(
+      compile(std::string(1000, 'a'), RegexFlags::NFA_ONLY).num_states(), 1001);
+}
+
+TEST(E2E, Pattern_properties_agree_with_every_match) {
+  NFA literal = compile("abc", RegexFlags::NFA_ONLY);
+  EXPECT_EQ(literal.properties().min_length, 3);
+  EXPECT_EQ(literal.properties().max_length, 3);
+  EXPECT_EQ(literal.properties().first_bytes.count(), 1);
+  EXPECT_TRUE(literal.properties().last_bytes.test('c'));
+  NFA repeated = compile("(ab|c)d*");
+  EXPECT_EQ(repeated.properties().min_length, 1);
+  EXPECT_EQ(repeated.properties().max_length, PatternProperties::UNBOUNDED);
+  EXPECT_FALSE(repeated.properties().nullable());
+  EXPECT_TRUE(compile("a*|b").properties().nullable());
+  // properties are in bytes, after case folding and UTF-8
+  NFA folded = compile("(?i)xé");
+  EXPECT_EQ(folded.properties().min_length, 3);
+  EXPECT_TRUE(folded.properties().first_bytes.test('X'));
+  // the last bytes of é and É
+  EXPECT_TRUE(folded.properties().last_bytes.test(0xA9));
+  EXPECT_TRUE(folded.properties().last_bytes.test(0x89));
+
+  // too short or too long to match, so the automaton never runs
+  MatchScratch scratch;
+  EXPECT_FALSE(literal.exact_match("abcd", scratch).success);
+  EXPECT_FALSE(literal.find_first_match("xxab", scratch).success);
+  EXPECT_TRUE(literal.find_all_matches("xxab", scratch).empty());
+  EXPECT_EQ(scratch.stats().candidate_starts, 0);
+  EXPECT_EQ(literal.find_all_matches("xxabc", scratch).size(), 1);
+
+  std::mt19937 random{50};
+  for (int i = 0; i < 200; i++) {
+    bool repeats = i % 2 == 0;
+    std::string pattern = random_pattern(random, 1, repeats);
+    NFA nfa = compile(pattern, RegexFlags::NFA_ONLY);
+    std::regex expected{pattern};
+    size_t shortest = PatternProperties::UNBOUNDED;
+    size_t longest = 0;
+    std::bitset<256> first;
+    std::bitset<256> last;
+    for (int length = 0; length <= 9; length++) {
+      for (int bits = 0; bits < (1 << length); bits++) {
+        std::string input;
+        for (int j = 0; j < length; j++) {
+          input += "ab"[(bits >> j) & 1];
+        }
+        if (!std::regex_match(input, expected)) {
+          continue;
+        }
+        shortest = std::min<size_t>(shortest, length);
+        longest = std::max<size_t>(longest, length);
+        if (!input.empty()) {
+          first.set(input.front());
+          last.set(input.back());
+        }
+      }
+    }
+    const PatternProperties &properties = nfa.properties();
+    EXPECT_EQ(properties.min_length, shortest) << pattern;
+    if (pattern.find_first_of("*+") == std::string::npos) {
+      EXPECT_EQ(properties.max_length, longest) << pattern;
+    } else {
+      EXPECT_EQ(properties.max_length, PatternProperties::UNBOUNDED)
+          << pattern;
+    }
+    EXPECT_EQ(properties.first_bytes, first) << pattern;
+    EXPECT_EQ(properties.last_bytes, last) << pattern;
+  }
+}
+
+TEST(E2E, Dfa_batches_match_like_one_input_at_a_time) {
+  std::mt19937 random{47};
+  std::vector<std::string> records;
+  for (int i = 0; i < 101; i++) {
+    std::string record;
+    for (size_t length = random() % 24; length > 0; length--) {
+      // every other record only of a and b, which the large pattern matches
+      record += "ab01@.x"[random() % (i % 2 == 0 ? 2 : 7)];
+    }
+    records.push_back(record);
+  }
+  std::vector<std::string_view> inputs{records.begin(), records.end()};
+  // over 65536 states, which is a table large enough to be prefetched
+  std::string large{"(a|b)*a"};
+  for (int i = 0; i < 15; i++) {
+    large += "(a|b)";
+  }
+  for (std::string_view pattern : {std::string_view{"[ab]+@[01]+\\.x"},
+                                   std::string_view{large},
+                                   std::string_view{"(a|0|@)*"}}) {
+    auto dfa = DFA::from_nfa(compile(pattern), 100000);
+    ASSERT_TRUE(dfa.has_value());
+    std::vector<bool> batched = dfa->exact_match_batch(inputs);
+    ASSERT_EQ(batched.size(), inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+      EXPECT_EQ(batched[i], dfa->exact_match(inputs[i]).success)
+          << pattern << " on " << inputs[i];
+    }
+  }
+  EXPECT_TRUE(DFA::from_nfa(compile("a"))->exact_match_batch({}).empty());
+}
+
+TEST(E2E, Dfa_reordered_by_a_profile_matches_the_same) {
+  auto dfa = DFA::from_nfa(compile("[a-z]+@[a-z]+\\.(com|org)|[0-9]+"));
+  ASSERT_TRUE(dfa.has_value());
+  std::vector<std::string_view> corpus{"123 4567 89 0", "bob@example.org 12",
+                                       "nothing to see here"};
+  DFA::Profile profile = dfa->profile(corpus);
+  EXPECT_EQ(profile.state_visits.size(), dfa->num_states());
+  EXPECT_GT(profile.hot_states(), 0);
+  EXPECT_LE(profile.hot_states(0.5), profile.hot_states());
+
+  DFA reordered = dfa->reordered(profile);
+  EXPECT_EQ(reordered.num_states(), dfa->num_states());
+  // the hottest states come first now
+  DFA::Profile again = reordered.profile(corpus);
+  EXPECT_TRUE(std::is_sorted(again.state_visits.begin() + 1,
+                             again.state_visits.end(), std::greater{}));
+  EXPECT_EQ(again.hot_states(), profile.hot_states());
+
+  std::mt19937 random{48};
+  for (int round = 0; round < 200; round++) {
+    std::string input;
+    for (size_t i = random() % 30; i > 0; i--) {
+      input += "abo@.cmrg01 "[random() % 12];
+    }
+    auto expected = dfa->find_all_matches(input);
+    auto found = reordered.find_all_matches(input);
+    ASSERT_EQ(found.size(), expected.size()) << input;
+    for (size_t i = 0; i < found.size(); i++) {
+      EXPECT_EQ(found[i].match, expected[i].match) << input;
+    }
+    EXPECT_EQ(reordered.exact_match(input).success,
+              dfa->exact_match(input).success)
+        << input;
+  }
+}
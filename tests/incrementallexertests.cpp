@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <libbearpig/compile.h>
+#include <libbearpig/incrementallexer.h>
+#include <random>
+
+using namespace bp;
+
+namespace {
+void expect_same_tokens(const IncrementalLexer &incremental,
+                        const IncrementalLexer &fresh) {
+  auto a = incremental.tokens();
+  auto b = fresh.tokens();
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); i++) {
+    EXPECT_EQ(a[i].start, b[i].start) << i;
+    EXPECT_EQ(a[i].length, b[i].length) << i;
+    EXPECT_EQ(a[i].matched, b[i].matched) << i;
+    EXPECT_EQ(incremental.token(i).start, a[i].start) << i;
+  }
+  EXPECT_EQ(incremental.num_tokens(), a.size());
+}
+} // namespace
+
+TEST(INCREMENTALLEXER, relexing_only_touches_the_edited_tokens) {
+  NFA nfa = compile("[a-z]+|[0-9]+|;");
+  std::string text;
+  for (int i = 0; i < 2000; i++) {
+    text += "abc;123;";
+  }
+  IncrementalLexer lexer{nfa, 16};
+  lexer.lex(text);
+  EXPECT_EQ(lexer.tokens().size(), 8000);
+
+  // "abc;1x23;" splits the number in two
+  text.insert(8 * 1000 + 5, "x");
+  auto change = lexer.relex(text, {8 * 1000 + 5, 0, 1});
+  EXPECT_EQ(lexer.tokens().size(), 8002);
+  EXPECT_LT(lexer.bytes_lexed(), 200);
+  EXPECT_LT(change.removed, 20);
+  EXPECT_EQ(change.inserted, change.removed + 2);
+  EXPECT_EQ(lexer.tokens()[4000 + 2].length, 1);
+  EXPECT_EQ(lexer.tokens().back().start, text.size() - 1);
+
+  // appending to the last token extends it
+  text += "45";
+  lexer.relex(text, {text.size() - 2, 0, 2});
+  text += "6";
+  auto extended = lexer.relex(text, {text.size() - 1, 0, 1});
+  EXPECT_EQ(extended.inserted, extended.removed);
+  EXPECT_EQ(lexer.tokens().back().length, 3);
+  EXPECT_TRUE(lexer.tokens().back().matched);
+}
+
+TEST(INCREMENTALLEXER, random_edits_lex_like_lexing_from_scratch) {
+  // "ab+" reads ahead, so edits after a token can change it
+  NFA nfa = compile("ab+c|a|b+|[0-9]+");
+  std::mt19937 rng{42};
+  for (size_t interval : {1, 4, 16}) {
+    std::string text;
+    for (int i = 0; i < 300; i++) {
+      text.push_back("abc1 "[rng() % 5]);
+    }
+    IncrementalLexer lexer{nfa, interval};
+    lexer.lex(text);
+    for (int round = 0; round < 500; round++) {
+      size_t start = rng() % (text.size() + 1);
+      // now and then a large cut, which empties the text at times
+      size_t cut = round % 50 == 49 ? rng() % 200 : rng() % 4;
+      size_t removed = std::min<size_t>(cut, text.size() - start);
+      std::string inserted;
+      for (size_t i = rng() % 4; i > 0; i--) {
+        inserted.push_back("abc1 "[rng() % 5]);
+      }
+      text.replace(start, removed, inserted);
+      lexer.relex(text, {start, removed, inserted.size()});
+
+      IncrementalLexer fresh{nfa};
+      fresh.lex(text);
+      expect_same_tokens(lexer, fresh);
+      if (HasFailure()) {
+        FAIL() << "interval " << interval << " round " << round;
+      }
+    }
+  }
+}
+
+TEST(INCREMENTALLEXER, relexing_does_as_much_in_a_long_text) {
+  NFA nfa = compile("[a-z]+|[0-9]+|;");
+  // the most bytes and checkpoints relexing a byte typed and deleted again in
+  // the middle took
+  auto relex_cost = [&](size_t repeats) {
+    std::string text;
+    for (size_t i = 0; i < repeats; i++) {
+      text += "abc;123;";
+    }
+    IncrementalLexer lexer{nfa};
+    lexer.lex(text);
+    size_t bytes = 0;
+    size_t checkpoints = 0;
+    auto relex = [&](IncrementalLexer::Edit edit) {
+      lexer.relex(text, edit);
+      bytes = std::max(bytes, lexer.bytes_lexed());
+      checkpoints = std::max(checkpoints, lexer.checkpoints_written());
+    };
+    for (size_t round = 0; round < 200; round++) {
+      size_t at = text.size() / 2 + round % 16;
+      text.insert(at, "x");
+      relex({at, 0, 1});
+      text.erase(at, 1);
+      relex({at, 1, 0});
+    }
+    return std::pair{bytes, checkpoints};
+  };
+  auto [short_bytes, short_checkpoints] = relex_cost(500);
+  auto [long_bytes, long_checkpoints] = relex_cost(50000);
+  // a hundred times the text, before edits touched every checkpoint after
+  // them
+  EXPECT_LT(short_bytes, 200);
+  EXPECT_LT(long_bytes, 200);
+  EXPECT_LT(short_checkpoints, 8);
+  EXPECT_LT(long_checkpoints, 8);
+}
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include <libbearpig/compile.h>
+#include <libbearpig/inputbuffer.h>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+using namespace bp;
+
+namespace {
+std::vector<std::string> lex(const NFA &nfa, InputBuffer &input) {
+  std::vector<std::string> tokens;
+  while (!input.at_end()) {
+    if (nfa.match_token(input)) {
+      tokens.emplace_back(input.token());
+    } else {
+      input.skip();
+    }
+  }
+  return tokens;
+}
+} // namespace
+
+TEST(INPUTBUFFER, tokens_survive_refills_and_outgrow_the_window) {
+  NFA nfa = compile("[a-z]+|[0-9]+|;");
+  std::istringstream source{"abc;12345678901234567;xy,z"};
+  InputBuffer input{source, 8};
+
+  EXPECT_TRUE(nfa.match_token(input));
+  EXPECT_EQ(input.token(), "abc");
+  EXPECT_EQ(input.token_offset(), 0);
+  EXPECT_TRUE(nfa.match_token(input));
+  EXPECT_TRUE(nfa.match_token(input));
+  EXPECT_EQ(input.token(), "12345678901234567");
+  EXPECT_EQ(input.token_offset(), 4);
+  EXPECT_GE(input.capacity(), 17);
+
+  EXPECT_EQ(lex(nfa, input), (std::vector<std::string>{";", "xy", "z"}));
+  EXPECT_EQ(input.offset(), 26);
+  EXPECT_FALSE(nfa.match_token(input));
+}
+
+TEST(INPUTBUFFER, reads_pipes_and_sentinel_bytes_in_the_input) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  std::thread writer{[fd = fds[1]] {
+    for (int i = 0; i < 1000; i++) {
+      std::string chunk = "word" + std::to_string(i) + ";";
+      EXPECT_EQ(write(fd, chunk.data(), chunk.size()), chunk.size());
+    }
+    close(fd);
+  }};
+  InputBuffer input{fds[0], 64};
+  auto tokens = lex(compile("[a-z]+[0-9]+"), input);
+  writer.join();
+  close(fds[0]);
+  EXPECT_EQ(input.error(), 0);
+  ASSERT_EQ(tokens.size(), 1000);
+  EXPECT_EQ(tokens[999], "word999");
+  EXPECT_EQ(input.capacity(), 64);
+
+  std::istringstream zeros{std::string{"a\0b;c", 5}};
+  InputBuffer with_zeros{zeros, 2};
+  EXPECT_EQ(lex(compile("[^;]+"), with_zeros),
+            (std::vector<std::string>{std::string{"a\0b", 3}, "c"}));
+}
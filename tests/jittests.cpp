@@ -0,0 +1,71 @@
+#include "libbearpig/compile.h"
+#include "libbearpig/jit.h"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+
+using namespace bp;
+
+TEST(JIT, matches_like_the_dfa) {
+  // few ranges, jump tables, self loops with and without accepting, and
+  // patterns that match the empty string
+  const std::vector<std::string> patterns{
+      "abc",          "[a-c]+",      "x[0-9]*y",     "(ab|cd|ef)+",
+      "[a-z]+@[a-z]+\\.(com|org)",   "a?",           "(a|b)*a(a|b)(a|b)",
+      "[a-eg-kn-qs-tv-z0-9]+_",      "[^x]*x",       ".*z"};
+  std::mt19937 rng{7};
+  for (const std::string &pattern : patterns) {
+    auto dfa = DFA::from_nfa(compile(pattern));
+    ASSERT_TRUE(dfa.has_value()) << pattern;
+    JitDFA jit{*dfa};
+    for (int round = 0; round < 200; round++) {
+      std::string input;
+      for (size_t i = rng() % 40; i > 0; i--) {
+        input.push_back("abcdefxyz019@._\n"[rng() % 16]);
+      }
+      EXPECT_EQ(jit.exact_match(input).success, dfa->exact_match(input).success)
+          << pattern << " on " << input;
+      auto first = jit.find_first_match(input);
+      auto expected = dfa->find_first_match(input);
+      EXPECT_EQ(first.success, expected.success) << pattern << " on " << input;
+      EXPECT_EQ(first.match, expected.match) << pattern << " on " << input;
+      EXPECT_EQ(jit.is_match(input), dfa->is_match(input))
+          << pattern << " on " << input;
+      EXPECT_EQ(jit.count_matches(input), dfa->count_matches(input))
+          << pattern << " on " << input;
+    }
+    EXPECT_EQ(jit.exact_match("").success, dfa->exact_match("").success);
+    EXPECT_EQ(jit.is_match(std::string_view{}), dfa->is_match(""));
+  }
+}
+
+TEST(JIT, long_runs_go_through_the_unrolled_loop) {
+  auto dfa = DFA::from_nfa(compile("a[a-z]*!"));
+  ASSERT_TRUE(dfa.has_value());
+  JitDFA jit{*dfa};
+  for (size_t length : {0, 1, 3, 4, 5, 7, 8, 9, 1000}) {
+    std::string input = "a" + std::string(length, 'q') + "!";
+    EXPECT_TRUE(jit.exact_match(input).success) << length;
+    EXPECT_FALSE(jit.exact_match(input + "x").success) << length;
+    EXPECT_EQ(jit.find_first_match("__" + input).length, input.size());
+  }
+}
+
+TEST(JIT, writes_a_perf_map) {
+  auto dfa = DFA::from_nfa(compile("ab+c"));
+  ASSERT_TRUE(dfa.has_value());
+  JitDFA jit{*dfa, {.perf_map = true, .name = "jittest_abc"}};
+  EXPECT_TRUE(jit.exact_match("abbbc").success);
+  if (!jit.is_native()) {
+    GTEST_SKIP() << "no JIT in this build";
+  }
+  std::string path = "/tmp/perf-" + std::to_string(::getpid()) + ".map";
+  std::ifstream map{path};
+  std::stringstream text;
+  text << map.rdbuf();
+  EXPECT_NE(text.str().find("jittest_abc_state"), std::string::npos);
+  EXPECT_NE(text.str().find("jittest_abc_exit"), std::string::npos);
+  std::remove(path.c_str());
+}
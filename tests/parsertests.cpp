@@ -4,13 +4,15 @@
 #include "libbearpig/regextokens.h"
 #include <gtest/gtest.h>
 #include <libbearpig/lib.h>
+#include <memory_resource>
 
 using namespace bp;
 
 TEST(REGEXPARSER, basic_able_to_parse_characters) {
   RegexScanner rs{"a"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -36,16 +38,28 @@ TEST(REGEXPARSER, basic_able_to_parse_characters) {
 TEST(REGEXPARSER, basic_able_to_parse_groups) {
   RegexScanner rs{"((a))"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
 }
 
+TEST(REGEXPARSER, errors_make_parse_give_false) {
+  for (std::string_view pattern : {"(ab", "a)", "[ab", "a|(", "*"}) {
+    RegexScanner rs{pattern};
+    auto tokens = rs.tokenize();
+    RegexParser rp{tokens};
+    EXPECT_FALSE(rp.parse()) << pattern;
+    EXPECT_EQ(rp.get_top_of_expression(), nullptr) << pattern;
+  }
+}
+
 TEST(REGEXPARSER, basic_able_to_parse_sets) {
   RegexScanner rs{"[az]"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -53,7 +67,8 @@ TEST(REGEXPARSER, basic_able_to_parse_sets) {
 TEST(REGEXPARSER, basic_able_to_parse_sets_with_ranges) {
   RegexScanner rs{"[a-d]"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -61,7 +76,8 @@ TEST(REGEXPARSER, basic_able_to_parse_sets_with_ranges) {
 TEST(REGEXPARSER, basic_able_to_parse_sets_with_multiple_ranges) {
   RegexScanner rs{"[a-df0-9]"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -69,7 +85,8 @@ TEST(REGEXPARSER, basic_able_to_parse_sets_with_multiple_ranges) {
 TEST(REGEXPARSER, basic_able_to_parse_negative_sets_with_multiple_ranges) {
   RegexScanner rs{"[^a-df0-9]"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -77,7 +94,8 @@ TEST(REGEXPARSER, basic_able_to_parse_negative_sets_with_multiple_ranges) {
 TEST(REGEXPARSER, basic_able_to_parse_any) {
   RegexScanner rs{"."};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -85,7 +103,8 @@ TEST(REGEXPARSER, basic_able_to_parse_any) {
 TEST(REGEXPARSER, basic_able_to_parse_nested_group_with_any) {
   RegexScanner rs{"((.))"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -93,7 +112,8 @@ TEST(REGEXPARSER, basic_able_to_parse_nested_group_with_any) {
 TEST(REGEXPARSER, basic_able_to_parse_plus) {
   RegexScanner rs{"(a+)+"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -102,7 +122,8 @@ TEST(REGEXPARSER, basic_able_to_parse_plus) {
 TEST(REGEXPARSER, basic_able_to_parse_star) {
   RegexScanner rs{"(a*)*"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -111,7 +132,8 @@ TEST(REGEXPARSER, basic_able_to_parse_star) {
 TEST(REGEXPARSER, basic_able_to_parse_optional) {
   RegexScanner rs{"a?"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -120,7 +142,8 @@ TEST(REGEXPARSER, basic_able_to_parse_optional) {
 TEST(REGEXPARSER, basic_able_to_parse_concat) {
   RegexScanner rs{"aaaaabaab."};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -129,7 +152,8 @@ TEST(REGEXPARSER, basic_able_to_parse_concat) {
 TEST(REGEXPARSER, basic_able_to_parse_a_bunch_of_stuff) {
   RegexScanner rs{"a.+(a?b*c+)*f"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -137,7 +161,8 @@ TEST(REGEXPARSER, basic_able_to_parse_a_bunch_of_stuff) {
 TEST(REGEXPARSER, basic_alternative) {
   RegexScanner rs{"a|b"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
@@ -146,8 +171,38 @@ TEST(REGEXPARSER, basic_alternative) {
 TEST(REGEXPARSER, basic_escape_sequence) {
   RegexScanner rs{R"(a\\)"};
 
-  RegexParser rp{rs.tokenize()};
+  auto tokens = rs.tokenize();
+  RegexParser rp{tokens};
   EXPECT_TRUE(rs.is_at_end());
   EXPECT_TRUE(rp.parse());
   EXPECT_TRUE(rp.is_done());
 }
+
+TEST(REGEXPARSER, ast_is_allocated_from_the_given_resource) {
+  std::pmr::monotonic_buffer_resource arena;
+  RegexScanner rs{"(ab|c)[de]*"};
+
+  auto tokens = rs.tokenize(&arena);
+  RegexParser rp{tokens, &arena};
+  EXPECT_TRUE(rp.parse());
+  EXPECT_TRUE(rp.is_done());
+
+  auto top = rp.get_top_of_expression();
+  EXPECT_EQ(top->alternatives.get_allocator().resource(), &arena);
+  auto &group = std::get<GroupExp>(top->alternatives.front().exps.front().exp);
+  EXPECT_EQ(group.subExp->alternatives.size(), 2);
+  EXPECT_EQ(group.subExp->alternatives.get_allocator().resource(), &arena);
+}
+
+TEST(REGEXPARSER, multi_byte_characters_are_one_token) {
+  RegexScanner rs{"é\xff"};
+
+  auto tokens = rs.tokenize();
+  EXPECT_EQ(tokens.size(), 2);
+  EXPECT_EQ(tokens[0].codepoint, U'é');
+  EXPECT_EQ(tokens[0].length, 2);
+  EXPECT_EQ(tokens[0].text(), "é");
+  // bytes that are not UTF-8 stand for themselves
+  EXPECT_TRUE(tokens[1].is_raw_byte());
+  EXPECT_EQ(tokens[1].column, 2);
+}
@@ -0,0 +1,79 @@
+#include "libbearpig/regexcache.h"
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+using namespace bp;
+
+TEST(REGEXCACHE, same_pattern_is_compiled_once) {
+  RegexCache cache;
+
+  auto first = cache.get("ab+");
+  auto second = cache.get("ab+");
+  EXPECT_EQ(first.get(), second.get());
+
+  auto match = second->find_first_match("xxabbb");
+  EXPECT_TRUE(match.success);
+  EXPECT_EQ(match.match, "abbb");
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.size, 1);
+}
+
+TEST(REGEXCACHE, least_recently_used_entry_is_evicted) {
+  RegexCache cache{2, 1};
+
+  auto a = cache.get("a");
+  cache.get("b");
+  cache.get("a"); // b is now the oldest
+  cache.get("c");
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.size, 2);
+  EXPECT_EQ(stats.evictions, 1);
+
+  EXPECT_EQ(cache.get("a").get(), a.get());
+  cache.get("b");
+  stats = cache.stats();
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.misses, 4);
+
+  // evicted automata stay usable by whoever still holds them
+  cache.clear();
+  EXPECT_TRUE(a->exact_match("a").success);
+}
+
+TEST(REGEXCACHE, concurrent_lookups_share_entries) {
+  RegexCache cache{64, 4};
+  std::vector<std::string> patterns{"a+b", "[0-9]+", "(ab|cd)*e", "x.z"};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&cache, &patterns] {
+      for (int i = 0; i < 200; i++) {
+        for (const auto &pattern : patterns) {
+          auto nfa = cache.get(pattern);
+          EXPECT_NE(nfa, nullptr);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.size, patterns.size());
+  EXPECT_EQ(stats.hits + stats.misses, 4 * 200 * patterns.size());
+  EXPECT_TRUE(cache.get("[0-9]+")->exact_match("2024").success);
+}
+
+TEST(REGEXCACHE, a_pattern_with_an_error_gives_nullptr) {
+  RegexCache cache;
+  EXPECT_EQ(cache.get("(ab"), nullptr);
+  EXPECT_EQ(cache.get("[z-a]"), nullptr);
+  EXPECT_EQ(cache.stats().size, 0);
+  // the cache keeps working for everybody else
+  EXPECT_TRUE(cache.get("ab")->exact_match("ab").success);
+}
@@ -0,0 +1,109 @@
+#include "libbearpig/regexset.h"
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace bp;
+
+TEST(REGEXSET, reports_every_matching_pattern) {
+  const std::vector<std::string> patterns{"GET", "POST", "[0-9]+ms", "ERROR",
+                                          "a*", "/api/v[0-9]/users"};
+  auto set = RegexSet::compile(patterns);
+  ASSERT_TRUE(set.has_value());
+  EXPECT_EQ(set->num_patterns(), 6);
+
+  auto found = set->matches("WARN GET /api/v1/users 200 12ms");
+  EXPECT_EQ(found.patterns(), (std::vector<size_t>{0, 2, 4, 5}));
+  EXPECT_TRUE(found.contains(2));
+  EXPECT_FALSE(found.contains(3));
+  EXPECT_EQ(found.count(), 4);
+
+  EXPECT_EQ(set->exact_matches("POST").patterns(), (std::vector<size_t>{1}));
+  EXPECT_EQ(set->exact_matches("").patterns(), (std::vector<size_t>{4}));
+  EXPECT_EQ(set->exact_matches("aaa").patterns(), (std::vector<size_t>{4}));
+  EXPECT_TRUE(set->exact_matches("GET ").empty());
+  EXPECT_EQ(set->matches("").patterns(), (std::vector<size_t>{4}));
+}
+
+TEST(REGEXSET, agrees_with_each_pattern_on_its_own) {
+  // more than 64 patterns, so the matches span several words
+  std::vector<std::string> patterns;
+  std::vector<NFA> nfas;
+  for (int i = 0; i < 100; i++) {
+    patterns.push_back(std::string{"abc"[i % 3]} + "[" + "ab"[i % 2] +
+                       "-c]" + std::to_string(i % 10) + (i % 4 ? "+" : "*"));
+    nfas.push_back(compile(patterns.back()));
+  }
+  auto set = RegexSet::compile(patterns);
+  ASSERT_TRUE(set.has_value());
+  std::mt19937 random{45};
+  for (int round = 0; round < 200; round++) {
+    std::string input;
+    for (size_t i = random() % 12; i > 0; i--) {
+      input += "abc0123456789"[random() % 13];
+    }
+    auto anywhere = set->matches(input);
+    auto whole = set->exact_matches(input);
+    for (size_t i = 0; i < patterns.size(); i++) {
+      EXPECT_EQ(anywhere.contains(i), nfas[i].is_match(input))
+          << patterns[i] << " in " << input;
+      EXPECT_EQ(whole.contains(i), nfas[i].exact_match(input).success)
+          << patterns[i] << " on " << input;
+    }
+  }
+}
+
+TEST(REGEXSET, a_full_cache_is_rebuilt_as_needed) {
+  // a DFA of over a hundred states, in a cache of 16
+  const std::vector<std::string> patterns{"(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)",
+                                          "b+"};
+  auto small = RegexSet::compile(patterns, RegexFlags::NONE, 16);
+  auto large = RegexSet::compile(patterns);
+  ASSERT_TRUE(small.has_value());
+  ASSERT_TRUE(large.has_value());
+  RegexSet::Scratch small_scratch;
+  RegexSet::Scratch large_scratch;
+  std::mt19937 random{46};
+  for (int round = 0; round < 200; round++) {
+    std::string input;
+    for (size_t i = random() % 40; i > 0; i--) {
+      input += "ab"[random() % 2];
+    }
+    EXPECT_EQ(small->matches(input, small_scratch),
+              large->matches(input, large_scratch))
+        << input;
+    EXPECT_EQ(small->exact_matches(input, small_scratch),
+              large->exact_matches(input, large_scratch))
+        << input;
+  }
+  EXPECT_LE(small_scratch.num_states(), 16);
+  EXPECT_GT(small_scratch.flushes(), 0);
+  EXPECT_EQ(large_scratch.flushes(), 0);
+  EXPECT_TRUE(RegexSet::compile({}).has_value());
+}
+
+TEST(REGEXSET, overlapping_patterns_only_build_the_states_they_reach) {
+  // Determinized up front, word.*codeN for a few hundred N has a state for
+  // every subset of codes seen so far.
+  std::vector<std::string> patterns;
+  for (int i = 0; i < 300; i++) {
+    patterns.push_back("word" + std::to_string(i % 7) + ".*code" +
+                       std::to_string(i));
+  }
+  auto set = RegexSet::compile(patterns);
+  ASSERT_TRUE(set.has_value());
+  RegexSet::Scratch scratch;
+  std::string line{"word3 first code10 then code45 and code290"};
+  // word3 starts the patterns 3 (mod 7), code1 and code29 are not among them
+  EXPECT_EQ(set->matches(line, scratch).patterns(),
+            (std::vector<size_t>{10, 45, 290}));
+  EXPECT_EQ(set->exact_matches(line, scratch).patterns(),
+            (std::vector<size_t>{290}));
+  EXPECT_EQ(set->exact_matches("word0 code14", scratch).patterns(),
+            (std::vector<size_t>{14}));
+  EXPECT_LT(scratch.num_states(), 200);
+}
+
+TEST(REGEXSET, a_pattern_with_an_error_fails_the_set) {
+  std::vector<std::string> patterns{"error", "(warn", "info"};
+  EXPECT_FALSE(RegexSet::compile(patterns).has_value());
+}
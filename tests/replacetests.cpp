@@ -0,0 +1,101 @@
+#include "libbearpig/compile.h"
+#include "libbearpig/replace.h"
+#include <gtest/gtest.h>
+#include <random>
+
+using namespace bp;
+
+namespace {
+std::vector<std::string> pieces(const NFA &nfa, std::string_view input) {
+  std::vector<std::string> pieces;
+  for (std::string_view piece : Split{nfa, input}) {
+    pieces.emplace_back(piece);
+  }
+  return pieces;
+}
+} // namespace
+
+TEST(REPLACE, replaces_every_match_with_a_string_or_a_callback) {
+  NFA email = compile("[a-z]+@[a-z]+\\.com");
+  std::string out;
+  EXPECT_EQ(replace_all(email, "mail bob@example.com or al@x.com now",
+                        "<email>", out),
+            2);
+  EXPECT_EQ(out, "mail <email> or <email> now");
+
+  out = "> ";
+  EXPECT_EQ(replace_all(
+                email, "al@x.com",
+                [](std::string_view match, const Sink &sink) {
+                  sink(std::string(match.size(), '*'));
+                },
+                out),
+            1);
+  EXPECT_EQ(out, "> ********");
+
+  // unchanged spans reach the sink as views into the input
+  std::string_view input = "to bob@example.com!";
+  std::vector<std::string_view> written;
+  replace_all(email, input, "x",
+              [&](std::string_view piece) { written.push_back(piece); });
+  ASSERT_EQ(written.size(), 3);
+  EXPECT_EQ(written[0].data(), input.data());
+  EXPECT_EQ(written[1], "x");
+  EXPECT_EQ(written[2].data(), input.data() + input.size() - 1);
+
+  out.clear();
+  EXPECT_EQ(replace_all(email, "nothing here", "x", out), 0);
+  EXPECT_EQ(out, "nothing here");
+}
+
+TEST(REPLACE, splits_lazily_between_matches) {
+  EXPECT_EQ(pieces(compile(","), "a,,b"),
+            (std::vector<std::string>{"a", "", "b"}));
+  EXPECT_EQ(pieces(compile(","), ""), (std::vector<std::string>{""}));
+  EXPECT_EQ(pieces(compile("[0-9]+"), "12ab3"),
+            (std::vector<std::string>{"", "ab", ""}));
+
+  NFA comma = compile(",");
+  Split split{comma, "a,b,c"};
+  auto it = split.begin();
+  EXPECT_EQ(*it, "a");
+  ++it;
+  EXPECT_EQ(*it, "b");
+}
+
+TEST(REPLACE, agrees_with_find_all_matches) {
+  std::mt19937 random{49};
+  for (std::string pattern : {"[a-c]+", "ab|b", "a*", "c", "(ab)+c?"}) {
+    for (RegexFlags flags : {RegexFlags::NONE, RegexFlags::NFA_ONLY}) {
+      NFA nfa = compile(pattern, flags);
+      for (int round = 0; round < 50; round++) {
+        std::string input;
+        for (size_t i = random() % 20; i > 0; i--) {
+          input += "abcd"[random() % 4];
+        }
+        std::string expected;
+        size_t copied = 0;
+        auto matches = nfa.find_all_matches(input);
+        for (const RegexMatch &match : matches) {
+          expected += input.substr(copied, match.start - copied) + "[" +
+                      match.match + "]";
+          copied = match.start + match.length;
+        }
+        expected += input.substr(copied);
+
+        std::string out;
+        size_t replaced = replace_all(
+            nfa, input,
+            [](std::string_view match, const Sink &sink) {
+              sink("[");
+              sink(match);
+              sink("]");
+            },
+            out);
+        EXPECT_EQ(replaced, matches.size()) << pattern << " " << input;
+        EXPECT_EQ(out, expected) << pattern << " " << input;
+        EXPECT_EQ(pieces(nfa, input).size(), matches.size() + 1);
+      }
+    }
+  }
+}
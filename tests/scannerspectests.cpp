@@ -0,0 +1,126 @@
+#include "libbearpig/scannerspec.h"
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+using namespace bp;
+
+namespace {
+const std::string_view spec_text = R"(# a tiny language
+digit   [0-9]
+letter  [a-z_]
+%%
+IF      if              return IF;
+IDENT   {letter}({letter}|{digit})*   return IDENT;
+NUMBER  {digit}+
+ARROW   \->
+MINUS   \-
+BRACES  \{[a-z]\}
+)";
+
+std::vector<std::string> rule_names(const ScannerSpec &spec,
+                                    const RuleScanner &scanner,
+                                    std::string_view input) {
+  std::vector<std::string> names;
+  for (auto token : scanner.tokenize(input)) {
+    names.push_back(token.rule == RuleScanner::NO_RULE
+                        ? "?"
+                        : spec.rules()[token.rule].name);
+  }
+  return names;
+}
+} // namespace
+
+TEST(SCANNERSPEC, parses_rules_macros_and_actions) {
+  auto spec = ScannerSpec::parse(spec_text);
+  ASSERT_TRUE(spec.has_value());
+  ASSERT_EQ(spec->rules().size(), 6);
+  EXPECT_EQ(spec->rules()[0].action, "return IF;");
+  EXPECT_EQ(spec->rules()[1].pattern, "([a-z_])(([a-z_])|([0-9]))*");
+  EXPECT_EQ(spec->rules()[1].line, 6);
+  EXPECT_EQ(spec->rules()[2].action, "");
+  EXPECT_EQ(spec->rules()[5].pattern, R"(\{[a-z]\})");
+
+  EXPECT_FALSE(ScannerSpec::parse("A {nope}").has_value());
+  EXPECT_FALSE(ScannerSpec::parse("A a\nA b").has_value());
+  EXPECT_FALSE(ScannerSpec::parse("1A a").has_value());
+  EXPECT_FALSE(ScannerSpec::parse("A").has_value());
+  // a rule that does not parse, found without compiling it
+  EXPECT_FALSE(ScannerSpec::parse("A a\nBAD (ab").has_value());
+
+  // an error only compiling finds fails the build
+  auto inverted = ScannerSpec::parse("A a\nBAD [z-a]");
+  ASSERT_TRUE(inverted.has_value());
+  EXPECT_FALSE(inverted->build(RegexFlags::NONE, {}, nullptr, 4).has_value());
+}
+
+TEST(SCANNERSPEC, longest_match_wins_and_then_the_first_rule) {
+  auto spec = ScannerSpec::parse(spec_text);
+  ASSERT_TRUE(spec.has_value());
+  auto scanner = spec->build();
+  ASSERT_TRUE(scanner.has_value());
+  EXPECT_EQ(rule_names(*spec, *scanner, "if"),
+            (std::vector<std::string>{"IF"}));
+  EXPECT_EQ(rule_names(*spec, *scanner, "iffy"),
+            (std::vector<std::string>{"IDENT"}));
+  EXPECT_EQ(rule_names(*spec, *scanner, "x1->42-{a}!"),
+            (std::vector<std::string>{"IDENT", "ARROW", "NUMBER", "MINUS",
+                                      "BRACES", "?"}));
+  auto tokens = scanner->tokenize("ab12->");
+  ASSERT_EQ(tokens.size(), 2);
+  EXPECT_EQ(tokens[1].start, 4);
+  EXPECT_EQ(tokens[1].length, 2);
+}
+
+TEST(SCANNERSPEC, the_scanner_does_not_depend_on_the_thread_count) {
+  std::string text{"digit [0-9]\n%%\n"};
+  std::string input;
+  for (int i = 0; i < 300; i++) {
+    text += "KW" + std::to_string(i) + " kw" + std::to_string(i) + "\n";
+    input += "kw" + std::to_string(i * 7 % 300) + "_";
+  }
+  text += "NUMBER {digit}+\nIDENT [a-z]+\nSEP _\n";
+  auto spec = ScannerSpec::parse(text);
+  ASSERT_TRUE(spec.has_value());
+  auto serial = spec->build(RegexFlags::NONE, {}, nullptr, 1);
+  auto parallel = spec->build(RegexFlags::NONE, {}, nullptr, 8);
+  ASSERT_TRUE(serial.has_value());
+  ASSERT_TRUE(parallel.has_value());
+  EXPECT_EQ(serial->num_states(), parallel->num_states());
+  auto names = rule_names(*spec, *parallel, input);
+  EXPECT_EQ(rule_names(*spec, *serial, input), names);
+  EXPECT_EQ(names[0], "KW0");
+  EXPECT_EQ(names[2], "KW7");
+}
+
+TEST(SCANNERSPEC, only_changed_rules_are_compiled_again) {
+  auto cache = std::filesystem::temp_directory_path() /
+               ("bearpig_" + std::to_string(::getpid()) + "_rulecache");
+  std::filesystem::remove_all(cache);
+
+  auto spec = ScannerSpec::parse(spec_text);
+  ASSERT_TRUE(spec.has_value());
+  ScannerSpec::BuildStats stats;
+  ASSERT_TRUE(spec->build(RegexFlags::NONE, cache, &stats).has_value());
+  EXPECT_EQ(stats.compiled, 6);
+  EXPECT_EQ(stats.cached, 0);
+
+  std::string edited{spec_text};
+  edited.replace(edited.find("{digit}+"), 8, "{digit}+u?");
+  auto changed = ScannerSpec::parse(edited);
+  ASSERT_TRUE(changed.has_value());
+  auto scanner = changed->build(RegexFlags::NONE, cache, &stats);
+  ASSERT_TRUE(scanner.has_value());
+  EXPECT_EQ(stats.compiled, 1);
+  EXPECT_EQ(stats.cached, 5);
+  EXPECT_EQ(rule_names(*changed, *scanner, "if_42u"),
+            (std::vector<std::string>{"IDENT"}));
+  EXPECT_EQ(rule_names(*changed, *scanner, "42u->"),
+            (std::vector<std::string>{"NUMBER", "ARROW"}));
+
+  // other flags make other automata
+  ASSERT_TRUE(
+      changed->build(RegexFlags::CASE_INSENSITIVE, cache, &stats).has_value());
+  EXPECT_EQ(stats.compiled, 6);
+  std::filesystem::remove_all(cache);
+}
@@ -0,0 +1,194 @@
+#include "libbearpig/compile.h"
+#include "libbearpig/dfa.h"
+#include "libbearpig/serialize.h"
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+using namespace bp;
+
+namespace {
+std::filesystem::path temp_file(std::string_view name) {
+  return std::filesystem::temp_directory_path() /
+         ("bearpig_" + std::to_string(::getpid()) + "_" + std::string{name});
+}
+} // namespace
+
+TEST(SERIALIZE, dfa_matches_like_the_nfa) {
+  const std::string input{"xaax"};
+  NFA nfa = compile("(a?)(ab)?");
+  auto dfa = DFA::from_nfa(nfa);
+  ASSERT_TRUE(dfa.has_value());
+
+  EXPECT_FALSE(dfa->exact_match(input).success);
+  EXPECT_EQ(dfa->find_first_match(input).match, "a");
+  auto matches = dfa->find_all_matches(input);
+  EXPECT_EQ(matches.size(), 3);
+  EXPECT_EQ(matches.front().start, 1);
+}
+
+TEST(SERIALIZE, dfa_construction_gives_up_when_too_large) {
+  // the classic exponential blowup, the DFA has to remember the last 8 chars
+  NFA nfa = compile("(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)");
+  EXPECT_FALSE(DFA::from_nfa(nfa, 64).has_value());
+  EXPECT_TRUE(DFA::from_nfa(nfa, 1024).has_value());
+}
+
+TEST(SERIALIZE, nfa_round_trips_through_a_file) {
+  auto path = temp_file("nfa");
+  {
+    NFA nfa = compile("([a-zA-Z]+|[0-9][0-9]?)+");
+    ASSERT_TRUE(save(nfa, path));
+  }
+  auto loaded = load_nfa(path);
+  ASSERT_TRUE(loaded.has_value());
+  auto matches = loaded->find_all_matches("abc123)0");
+  EXPECT_EQ(matches.size(), 2);
+  EXPECT_EQ(matches[0].match, "abc123");
+  EXPECT_EQ(matches[1].match, "0");
+  // the group tags live in the edges
+  std::array<Capture, 2> groups;
+  EXPECT_TRUE(loaded->exact_match("abc123", groups));
+  EXPECT_EQ(groups[1].in("abc123"), "3");
+  EXPECT_NE(loaded->plan(), nullptr);
+
+  // NFA_ONLY maps it back in without planning it, as the scanner does
+  auto unplanned = load_nfa(path, RegexFlags::NFA_ONLY);
+  ASSERT_TRUE(unplanned.has_value());
+  EXPECT_EQ(unplanned->plan(), nullptr);
+  EXPECT_EQ(unplanned->find_all_matches("abc123)0").size(), 2);
+  std::filesystem::remove(path);
+}
+
+TEST(SERIALIZE, dfa_round_trips_through_a_file) {
+  auto path = temp_file("dfa");
+  {
+    auto dfa = DFA::from_nfa(compile("ab[cd]+"));
+    ASSERT_TRUE(dfa.has_value());
+    ASSERT_TRUE(save(*dfa, path));
+  }
+  auto loaded = load_dfa(path);
+  ASSERT_TRUE(loaded.has_value());
+  EXPECT_TRUE(loaded->exact_match("abcdc").success);
+  EXPECT_EQ(loaded->find_first_match("xxabdx").match, "abd");
+  // the pattern's properties are stored with the tables
+  EXPECT_EQ(loaded->properties().min_length, 3);
+  EXPECT_EQ(loaded->properties().max_length, PatternProperties::UNBOUNDED);
+  EXPECT_TRUE(loaded->properties().last_bytes.test('d'));
+  EXPECT_FALSE(loaded->exact_match("ab").success);
+  // an NFA file is not a DFA file
+  EXPECT_FALSE(load_nfa(path).has_value());
+  std::filesystem::remove(path);
+}
+
+TEST(SERIALIZE, saving_over_a_mapped_file_leaves_the_mapping_whole) {
+  auto path = temp_file("replaced");
+  auto small = DFA::from_nfa(compile("ab[cd]+"));
+  ASSERT_TRUE(small.has_value());
+  ASSERT_TRUE(save(*small, path));
+  auto mapped = load_dfa(path);
+  ASSERT_TRUE(mapped.has_value());
+
+  // written in place, the mapping would read the new tables or past the
+  // end of the file
+  auto other = DFA::from_nfa(compile("x"));
+  ASSERT_TRUE(other.has_value());
+  ASSERT_TRUE(save(*other, path));
+  EXPECT_TRUE(mapped->exact_match("abcdcd").success);
+  EXPECT_TRUE(load_dfa(path)->exact_match("x").success);
+
+  // nothing is left beside it
+  size_t files = 0;
+  for (const auto &entry : std::filesystem::directory_iterator{
+           std::filesystem::temp_directory_path()}) {
+    files += entry.path().string().starts_with(path.string());
+  }
+  EXPECT_EQ(files, 1);
+  std::filesystem::remove(path);
+
+  EXPECT_FALSE(save(*small, "/nonexistent/dir/file"));
+}
+
+TEST(SERIALIZE, dfa_tables_use_the_narrowest_state_ids) {
+  auto small = DFA::from_nfa(compile("ab[cd]+"));
+  ASSERT_TRUE(small.has_value());
+  EXPECT_EQ(small->state_width(), 1);
+
+  // more than 256 states, one per last 9 characters
+  NFA nfa = compile("(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)");
+  auto large = DFA::from_nfa(nfa, 1024);
+  ASSERT_TRUE(large.has_value());
+  EXPECT_GT(large->num_states(), 256);
+  EXPECT_EQ(large->state_width(), 2);
+  auto path = temp_file("wide_dfa");
+  ASSERT_TRUE(save(*large, path));
+  auto loaded = load_dfa(path);
+  ASSERT_TRUE(loaded.has_value());
+  EXPECT_EQ(loaded->state_width(), 2);
+  for (std::string_view input :
+       {"abbbbbbbb", "aabbbbbbbb", "babababab", "bbbbbbbbb", "abababababab"}) {
+    EXPECT_EQ(loaded->exact_match(input).success,
+              nfa.exact_match(input).success)
+        << input;
+    EXPECT_EQ(loaded->is_match(input), nfa.is_match(input)) << input;
+  }
+  std::filesystem::remove(path);
+
+  std::vector<uint32_t> ids{0, 1, 65535, 69999};
+  StateTable wide{ids, 70000};
+  EXPECT_EQ(wide.width(), 4);
+  EXPECT_EQ(wide[3], 69999);
+  StateTable narrow{std::span{ids}.first(2), 2};
+  EXPECT_EQ(narrow.width(), 1);
+  EXPECT_EQ(narrow.data().size(), 2);
+  EXPECT_FALSE(StateTable::view(wide.data(), 3).has_value());
+}
+
+TEST(SERIALIZE, rejects_foreign_and_damaged_files) {
+  auto path = temp_file("damaged");
+  {
+    std::ofstream out{path, std::ios::binary};
+    out << "definitely not an automaton, but long enough to hold a header"
+        << std::string(400, 'x');
+  }
+  EXPECT_FALSE(load_nfa(path).has_value());
+
+  ASSERT_TRUE(save(compile("abc"), path));
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+  EXPECT_FALSE(load_nfa(path).has_value());
+  std::filesystem::remove(path);
+}
+
+TEST(SERIALIZE, compile_all_writes_the_same_automata_on_any_thread_count) {
+  std::vector<std::string> patterns;
+  for (int i = 0; i < 200; i++) {
+    patterns.push_back(std::to_string(i) + "(a|b" + std::to_string(i % 7) +
+                       ")*[x-z]+");
+  }
+  auto serial = compile_all(patterns, RegexFlags::NONE, 1);
+  auto parallel = compile_all(patterns, RegexFlags::NONE, 8);
+  ASSERT_EQ(serial.size(), patterns.size());
+  ASSERT_EQ(parallel.size(), patterns.size());
+  auto contents = [](const NFA &nfa) {
+    auto path = temp_file("compile_all");
+    EXPECT_TRUE(save(nfa, path));
+    std::ifstream in{path, std::ios::binary};
+    std::string bytes{std::istreambuf_iterator<char>{in}, {}};
+    std::filesystem::remove(path);
+    return bytes;
+  };
+  for (size_t i = 0; i < patterns.size(); i++) {
+    ASSERT_TRUE(serial[i] && parallel[i]) << patterns[i];
+    EXPECT_EQ(contents(*serial[i]), contents(*parallel[i])) << patterns[i];
+    EXPECT_TRUE(parallel[i]->exact_match(std::to_string(i) + "aaz").success);
+  }
+
+  // a pattern with an error fails its own slot, on a worker, and no other
+  patterns[17] = "(ab";
+  patterns[99] = "[z-a]";
+  auto failed = compile_all(patterns, RegexFlags::NONE, 4);
+  for (size_t i = 0; i < patterns.size(); i++) {
+    EXPECT_EQ(failed[i].has_value(), i != 17 && i != 99) << i;
+  }
+}
@@ -0,0 +1,51 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <libbearpig/threadpool.h>
+#include <mutex>
+#include <set>
+
+using namespace bp;
+
+TEST(THREADPOOL, runs_every_task_including_the_ones_tasks_submit) {
+  ThreadPool pool{4};
+  EXPECT_EQ(pool.size(), 4);
+  EXPECT_EQ(pool.current_worker(), ThreadPool::NOT_A_WORKER);
+
+  std::atomic<int> leaves{0};
+  std::mutex mutex;
+  std::set<size_t> seen_workers;
+  // a binary tree of tasks, 2^10 leaves
+  std::function<void(int)> fan_out = [&](int depth) {
+    {
+      std::lock_guard lock{mutex};
+      seen_workers.insert(pool.current_worker());
+    }
+    if (depth == 0) {
+      leaves++;
+      return;
+    }
+    pool.submit([&fan_out, depth] { fan_out(depth - 1); });
+    pool.submit([&fan_out, depth] { fan_out(depth - 1); });
+  };
+  pool.submit([&fan_out] { fan_out(10); });
+  pool.wait();
+  EXPECT_EQ(leaves.load(), 1 << 10);
+  EXPECT_FALSE(seen_workers.contains(ThreadPool::NOT_A_WORKER));
+  EXPECT_LT(*seen_workers.rbegin(), pool.size());
+
+  // the pool can be waited on again
+  pool.submit([&leaves] { leaves++; });
+  pool.wait();
+  EXPECT_EQ(leaves.load(), (1 << 10) + 1);
+}
+
+TEST(THREADPOOL, destructor_waits_for_pending_tasks) {
+  std::atomic<int> done{0};
+  {
+    ThreadPool pool{2};
+    for (int i = 0; i < 100; i++) {
+      pool.submit([&done] { done++; });
+    }
+  }
+  EXPECT_EQ(done.load(), 100);
+}
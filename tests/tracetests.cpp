@@ -0,0 +1,41 @@
+#include "libbearpig/compile.h"
+#include "libbearpig/trace.h"
+#include <algorithm>
+#include <gtest/gtest.h>
+
+using namespace bp;
+
+TEST(TRACE, ring_buffer_keeps_the_newest_records_in_order) {
+  TraceBuffer buffer;
+  for (uint64_t i = 0; i < TraceBuffer::CAPACITY + 10; i++) {
+    buffer.record(TraceEvent::SCAN_TOKEN, i, 0);
+  }
+  auto records = buffer.snapshot();
+  EXPECT_EQ(records.size(), TraceBuffer::CAPACITY);
+  EXPECT_EQ(buffer.total_recorded(), TraceBuffer::CAPACITY + 10);
+  EXPECT_EQ(records.front().first, 10);
+  EXPECT_EQ(records.back().first, TraceBuffer::CAPACITY + 9);
+
+  buffer.clear();
+  EXPECT_TRUE(buffer.snapshot().empty());
+}
+
+TEST(TRACE, compiling_and_matching_leave_a_trace) {
+  if (!trace_enabled) {
+    GTEST_SKIP() << "built without BEARPIG_TRACE";
+  }
+  TraceBuffer::for_this_thread().clear();
+  NFA nfa = compile("ab", RegexFlags::NFA_ONLY);
+  nfa.find_first_match("xab");
+
+  auto records = TraceBuffer::for_this_thread().snapshot();
+  auto count = [&records](TraceEvent event) {
+    return std::ranges::count_if(records, [event](const TraceRecord &record) {
+      return record.event == event;
+    });
+  };
+  EXPECT_EQ(count(TraceEvent::SCAN_TOKEN), 2);
+  EXPECT_EQ(count(TraceEvent::GEN_CHAR), 2);
+  EXPECT_GT(count(TraceEvent::DFA_STATE_ADDED), 0);
+  EXPECT_EQ(count(TraceEvent::MATCH_ATTEMPT), 1);
+}